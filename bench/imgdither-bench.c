@@ -0,0 +1,382 @@
+/************************************************/
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+/************************************************/
+#include "Bitmap.h"
+#include "DitherImage-Colourspace.h"
+#include "DitherImage-Kernels.h"
+#include "DitherImage-Search.h"
+#include "DitherImage.h"
+#include "Vec4f.h"
+/************************************************/
+
+//! Benchmarks for `make bench`
+//! Usage:
+//!  imgdither-bench load Input.bmp [Runs]
+//!  imgdither-bench search Palette.bmp [Queries] [Colourspace]
+//! Returns 0 on success, or 1 on failure (including search results
+//! that differ between methods).
+
+/************************************************/
+
+//! Palette search methods
+#define SEARCH_LINEAR 0 //! Linear (SIMD) scan over every distinct colour
+#define SEARCH_TREE   1 //! k-d tree
+#define SEARCH_CELLS  2 //! Grid cell candidate lists (falling back to the above)
+#define SEARCH_PAIRS  3 //! Pairwise distance lists (dithered searches only)
+#define SEARCH_COUNT  4
+
+//! Palette search benchmark results
+struct SearchBench_t {
+	uint8_t  Available[SEARCH_COUNT];      //! Search method is built for this palette
+	double   NearestTime[SEARCH_COUNT];    //! Seconds for all closest-colour searches (not for pairs)
+	double   NearestTwoTime[SEARCH_COUNT]; //! Seconds for all closest-two searches (not for pairs)
+	double   DitheredTime[SEARCH_COUNT];   //! Seconds for all dithered searches
+	uint32_t nMismatches;   //! Results that differ from the linear scan (should be 0)
+	uint32_t nInCells;      //! Queries that fell inside the grid
+	double   AvgCandidates; //! Average list length for those queries
+	uint64_t nPairEvals;    //! Distances computed by the dithered searches with the pairwise lists
+	uint64_t nFullEvals;    //! Distances computed by the same searches with full scans
+};
+
+/************************************************/
+
+//! Get time in seconds
+static double GetTime(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1.0e-9;
+}
+
+//! Parse colourspace name (as for `-colspace:` in the CLI)
+static int ParseColourspace(const char *s) {
+	     if(!strcmp(s, "srgb"))      return COLOURSPACE_SRGB;
+	else if(!strcmp(s, "ycbcr"))     return COLOURSPACE_YCBCR;
+	else if(!strcmp(s, "ycocg"))     return COLOURSPACE_YCOCG;
+	else if(!strcmp(s, "cielab"))    return COLOURSPACE_CIELAB;
+	else if(!strcmp(s, "ictcp"))     return COLOURSPACE_ICTCP;
+	else if(!strcmp(s, "oklab"))     return COLOURSPACE_OKLAB;
+	else if(!strcmp(s, "rgb-psy"))   return COLOURSPACE_RGB_PSY;
+	else if(!strcmp(s, "ycbcr-psy")) return COLOURSPACE_YCBCR_PSY;
+	else if(!strcmp(s, "ycocg-psy")) return COLOURSPACE_YCOCG_PSY;
+	else return -1;
+}
+
+/************************************************/
+
+//! Benchmark loading of the input image
+//! The image is loaded nRuns times both with BmpCtx_FromFile(), and by
+//! mapping it and decoding every row to RGBA, and the throughput (in
+//! MB of file data per second) is printed for each.
+static int LoadBenchmark(const char *Filename, uint32_t nRuns) {
+	uint32_t n, y;
+	struct BmpView_t View;
+	if(!BmpView_Open(&View, Filename)) {
+		printf("ERROR: Unable to read input file.\n");
+		return 1;
+	}
+	double FileMB = View.MapSize / 1.0e6;
+	uint32_t Width = View.Width, Height = View.Height, BitCnt = View.BitCnt;
+	BmpView_Close(&View);
+
+	//! Load to BGRA (or indices)
+	double t = GetTime();
+	for(n=0;n<nRuns;n++) {
+		struct BmpCtx_t Image;
+		if(!BmpCtx_FromFile(&Image, Filename)) {
+			printf("ERROR: Unable to read input file.\n");
+			return 1;
+		}
+		BmpCtx_Destroy(&Image);
+	}
+	double tLoad = GetTime() - t;
+
+	//! Map and decode to RGBA
+	uint8_t *Row = malloc((size_t)Width * 4);
+	if(!Row) {
+		printf("ERROR: Out of memory for benchmark.\n");
+		return 1;
+	}
+	t = GetTime();
+	for(n=0;n<nRuns;n++) {
+		uint8_t Format, Palette[BMP_PALETTE_COLOURS*4];
+		if(!BmpView_Open(&View, Filename)) {
+			printf("ERROR: Unable to read input file.\n");
+			free(Row);
+			return 1;
+		}
+		switch(View.BitCnt) {
+			case 8: {
+				Format = DITHER_FORMAT_INDEXED;
+				DitherImage_DecodeRow(Palette, (const uint8_t*)View.Palette, BMP_PALETTE_COLOURS, DITHER_FORMAT_BGRA, NULL);
+			} break;
+			case 24: Format = DITHER_FORMAT_BGR; break;
+			default: Format = View.AlphaUnused ? DITHER_FORMAT_BGRX : DITHER_FORMAT_BGRA; break;
+		}
+		for(y=0;y<View.Height;y++) {
+			DitherImage_DecodeRow(Row, View.Px + (ptrdiff_t)y*View.Stride, View.Width, Format, Palette);
+		}
+		BmpView_Close(&View);
+	}
+	double tMap = GetTime() - t;
+	free(Row);
+
+	printf(
+		"Load benchmark (%ux%u, %u-bit, %.1fMB x %u):\n"
+		"  BmpCtx_FromFile(): %.0f MB/s\n"
+		"  Mapped + decoded:  %.0f MB/s\n",
+		Width, Height, BitCnt, FileMB, nRuns,
+		FileMB*nRuns / tLoad,
+		FileMB*nRuns / tMap
+	);
+	return 0;
+}
+
+/************************************************/
+
+//! Run the palette search benchmark
+//! nQueries opaque colours (in runs of 64, each a small random step from
+//! the last) are converted to the colourspace and searched for in the
+//! palette with each of the search methods, and the results are checked
+//! against the linear scan. Dithered searches cycle through 64
+//! thresholds spread over the matrix range, at the default dither level
+//! of 0.5. The palette is converted as for a dither with no flags.
+//! Returns DITHER_OK on success, or a DITHER_ERROR_* code on failure.
+static uint8_t RunSearchBench(
+	const uint8_t *Palette, //! RGBA
+	uint32_t nPaletteColours,
+	uint8_t  Colourspace,
+	uint32_t nQueries,
+	struct SearchBench_t *Result
+) {
+	uint32_t i, m;
+	const struct DitherKernels_t *Kernels = DitherKernels;
+	*Result = (struct SearchBench_t){.nMismatches = 0};
+
+	//! Prepare palette and queries
+	Vec4f_t *Pal = malloc(nPaletteColours * sizeof(Vec4f_t));
+	Vec4f_t *Px  = malloc(nQueries * sizeof(Vec4f_t));
+	uint8_t *Src = malloc(nQueries * 4);
+	uint8_t *Ref = malloc(nQueries * 4);
+	if(!Pal || !Px || !Src || !Ref) {
+		free(Pal);
+		free(Px);
+		free(Src);
+		free(Ref);
+		return DITHER_ERROR_MEMORY;
+	}
+	uint8_t a = 0xFF;
+	for(i=0;i<nPaletteColours;i++) a &= Palette[i*4+3];
+	Kernels->ConvertRow(Pal, Palette, nPaletteColours, Colourspace, 0, 0);
+
+	//! Like the pixels of a row in an image, each query is a small step
+	//! away from the last, with a jump to a new colour every so often.
+	uint32_t c, Seed = 0x12345678u;
+	for(i=0;i<nQueries;i++) {
+		Seed ^= Seed << 13, Seed ^= Seed >> 17, Seed ^= Seed << 5; //! xorshift32
+		if(i % 64 == 0) memcpy(Src + i*4, &Seed, 3);
+		else for(c=0;c<3;c++) {
+			int32_t v = Src[(i-1)*4+c] + (int32_t)((Seed >> (c*8)) % 9) - 4;
+			Src[i*4+c] = (uint8_t)((v < 0) ? 0 : (v > 0xFF) ? 0xFF : v);
+		}
+		Src[i*4+3] = 0xFF;
+	}
+	Kernels->ConvertRow(Px, Src, nQueries, Colourspace, 0, 0);
+
+	//! Build every search method, and get a view of each
+	//! Queries are opaque, so opaque palettes use the opaque search.
+	struct PalSearch_t Search, Views[SEARCH_COUNT];
+	if(!PalSearch_CreateAll(&Search, Pal, nPaletteColours, 0)) {
+		free(Pal);
+		free(Px);
+		free(Src);
+		free(Ref);
+		return DITHER_ERROR_MEMORY;
+	}
+	const struct PalSearch_t View = (a == 0xFF) ? PalSearch_Opaque(&Search) : Search;
+	for(m=0;m<SEARCH_COUNT;m++) Views[m] = View;
+	for(m=0;m<SEARCH_PAIRS;m++) Views[m].UsePairs = 0;
+	Views[SEARCH_LINEAR].UseTree  = 0;
+	Views[SEARCH_LINEAR].UseCells = 0;
+	Views[SEARCH_TREE  ].UseCells = 0;
+	Result->Available[SEARCH_LINEAR] = 1;
+	Result->Available[SEARCH_TREE  ] = View.UseTree;
+	Result->Available[SEARCH_CELLS ] = View.UseCells && View.Opaque;
+	Result->Available[SEARCH_PAIRS ] = View.UsePairs;
+
+	//! Run searches, checking the results against the linear scan
+	//! The pairwise lists are only used for dithered searches, so the
+	//! others would just repeat the tree or grid for them.
+	for(m=0;m<SEARCH_COUNT;m++) if(Result->Available[m]) {
+		uint8_t  IdxA, IdxB, Hint = 0;
+		float    DistA, DistB;
+		uint64_t nEvals = 0;
+		double   t;
+		if(m != SEARCH_PAIRS) {
+			t = GetTime();
+			for(i=0;i<nQueries;i++) {
+				IdxA = Kernels->FindNearest(&Views[m], &Px[i]);
+				if(m == SEARCH_LINEAR) Ref[i*4+0] = IdxA;
+				else Result->nMismatches += (IdxA != Ref[i*4+0]);
+			}
+			Result->NearestTime[m] = GetTime() - t;
+			t = GetTime();
+			for(i=0;i<nQueries;i++) {
+				Kernels->FindNearestTwo(&Views[m], &Px[i], &IdxA, &DistA, &IdxB, &DistB);
+				if(DistB == INFINITY) IdxB = 0;
+				if(m == SEARCH_LINEAR) Ref[i*4+1] = IdxA, Ref[i*4+2] = IdxB;
+				else Result->nMismatches += (IdxA != Ref[i*4+1] || IdxB != Ref[i*4+2]);
+			}
+			Result->NearestTwoTime[m] = GetTime() - t;
+		}
+		t = GetTime();
+		for(i=0;i<nQueries;i++) {
+			uint32_t nQueryEvals = 0;
+			Vec4f_t  Bias = Vec4f_Broadcast(((float)((i*37u) & 63) * (1.0f/64) - 0.5f) * 0.5f);
+			IdxA = Kernels->FindNearestDithered(&Views[m], &Px[i], &Bias, &Hint, &nQueryEvals);
+			nEvals += nQueryEvals;
+			if(m == SEARCH_LINEAR) Ref[i*4+3] = IdxA;
+			else Result->nMismatches += (IdxA != Ref[i*4+3]);
+		}
+		Result->DitheredTime[m] = GetTime() - t;
+		if(m == SEARCH_LINEAR) Result->nFullEvals = nEvals;
+		if(m == SEARCH_PAIRS)  Result->nPairEvals = nEvals;
+	}
+
+	//! Get cell statistics
+	if(Result->Available[SEARCH_CELLS]) {
+		uint64_t nCandidates = 0;
+		for(i=0;i<nQueries;i++) {
+			uint32_t n = PalSearch_CellCandidates(&View, &Px[i]);
+			Result->nInCells += (n != 0);
+			nCandidates      += n;
+		}
+		if(Result->nInCells) Result->AvgCandidates = (double)nCandidates / Result->nInCells;
+	}
+	PalSearch_Destroy(&Search);
+	free(Pal);
+	free(Px);
+	free(Src);
+	free(Ref);
+	return DITHER_OK;
+}
+
+//! Benchmark the palette search
+//! The time per query is printed for each search method.
+static int SearchBenchmark(const char *PaletteFilename, uint32_t nQueries, uint8_t Colourspace) {
+	static const char *MethodNames[SEARCH_COUNT] = {
+		[SEARCH_LINEAR] = "Linear scan",
+		[SEARCH_TREE]   = "k-d tree",
+		[SEARCH_CELLS]  = "Grid cells",
+		[SEARCH_PAIRS]  = "Pairwise",
+	};
+	uint32_t i, m;
+
+	//! Load palette to RGBA
+	struct BmpCtx_t PaletteImage;
+	if(!BmpCtx_FromFile(&PaletteImage, PaletteFilename)) {
+		printf("ERROR: Unable to read palette image file.\n");
+		return 1;
+	}
+	uint32_t nPaletteColours = PaletteImage.PaletteCount;
+	if(nPaletteColours == 0) {
+		printf("ERROR: Palette image must be 8-bit palettized BMP.\n");
+		BmpCtx_Destroy(&PaletteImage);
+		return 1;
+	}
+	uint8_t Palette[BMP_PALETTE_COLOURS*4];
+	for(i=0;i<nPaletteColours;i++) {
+		Palette[i*4+0] = PaletteImage.Palette[i].r;
+		Palette[i*4+1] = PaletteImage.Palette[i].g;
+		Palette[i*4+2] = PaletteImage.Palette[i].b;
+		Palette[i*4+3] = PaletteImage.Palette[i].a;
+	}
+	BmpCtx_Destroy(&PaletteImage);
+
+	//! Run benchmark
+	struct SearchBench_t Bench;
+	uint8_t Error = RunSearchBench(Palette, nPaletteColours, Colourspace, nQueries, &Bench);
+	if(Error != DITHER_OK) {
+		printf("ERROR: Unable to run search benchmark (%s).\n", DitherImage_ErrorString(Error));
+		return 1;
+	}
+	printf("Search benchmark (%u colours, %u queries):\n", nPaletteColours, nQueries);
+	for(m=0;m<SEARCH_COUNT;m++) {
+		if(!Bench.Available[m]) {
+			printf("  %-12s n/a\n", MethodNames[m]);
+			continue;
+		}
+		if(m == SEARCH_PAIRS) {
+			printf(
+				"  %-12s %7s                %7s                  %7.1f ns/dithered\n",
+				MethodNames[m], "-", "-",
+				Bench.DitheredTime[m] * 1.0e9 / nQueries
+			);
+			continue;
+		}
+		printf(
+			"  %-12s %7.1f ns/nearest, %7.1f ns/nearest-two, %7.1f ns/dithered\n",
+			MethodNames[m],
+			Bench.NearestTime[m]    * 1.0e9 / nQueries,
+			Bench.NearestTwoTime[m] * 1.0e9 / nQueries,
+			Bench.DitheredTime[m]   * 1.0e9 / nQueries
+		);
+	}
+	if(Bench.Available[SEARCH_CELLS]) {
+		printf(
+			"  %.1f%% of queries in grid, %.1f candidates per cell\n",
+			Bench.nInCells * 100.0 / nQueries,
+			Bench.AvgCandidates
+		);
+	}
+	if(Bench.Available[SEARCH_PAIRS]) {
+		printf(
+			"  %.1f distances per dithered search with pairwise lists, against %.1f (%.1f%% avoided)\n",
+			(double)Bench.nPairEvals / nQueries,
+			(double)Bench.nFullEvals / nQueries,
+			Bench.nFullEvals ? (1.0 - (double)Bench.nPairEvals / Bench.nFullEvals) * 100.0 : 0.0
+		);
+	}
+	printf("  %u mismatches against linear scan\n", Bench.nMismatches);
+	return Bench.nMismatches ? 1 : 0;
+}
+
+/************************************************/
+
+int main(int argc, const char *argv[]) {
+	if(argc >= 3 && !strcmp(argv[1], "load")) {
+		int nRuns = (argc > 3) ? atoi(argv[3]) : 10;
+		if(nRuns <= 0) {
+			printf("ERROR: Invalid run count.\n");
+			return 1;
+		}
+		return LoadBenchmark(argv[2], (uint32_t)nRuns);
+	}
+	if(argc >= 3 && !strcmp(argv[1], "search")) {
+		int nQueries = (argc > 3) ? atoi(argv[3]) : 1000000;
+		int Colourspace = (argc > 4) ? ParseColourspace(argv[4]) : COLOURSPACE_YCBCR_PSY;
+		if(nQueries <= 0 || Colourspace == -1) {
+			printf("ERROR: Invalid query count or colourspace.\n");
+			return 1;
+		}
+		return SearchBenchmark(argv[2], (uint32_t)nQueries, (uint8_t)Colourspace);
+	}
+	printf(
+		"Usage:\n"
+		"  imgdither-bench load Input.bmp [Runs]\n"
+		"    Time loading an image (default: 10 times), both in full and by\n"
+		"    mapping it and decoding its rows, and print the throughput.\n"
+		"  imgdither-bench search Palette.bmp [Queries] [Colourspace]\n"
+		"    Time each palette search method on random colours (default:\n"
+		"    1000000 queries in ycbcr-psy), and check that they all agree.\n"
+	);
+	return 1;
+}
+
+/************************************************/
+//! EOF
+/************************************************/
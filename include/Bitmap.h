@@ -2,6 +2,7 @@
 #pragma once
 /************************************************/
 #include <stdint.h>
+#include <stdio.h>
 /************************************************/
 #define BMP_PALETTE_COLOURS 256
 /************************************************/
@@ -42,6 +43,92 @@ uint8_t BmpCtx_FromFile(struct BmpCtx_t *Ctx, const char *Filename);
 //! NOTE: Always 32bit BGRA; 24bit BGR is never used for output.
 uint8_t BmpCtx_ToFile(const struct BmpCtx_t *Ctx, const char *Filename);
 
+//! Memory-mapped view
+//! The file is mapped read-only, and its pixel data is used in place:
+//! row y starts at Px + y*Stride, where Stride is negative for the
+//! usual bottom-up storage (and positive for top-down files), so no
+//! copying or flipping is needed.
+struct BmpView_t {
+	uint32_t Width, Height;
+	uint16_t BitCnt;
+	uint32_t PaletteCount; //! Number of colors in palette (0 if direct color)
+	BGRA8_t  Palette[BMP_PALETTE_COLOURS];
+	uint8_t  AlphaUnused;  //! All alpha values are 0, so image is opaque (32bit only)
+	const uint8_t *Px;     //! First (top) row
+	int32_t  Stride;       //! Bytes from one row to the next
+	void    *Map;          //! Mapped file
+	size_t   MapSize;
+#ifdef _WIN32
+	void    *hFile, *hMap;
+#endif
+};
+
+//! Map file
+//! Returns 0 on failure, or 1 on success.
+//! NOTE: For 32bit BGRA, the pixels are scanned once here to check
+//! whether the alpha channel is used (see BmpCtx_FromFile()).
+uint8_t BmpView_Open(struct BmpView_t *View, const char *Filename);
+
+//! Unmap file
+void BmpView_Close(struct BmpView_t *View);
+
+/************************************************/
+
+//! Streaming reader
+//! This reads an image a band of rows at a time (top to bottom), so
+//! that the image never needs to be held in memory as a whole. Both
+//! bottom-up and top-down (negative height) files are supported.
+struct BmpReader_t {
+	FILE    *File;
+	uint32_t Width, Height;
+	uint16_t BitCnt;
+	uint32_t PaletteCount; //! Number of colors in palette (0 if direct color)
+	BGRA8_t  Palette[BMP_PALETTE_COLOURS];
+	uint32_t DataOffs;     //! Offset of pixel data in file
+	uint32_t RowStride;    //! Bytes per row in file (including padding)
+	uint8_t  FixAlpha;     //! Alpha channel is unused (32bit only)
+	uint8_t  TopDown;      //! Rows are stored top-down in file
+	uint8_t *RowBuf;       //! Raw row data [RowStride]
+};
+
+//! Open file for streaming
+//! Returns 0 on failure, or 1 on success.
+//! NOTE: For 32bit BGRA, the whole file is scanned once here to check
+//! whether the alpha channel is used (see BmpCtx_FromFile()).
+uint8_t BmpReader_Open(struct BmpReader_t *Reader, const char *Filename);
+
+//! Close streaming reader
+void BmpReader_Close(struct BmpReader_t *Reader);
+
+//! Read rows [y,y+nRows) to BGRA
+//! Returns 0 on failure, or 1 on success.
+//! NOTE: Palettized images are expanded through their palette.
+uint8_t BmpReader_ReadRows(struct BmpReader_t *Reader, BGRA8_t *Dst, uint32_t y, uint32_t nRows);
+
+/************************************************/
+
+//! Streaming writer
+//! This writes a palettized image a band of rows at a time. The file
+//! is identical to that written by BmpCtx_ToFile().
+struct BmpWriter_t {
+	FILE    *File;
+	uint32_t Width, Height;
+	uint32_t DataOffs;     //! Offset of pixel data in file
+	uint32_t RowStride;    //! Bytes per row in file (including padding)
+};
+
+//! Create file for streaming
+//! Returns 0 on failure, or 1 on success.
+uint8_t BmpWriter_Open(struct BmpWriter_t *Writer, const char *Filename, uint32_t w, uint32_t h, const BGRA8_t *Palette);
+
+//! Close streaming writer
+//! Returns 0 on failure (eg. data could not be flushed), or 1 on success.
+uint8_t BmpWriter_Close(struct BmpWriter_t *Writer);
+
+//! Write rows [y,y+nRows) of palette indices
+//! Returns 0 on failure, or 1 on success.
+uint8_t BmpWriter_WriteRows(struct BmpWriter_t *Writer, const uint8_t *PxIdx, uint32_t y, uint32_t nRows);
+
 /************************************************/
 //! EOF
 /************************************************/
@@ -0,0 +1,89 @@
+/************************************************/
+#pragma once
+/************************************************/
+#include <stdint.h>
+/************************************************/
+#include "DitherImage-Kernels.h"
+#include "DitherImage-Search.h"
+#include "Vec4f.h"
+/************************************************/
+
+//! Colour cache
+//! This is an open-addressing hash table (with linear probing), keyed
+//! on the packed RGBA8 input colour, that stores the converted colour
+//! and (for undithered output) the matched palette index, so that
+//! repeated colours skip both the colour conversion and the search.
+//! Each thread uses its own cache, so no locking is needed.
+//! NOTE: Cached results are exactly those that would be computed, so
+//! the output is identical with or without the cache.
+//! NOTE: The cache disables itself if, after COLOURCACHE_TRIAL_LOOKUPS
+//! lookups, fewer than 1/COLOURCACHE_MIN_HIT_RATIO of them were hits
+//! (eg. for photographic input with very many unique colours).
+#define COLOURCACHE_SIZE_LOG2      13    //! Table size (log2)
+#define COLOURCACHE_MAX_PROBE      8     //! Maximum entries to probe before giving up
+#define COLOURCACHE_TRIAL_LOOKUPS  16384 //! Lookups before deciding if the cache pays off
+#define COLOURCACHE_MIN_HIT_RATIO  8     //! Minimum hit rate (1/x) to keep the cache enabled
+struct ColourCacheEntry_t {
+	uint32_t Key;    //! Packed RGBA8 colour
+	uint8_t  Used;   //! Entry is occupied
+	uint8_t  HasIdx; //! Idx is valid
+	uint8_t  Idx;    //! Matched palette index (undithered)
+};
+struct ColourCache_t {
+	struct ColourCacheEntry_t *Entries;
+	Vec4f_t *Values;             //! Converted colour for each entry
+	const struct DitherKernels_t *Kernels;
+	uint8_t  Colourspace;
+	uint8_t  PremultipliedAlpha;
+	uint8_t  Approx;
+	uint8_t  OwnsMem;            //! Values (and Entries) were allocated by ColourCache_Create()
+	uint8_t  Enabled;
+	uint64_t nLookups;
+	uint64_t nHits;
+};
+
+//! Memory needed for a colour cache
+//! Values are stored first, so that they keep the alignment of the
+//! memory block.
+#define COLOURCACHE_MEM_SIZE ((1u << COLOURCACHE_SIZE_LOG2) * (sizeof(Vec4f_t) + sizeof(struct ColourCacheEntry_t)))
+
+/************************************************/
+
+//! Create colour cache
+//! Returns 0 on failure, or 1 on success.
+uint8_t ColourCache_Create(
+	struct ColourCache_t *Cache,
+	const struct DitherKernels_t *Kernels,
+	uint8_t Colourspace,
+	uint8_t PremultipliedAlpha,
+	uint8_t Approx
+);
+
+//! Create colour cache in caller-supplied memory
+//! Mem must hold COLOURCACHE_MEM_SIZE bytes, aligned for Vec4f_t, and
+//! stays owned by the caller.
+void ColourCache_CreateInPlace(
+	struct ColourCache_t *Cache,
+	void *Mem,
+	const struct DitherKernels_t *Kernels,
+	uint8_t Colourspace,
+	uint8_t PremultipliedAlpha,
+	uint8_t Approx
+);
+
+//! Destroy colour cache
+void ColourCache_Destroy(struct ColourCache_t *Cache);
+
+//! Convert RGBA8 pixels to the target colourspace
+//! This is the same as DitherKernels_t::ConvertRow(), but cached.
+void ColourCache_ConvertRow(struct ColourCache_t *Cache, Vec4f_t *Dst, const uint8_t *Src, uint32_t n);
+
+//! Map RGBA8 pixels to the closest palette entries (undithered)
+//! This is the same as DitherKernels_t::ConvertRow() followed by
+//! DitherKernels_t::DitherRow() with DITHER_NONE, but cached.
+//! NOTE: A cache must only ever be used with the same palette.
+void ColourCache_MapRow(struct ColourCache_t *Cache, uint8_t *Dst, const uint8_t *Src, uint32_t n, const struct PalSearch_t *Pal);
+
+/************************************************/
+//! EOF
+/************************************************/
@@ -20,6 +20,8 @@ so the numerical values might be different from an exact representation.
 #define DITHER_CHECKER        (0xFF) //! Checkerboard pattern
 #define DITHER_FLOYDSTEINBERG (0xFE) //! Floyd-Steinberg (diffusion)
 #define DITHER_ATKINSON       (0xFD) //! Atkinson (diffusion)
+#define DITHER_MATRIX         (0xFC) //! Ordered dithering with a custom threshold matrix (see DitherMatrix_t)
+#define DITHER_ORDERED_MAX    (   6) //! Largest n for DITHER_ORDERED(n)
 
 /************************************************/
 
@@ -61,12 +63,12 @@ static float VisualRGBtoRGB(float t) {
 
 /************************************************/
 
-//! Convert sRGB <-> XYZ
-static Vec4f_t ConvertRGBtoXYZ(const Vec4f_t *x) {
+//! Convert linear RGB -> XYZ, XYZ -> sRGB
+static Vec4f_t ConvertLinearRGBtoXYZ(const Vec4f_t *x) {
 	Vec4f_t t;
-	float R = RGBtoLinearRGB(x->f32[0]);
-	float G = RGBtoLinearRGB(x->f32[1]);
-	float B = RGBtoLinearRGB(x->f32[2]);
+	float R = x->f32[0];
+	float G = x->f32[1];
+	float B = x->f32[2];
 	t.f32[0] = 0.412453f*R + 0.357580f*G + 0.180423f*B;
 	t.f32[1] = 0.212671f*R + 0.715160f*G + 0.072169f*B;
 	t.f32[2] = 0.019334f*R + 0.119193f*G + 0.950227f*B;
@@ -121,12 +123,12 @@ static Vec4f_t ConvertLabToXYZ(const Vec4f_t *x) {
 
 /************************************************/
 
-//! Convert sRGB <-> LMS
-static Vec4f_t ConvertRGBtoLMS(const Vec4f_t *x) {
+//! Convert linear RGB -> LMS, LMS -> sRGB
+static Vec4f_t ConvertLinearRGBtoLMS(const Vec4f_t *x) {
 	Vec4f_t t;
-	float R = RGBtoLinearRGB(x->f32[0]);
-	float G = RGBtoLinearRGB(x->f32[1]);
-	float B = RGBtoLinearRGB(x->f32[2]);
+	float R = x->f32[0];
+	float G = x->f32[1];
+	float B = x->f32[2];
 	t.f32[0] = 0.412221f*R + 0.536333f*G + 0.051446f*B;
 	t.f32[1] = 0.211903f*R + 0.680700f*G + 0.107397f*B;
 	t.f32[2] = 0.088302f*R + 0.281719f*G + 0.629979f*B;
@@ -192,19 +194,24 @@ static Vec4f_t ConvertOklabToLMS(const Vec4f_t *x) {
 
 /************************************************/
 
-//! Convert RGBA to specified colourspace
-static Vec4f_t ConvertToColourspace(const Vec4f_t *x, uint8_t Colourspace) {
-	Vec4f_t Out, In = *x;
-
-	//! Put colours into linear light space as needed
+//! Apply per-channel transfer function for specified colourspace
+//! This is the first step of ConvertToColourspace() (putting colours
+//! into linear light space as needed), and depends only on the value
+//! of each channel by itself, so it can be tabulated for 8-bit input.
+static float ColourspaceTransfer(float t, uint8_t Colourspace) {
 	switch(Colourspace) {
 		case COLOURSPACE_RGB_LINEAR:
-		case COLOURSPACE_RGB_PSY: {
-			In.f32[0] = RGBtoLinearRGB(In.f32[0]);
-			In.f32[1] = RGBtoLinearRGB(In.f32[1]);
-			In.f32[2] = RGBtoLinearRGB(In.f32[2]);
-		} break;
+		case COLOURSPACE_RGB_PSY:
+		case COLOURSPACE_CIELAB:
+		case COLOURSPACE_ICTCP:
+		case COLOURSPACE_OKLAB: return RGBtoLinearRGB(t);
 	}
+	return t;
+}
+
+//! Convert RGBA to specified colourspace, after ColourspaceTransfer()
+static Vec4f_t ConvertTransferredToColourspace(const Vec4f_t *x, uint8_t Colourspace) {
+	Vec4f_t Out, In = *x;
 
 	//! Apply transformation
 	switch(Colourspace) {
@@ -228,15 +235,15 @@ static Vec4f_t ConvertToColourspace(const Vec4f_t *x, uint8_t Colourspace) {
 			Out.f32[3] = In.f32[3];
 		} break;
 		case COLOURSPACE_CIELAB: {
-			Out = ConvertRGBtoXYZ(&In);
+			Out = ConvertLinearRGBtoXYZ(&In);
 			Out = ConvertXYZtoLab(&Out);
 		} break;
 		case COLOURSPACE_ICTCP: {
-			Out = ConvertRGBtoLMS(&In);
+			Out = ConvertLinearRGBtoLMS(&In);
 			Out = ConvertLMStoICtCp(&Out);
 		} break;
 		case COLOURSPACE_OKLAB: {
-			Out = ConvertRGBtoLMS(&In);
+			Out = ConvertLinearRGBtoLMS(&In);
 			Out = ConvertLMStoOklab(&Out);
 		} break;
 	}
@@ -267,6 +274,15 @@ static Vec4f_t ConvertToColourspace(const Vec4f_t *x, uint8_t Colourspace) {
 	return Out;
 }
 
+//! Convert RGBA to specified colourspace
+static Vec4f_t ConvertToColourspace(const Vec4f_t *x, uint8_t Colourspace) {
+	Vec4f_t In = *x;
+	In.f32[0] = ColourspaceTransfer(In.f32[0], Colourspace);
+	In.f32[1] = ColourspaceTransfer(In.f32[1], Colourspace);
+	In.f32[2] = ColourspaceTransfer(In.f32[2], Colourspace);
+	return ConvertTransferredToColourspace(&In, Colourspace);
+}
+
 //! Convert from specified colourspace to RGBA
 static Vec4f_t ConvertFromColourspace(const Vec4f_t *x, uint8_t Colourspace) {
 	Vec4f_t Out, In = *x;
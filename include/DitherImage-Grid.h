@@ -0,0 +1,92 @@
+/************************************************/
+#pragma once
+/************************************************/
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+/************************************************/
+#include "DitherImage.h"
+#include "DitherImage-Kernels.h"
+#include "DitherImage-Search.h"
+#include "Vec4f.h"
+/************************************************/
+
+//! Ordered dither lookup grid
+//! With ordered dithering, the output index depends only on the input
+//! colour and on the threshold of the matrix entry for the pixel. The
+//! grid splits the target colourspace into GRID^3 cells, and stores
+//! the result for every cell and distinct threshold, so that once the
+//! grid has warmed up, each pixel only needs a table lookup. Entries
+//! are computed when first needed, by dithering the centre of the
+//! cell exactly as the row kernels would.
+//! NOTE: Results are those for the cell centre, so they are only an
+//! approximation of exact dithering; their accuracy depends on the
+//! number of cells, and so on the memory allowed for the grid.
+//! NOTE: The grid may be shared by any number of threads. Entries
+//! only ever go from empty to their (fixed) value, so any thread that
+//! races to compute an entry stores the same value, and the output
+//! never depends on the number of threads.
+//! NOTE: Colours outside the range of the grid (which is found from
+//! the opaque RGB colours), and sources with alpha, are dithered
+//! exactly instead.
+#define DITHERGRID_MAX_LEVELS 4096 //! Maximum distinct thresholds
+#define DITHERGRID_MIN_CELLS  8    //! Minimum cells per axis (below this, the grid isn't worth it)
+#define DITHERGRID_MAX_CELLS  256  //! Maximum cells per axis
+struct DitherGrid_t {
+	_Atomic uint16_t *Entries;   //! Palette index + 1 (or 0 if not yet computed) [nCells^3][nLevels]
+	uint32_t  nCells;            //! Cells per axis
+	uint32_t  nLevels;           //! Distinct thresholds
+	float     Min[3];            //! Lowest value of each channel
+	float     Scale[3];          //! Cells per unit of each channel
+	float     Alpha;             //! Opaque alpha in the target colourspace
+	uint16_t *MatrixLevel;       //! Threshold level of each matrix entry [Height][Width]
+	uint32_t *LevelPos;          //! Position of a matrix entry with each level [nLevels]
+	const struct DitherMatrix_t  *Matrix;
+	float     DitherLevel;
+	const struct DitherKernels_t *Kernels;
+	atomic_ullong nLookups;
+	atomic_ullong nMisses;
+};
+
+//! Memory needed for the grid entries with a given number of cells
+#define DITHERGRID_MEM_SIZE(nCells, nLevels) ((size_t)(nCells)*(nCells)*(nCells) * (nLevels) * sizeof(uint16_t))
+
+/************************************************/
+
+//! Create ordered dither lookup grid
+//! The number of cells is chosen to fit the entries into MaxMemory
+//! bytes (which are only touched as cells are used).
+//! Returns 0 on failure (including if the matrix has too many distinct
+//! thresholds, or if MaxMemory is too small), or 1 on success.
+uint8_t DitherGrid_Create(
+	struct DitherGrid_t *Grid,
+	const struct DitherKernels_t *Kernels,
+	uint8_t  Colourspace,
+	uint8_t  PremultipliedAlpha,
+	uint8_t  Approx,
+	const struct DitherMatrix_t *Matrix,
+	float    DitherLevel,
+	size_t   MaxMemory
+);
+
+//! Destroy ordered dither lookup grid
+void DitherGrid_Destroy(struct DitherGrid_t *Grid);
+
+//! Map pixels [x0,x1) of row y through the grid
+//! This is the same as DitherKernels_t::DitherRow() with the matrix
+//! and level of the grid, but looked up per cell.
+//! NOTE: Pal must be the same for every call, and the source must be
+//! opaque.
+void DitherGrid_MapRow(
+	struct DitherGrid_t *Grid,
+	      uint8_t *Dst,
+	const Vec4f_t *Px,
+	uint32_t x0,
+	uint32_t x1,
+	uint32_t y,
+	const struct PalSearch_t *Pal
+);
+
+/************************************************/
+//! EOF
+/************************************************/
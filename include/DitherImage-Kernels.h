@@ -0,0 +1,138 @@
+/************************************************/
+#pragma once
+/************************************************/
+#include <stdint.h>
+/************************************************/
+#include "DitherImage.h"
+#include "DitherImage-Search.h"
+#include "Vec4f.h"
+/************************************************/
+
+//! Hot-path kernels
+//! The kernels are compiled once per instruction set (see
+//! DitherImage-Kernels-Template.h), and the best set supported by
+//! the CPU is selected when the program or library is loaded.
+//! All kernel sets give bit-identical results.
+//! NOTE: For the row kernels, Dst and Px point at pixel x0, while the
+//! diffusion rows are indexed by absolute x.
+struct DitherKernels_t {
+	const char *Name;      //! Instruction set the kernels were compiled for
+	uint32_t    SimdWidth; //! Palette entries per SIMD step of the search
+
+	//! Palette search (see DitherImage-Search.h)
+	uint8_t (*FindNearest)(const struct PalSearch_t *Pal, const Vec4f_t *x);
+	void    (*FindNearestTwo)(
+		const struct PalSearch_t *Pal,
+		const Vec4f_t *x,
+		uint8_t *IdxA,
+		float   *DistA,
+		uint8_t *IdxB,
+		float   *DistB
+	);
+
+	//! Find closest colour to x, biased by Bias towards the second closest
+	//! This is the search used by DitherRow() for each dithered pixel.
+	//! Hint is the closest match for a nearby colour (eg. the previous
+	//! pixel) to start from, and is updated to the closest match for x.
+	//! nEvals is incremented by the number of distances computed (or by
+	//! the palette size per search, when the pairwise lists aren't used).
+	uint8_t (*FindNearestDithered)(
+		const struct PalSearch_t *Pal,
+		const Vec4f_t *x,
+		const Vec4f_t *Bias,
+		uint8_t  *Hint,
+		uint32_t *nEvals
+	);
+
+	//! Convert RGBA8 pixels to the target colourspace
+	//! When Approx is set, see ConvertRowPlanar().
+	void (*ConvertRow)(
+		      Vec4f_t *Dst,
+		const uint8_t *Src,
+		uint32_t n,
+		uint8_t  Colourspace,
+		uint8_t  PremultipliedAlpha,
+		uint8_t  Approx
+	);
+
+	//! Convert RGBA8 pixels to the target colourspace, into planar rows
+	//! Dst[] receives one array per channel, each of at least n entries.
+	//! When Approx is set, polynomial approximations are used in place
+	//! of cbrtf() and powf() (see DitherImage-Kernels-Convert.h for the
+	//! error bounds); otherwise, the results are exact. Colourspaces
+	//! without either (including ICtCp, which only uses sqrtf() after
+	//! the tabulated sRGB linearisation) are always exact.
+	void (*ConvertRowPlanar)(
+		float *const   Dst[4],
+		const uint8_t *Src,
+		uint32_t n,
+		uint8_t  Colourspace,
+		uint8_t  PremultipliedAlpha,
+		uint8_t  Approx
+	);
+
+	//! Decode n source pixels in a DITHER_FORMAT_* format to RGBA8
+	//! Palette is only used for DITHER_FORMAT_INDEXED (256 RGBA entries).
+	//! Dst may be the same as Src for 4-byte formats.
+	void (*DecodeRow)(
+		      uint8_t *Dst,
+		const uint8_t *Src,
+		uint32_t n,
+		uint8_t  Format,
+		const uint8_t *Palette
+	);
+
+	//! Map pixels [x0,x1) of row y, ordered by a threshold matrix
+	//! Matrix may be NULL for no dithering (DITHER_NONE).
+	void (*DitherRow)(
+		      uint8_t *Dst,
+		const Vec4f_t *Px,
+		uint32_t x0,
+		uint32_t x1,
+		uint32_t y,
+		const struct DitherMatrix_t *Matrix,
+		float    DitherLevel,
+		const struct PalSearch_t *Pal
+	);
+
+	//! Map pixels [x0,x1) with error diffusion, propagating into the diffusion rows
+	void (*DiffuseRow_FloydSteinberg)(
+		      uint8_t *Dst,
+		const Vec4f_t *Px,
+		uint32_t x0,
+		uint32_t x1,
+		float    DitherLevel,
+		const struct PalSearch_t *Pal,
+		Vec4f_t *y0,
+		Vec4f_t *y1
+	);
+	void (*DiffuseRow_Atkinson)(
+		      uint8_t *Dst,
+		const Vec4f_t *Px,
+		uint32_t x0,
+		uint32_t x1,
+		float    DitherLevel,
+		const struct PalSearch_t *Pal,
+		Vec4f_t *y0,
+		Vec4f_t *y1,
+		Vec4f_t *y2
+	);
+};
+
+/************************************************/
+
+//! Kernel sets
+//! NOTE: Sets whose instruction set is not available to the compiler
+//! (eg. on non-x86 targets) contain the generic kernels instead.
+extern const struct DitherKernels_t DitherKernels_Generic;
+extern const struct DitherKernels_t DitherKernels_AVX2;
+extern const struct DitherKernels_t DitherKernels_AVX512;
+
+//! Active kernel set
+//! This is selected at load time, and can be forced to a narrower set
+//! by setting the environment variable IMGDITHER_ISA to "generic" or "avx2".
+extern const struct DitherKernels_t *DitherKernels;
+
+/************************************************/
+//! EOF
+/************************************************/
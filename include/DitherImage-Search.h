@@ -0,0 +1,131 @@
+/************************************************/
+#pragma once
+/************************************************/
+#include <stdint.h>
+/************************************************/
+#include "Vec4f.h"
+/************************************************/
+
+//! Palette search index
+//! This is a k-d tree over the (converted) palette entries, stored
+//! implicitly as a median-ordered array: the node for the range
+//! [Lo,Hi) lives at (Lo+Hi)/2, with its children in [Lo,Mid) and
+//! [Mid+1,Hi). Ranges of PALSEARCH_LEAF_SIZE or fewer entries are
+//! leaves, and are scanned linearly.
+//! The tree-ordered entries are also stored as structure-of-arrays
+//! (one array per channel), so that leaves can be scanned several
+//! entries at a time with SIMD. Palettes that are too small for the
+//! tree to pay off are left in palette order and scanned directly.
+//! Duplicate entries are left out of all of these, as only the lowest
+//! index of identical colours can ever match. Entries below FirstCol
+//! (eg. a clear colour 0) are left out as well, and are never matched.
+//! For opaque searches, there is also a uniform grid of cells over
+//! the bounding box of the palette (plus a margin), where each cell
+//! lists the entries that may be the closest two to any point in the
+//! cell, along with a lower bound on the distance to all the others.
+//! A lookup scans only the list of its cell, and the result is kept
+//! if it is closer than that bound (so that no other entry can match);
+//! otherwise, or for points outside the grid, the tree (or the linear
+//! scan) is used instead.
+//! For dithered searches (see DitherKernels_t::FindNearestDithered()),
+//! each entry also keeps a list of all the entries sorted by their
+//! distance from it. By the triangle inequality, no entry that is
+//! further from the current best match than twice its distance (or,
+//! for the closest two, than the sum of both distances) can improve
+//! on it, so a search starting from a nearby entry (eg. the match of
+//! the previous pixel) only needs to scan the head of its list,
+//! moving to the list of each better match as it is found (as in
+//! Orchard's algorithm).
+//! NOTE: All searches return exactly the same results as a linear
+//! scan over the palette, including tie-breaking on the lowest index.
+#define PALSEARCH_LEAF_SIZE     16 //! Maximum entries per leaf
+#define PALSEARCH_SOA_PAD       16 //! Padding entries at end of SoA arrays (max SIMD width)
+#define PALSEARCH_CELLS         16 //! Grid cells per axis
+struct PalSearch_t {
+	uint32_t nCols;
+	uint32_t FirstCol;   //! First entry that may be matched
+	uint32_t nDistinct;  //! Distinct entries (the only ones held by the tree and lists)
+	uint8_t  UseTree;    //! Whether the tree is used (else linear scan)
+	uint8_t  UseCells;   //! Whether the grid is used (opaque searches only)
+	uint8_t  UsePairs;   //! Whether pairwise lists are used (dithered searches only)
+	uint8_t  Opaque;     //! Skip the alpha channel (see PalSearch_Opaque())
+	const Vec4f_t *Pal;  //! Palette (not owned by this context)
+	Vec4f_t *TreePt;     //! Tree nodes: Colour
+	uint8_t *TreeIdx;    //! Tree nodes: Palette index
+	uint8_t *TreeAxis;   //! Tree nodes: Split axis
+	float   *SoaPt[4];   //! Tree nodes: Colour (one array per channel, NaN-padded)
+	float   *SoaIdx;     //! Tree nodes: Palette index (as float, for SIMD compares)
+	void    *SoaMem;     //! Allocation backing SoaPt[] and SoaIdx
+	float    CellMin[3];   //! Lowest corner of the grid
+	float    CellScale[3]; //! Cells per unit of each channel
+	uint32_t *CellOffs;  //! Grid cells: Offset of each list in CellIdx [PALSEARCH_CELLS^3+1]
+	uint8_t  *CellIdx;   //! Grid cells: Candidate palette indices (ascending)
+	float    *CellBound; //! Grid cells: Lower bound on the distance to any other entry [PALSEARCH_CELLS^3]
+	uint8_t  *PairIdx;   //! Pairs: Every distinct palette index, by distance from each entry [nCols][nDistinct]
+	float    *PairDist;  //! Pairs: Distance (not squared, rounded down) of those entries [nCols][nDistinct]
+};
+
+//! Get grid cell holding a colour
+//! Returns the cell index, or -1 if x is outside the grid (or NaN).
+static inline int32_t PalSearch_CellOf(const struct PalSearch_t *Ctx, const Vec4f_t *x) {
+	uint32_t c, Cell[3];
+	for(c=0;c<3;c++) {
+		float f = (x->f32[c] - Ctx->CellMin[c]) * Ctx->CellScale[c];
+		if(!(f >= 0.0f && f < (float)PALSEARCH_CELLS)) return -1;
+		Cell[c] = (uint32_t)f;
+	}
+	return (int32_t)((Cell[2]*PALSEARCH_CELLS + Cell[1])*PALSEARCH_CELLS + Cell[0]);
+}
+
+/************************************************/
+
+//! Create search index
+//! Returns 0 on failure, or 1 on success.
+//! NOTE: Pal must remain valid for the lifetime of the context.
+//! NOTE: If memory for the tree cannot be allocated, searches will
+//! fall back to a linear scan, so the context is always usable.
+//! NOTE: Entries below FirstCol are never matched, unless there are no
+//! others, in which case all searches return index 0.
+uint8_t PalSearch_Create(struct PalSearch_t *Ctx, const Vec4f_t *Pal, uint32_t nCols, uint32_t FirstCol);
+
+//! Create search index with all search methods
+//! Same as PalSearch_Create(), but the tree, grid and pairwise lists
+//! are built (and used) even for small palettes. This is only useful
+//! for benchmarks.
+uint8_t PalSearch_CreateAll(struct PalSearch_t *Ctx, const Vec4f_t *Pal, uint32_t nCols, uint32_t FirstCol);
+
+//! Get opaque view of search index
+//! Searches through the view skip the alpha channel in distances. For
+//! an opaque palette, and opaque colours to search for, the distances
+//! are identical, as the alpha channels are then always equal. The view
+//! shares all memory with Ctx, so it must not be destroyed itself.
+struct PalSearch_t PalSearch_Opaque(const struct PalSearch_t *Ctx);
+
+//! Destroy search index
+void PalSearch_Destroy(struct PalSearch_t *Ctx);
+
+//! Find closest colour in palette
+uint8_t PalSearch_FindNearest(const struct PalSearch_t *Ctx, const Vec4f_t *x);
+
+//! Find closest two colours in palette
+//! The second match is the closest entry whose distance is strictly
+//! greater than that of the first match (ie. duplicate entries, and
+//! entries at the same distance, are never returned as IdxB).
+//! If there is no such entry, DistB is set to INFINITY.
+void PalSearch_FindNearestTwo(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint8_t *IdxA,
+	float   *DistA,
+	uint8_t *IdxB,
+	float   *DistB
+);
+
+//! Get candidates for a colour
+//! Returns the number of entries in the list of the grid cell holding
+//! x, or 0 if x is outside the grid (or the grid isn't used).
+uint32_t PalSearch_CellCandidates(const struct PalSearch_t *Ctx, const Vec4f_t *x);
+
+/************************************************/
+//! EOF
+/************************************************/
@@ -0,0 +1,46 @@
+/************************************************/
+#pragma once
+/************************************************/
+#include <stdatomic.h>
+#include <stdint.h>
+/************************************************/
+
+//! Colour conversion tables
+//! Source pixels are 8-bit, so the per-channel transfer step of each
+//! colourspace (see ColourspaceTransfer()) is tabulated, which skips
+//! the powf() calls of sRGB linearisation. For colourspaces where the
+//! whole conversion is per-channel (sRGB, linear RGB, RGB + Psyopt),
+//! the tables hold the final converted values instead.
+//! Optionally, a full 24-bit RGB table can also be built, which skips
+//! the conversion entirely. This takes COLOURTABLES_RGB_SIZE bytes per
+//! colourspace, so it only pays off for batch jobs over many pixels.
+//! All tables are built once, and then shared by all calls and threads.
+//! NOTE: Table lookups give exactly the same results as converting.
+#define COLOURTABLES_COUNT    10 //! Number of colourspaces
+#define COLOURTABLES_RGB_SIZE ((size_t)(1u << 24) * 3 * sizeof(float))
+struct ColourTables_t {
+	uint8_t Separable;        //! Conversion is entirely per-channel
+	float   Channel[3][256];  //! Per-channel values (RGB only; alpha is always x/255)
+	_Atomic(float*) RGB;      //! Full table [B<<16 | G<<8 | R][3] (or NULL)
+};
+
+/************************************************/
+
+//! Get tables for colourspace
+//! Returns NULL for unknown colourspaces.
+const struct ColourTables_t *ColourTables_Get(uint8_t Colourspace);
+
+//! Build full 24-bit RGB table for colourspace
+//! Returns 0 on failure, or 1 on success.
+//! NOTE: This does nothing for colourspaces that are Separable, as
+//! the per-channel tables are already as fast.
+//! NOTE: The table is built using nThreads threads (0 = one per core).
+uint8_t ColourTables_CreateRGB(uint8_t Colourspace, uint32_t nThreads);
+
+//! Release all full 24-bit RGB tables
+//! NOTE: This must not be called while any dithering is in progress.
+void ColourTables_DestroyRGB(void);
+
+/************************************************/
+//! EOF
+/************************************************/
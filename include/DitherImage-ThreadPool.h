@@ -0,0 +1,54 @@
+/************************************************/
+#pragma once
+/************************************************/
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+/************************************************/
+
+//! Job function
+//! Job is the index of the job to run, and Thread is the index of the
+//! thread running it (0 = calling thread), for per-thread scratch data.
+typedef void (*ThreadPool_JobFunc_t)(void *Arg, uint32_t Job, uint32_t Thread);
+
+//! Thread pool
+//! Jobs of a batch are claimed dynamically by all threads (including
+//! the calling thread), so uneven jobs still balance out.
+struct ThreadPool_t {
+	uint32_t   nThreads;  //! Number of threads, including the calling thread
+	pthread_t *Workers;   //! Worker threads [nThreads-1]
+	pthread_mutex_t Lock;
+	pthread_cond_t  WorkCond;
+	pthread_cond_t  DoneCond;
+	uint32_t   Generation; //! Incremented for every batch
+	uint32_t   nBusy;      //! Workers still running the current batch
+	uint8_t    Quit;
+
+	//! Current batch
+	ThreadPool_JobFunc_t Func;
+	void       *Arg;
+	uint32_t    nJobs;
+	atomic_uint NextJob;
+};
+
+/************************************************/
+
+//! Get number of CPU cores available
+uint32_t ThreadPool_CpuCount(void);
+
+//! Create thread pool
+//! Pass nThreads=0 to use one thread per CPU core.
+//! Returns 0 on failure, or 1 on success.
+//! NOTE: If not all worker threads can be started, the pool will
+//! simply run with fewer threads.
+uint8_t ThreadPool_Create(struct ThreadPool_t *Pool, uint32_t nThreads);
+
+//! Destroy thread pool
+void ThreadPool_Destroy(struct ThreadPool_t *Pool);
+
+//! Run jobs [0,nJobs) and wait for them to complete
+void ThreadPool_Run(struct ThreadPool_t *Pool, uint32_t nJobs, ThreadPool_JobFunc_t Func, void *Arg);
+
+/************************************************/
+//! EOF
+/************************************************/
@@ -1,10 +1,84 @@
 /************************************************/
 #pragma once
 /************************************************/
+#include <stddef.h>
 #include <stdint.h>
 /************************************************/
 
-void DitherPaletteImage(
+//! Dithering statistics
+//! Repeated input colours are looked up in a cache, skipping colour
+//! conversion (and, for undithered output, the palette search).
+//! With a lookup grid (see DitherPaletteImageEx()), ordered dithers
+//! look up each pixel in the grid, and misses are computed once.
+struct DitherStats_t {
+	uint64_t nCacheLookups; //! Pixels looked up in the colour cache
+	uint64_t nCacheHits;    //! Pixels whose colour was found in the cache
+	uint64_t nGridLookups;  //! Pixels looked up in the lookup grid
+	uint64_t nGridMisses;   //! Grid entries that had to be computed
+	uint32_t nGridCells;    //! Grid cells per axis (0 = no grid)
+	uint32_t nGridLevels;   //! Distinct thresholds in the grid
+	uint32_t nPaletteColours;  //! Palette entries
+	uint32_t nDistinctColours; //! Distinct palette colours (duplicates are never searched)
+};
+
+//! Source pixel formats
+#define DITHER_FORMAT_RGBA    0 //! R,G,B,A bytes
+#define DITHER_FORMAT_BGRA    1 //! B,G,R,A bytes
+#define DITHER_FORMAT_BGRX    2 //! B,G,R,x bytes (opaque; 4th byte is ignored)
+#define DITHER_FORMAT_RGB     3 //! R,G,B bytes (opaque)
+#define DITHER_FORMAT_BGR     4 //! B,G,R bytes (opaque)
+#define DITHER_FORMAT_INDEXED 5 //! Index into an RGBA source palette
+
+//! Dithering flags
+#define DITHER_FLAG_FASTMATH (1u << 0) //! Use approximate (faster) colour conversion
+#define DITHER_FLAG_BOTTOMUP (1u << 1) //! Source rows are stored bottom-up (DitherPaletteImageEx() only)
+#define DITHER_FLAG_OPAQUE   (1u << 2) //! Source is known to be fully opaque
+#define DITHER_FLAG_CLEAR0   (1u << 3) //! Colour 0 of the palette is transparent
+
+//! NOTE: When both the palette and the source are fully opaque, the
+//! palette search skips the alpha channel (which makes no difference
+//! to the results). Sources are checked for this before dithering,
+//! unless DITHER_FLAG_OPAQUE is passed, in which case any source alpha
+//! is ignored in the search. Formats without alpha are always opaque.
+
+//! NOTE: With DITHER_FLAG_CLEAR0, clear pixels are mapped straight to
+//! index 0, without being searched for, and neither take nor pass on
+//! any diffused error. Clear pixels are those with an alpha of 0, those
+//! whose RGB matches the clear colour (if any), and, for indexed
+//! sources, those using colour 0 of the source palette. Clear rows and
+//! columns around the image content are skipped entirely.
+//! Index 0 is never used for pixels that aren't clear (unless the
+//! palette has no other colours).
+
+//! Error codes
+//! NOTE: Dithering never silently falls back to a lower quality; if
+//! the memory for the requested dither can't be had, this is reported
+//! as DITHER_ERROR_MEMORY and nothing is written.
+#define DITHER_OK            0 //! Success
+#define DITHER_ERROR_FORMAT  1 //! Invalid source format, or missing source palette
+#define DITHER_ERROR_MEMORY  2 //! Out of memory, or scratch memory too small
+#define DITHER_ERROR_CONTEXT 3 //! Scratch memory belongs to a different context
+#define DITHER_ERROR_DITHER  4 //! Invalid dither type, or missing threshold matrix
+#define DITHER_ERROR_ROWS    5 //! More rows than the stream was created for
+
+//! Threshold matrix for ordered dithering (DITHER_MATRIX)
+//! The matrix is tiled over the image, with pixel (x,y) offset by
+//! Thresholds[(y % Height)*Width + (x % Width)] times the dither
+//! level. Thresholds should lie in [-0.5,+0.5); the built-in ordered
+//! dithers use the Bayer matrix of rank r (of N entries) as r/N - 0.5.
+//! The matrix may have any size (eg. a blue-noise mask), and is read
+//! in place, so it must outlive any call or stream it is passed to.
+struct DitherMatrix_t {
+    uint32_t Width;
+    uint32_t Height;
+    const float *Thresholds; //! [Height][Width]
+};
+
+/************************************************/
+
+//! Dither palettized image data
+//! Returns DITHER_OK on success, or a DITHER_ERROR_* code on failure.
+uint8_t DitherPaletteImage(
           uint8_t *DstPx,
     const uint8_t *SrcPx,
     const uint8_t *Palette,
@@ -17,6 +91,251 @@ void DitherPaletteImage(
     uint32_t nPaletteColours
 );
 
+//! Dithering options for DitherPaletteImageEx()
+//! Zero-initialise this (eg. `struct DitherOptions_t Options = {0};`)
+//! and set only the fields that are needed; every zero field gives the
+//! default behaviour, which is that of DitherPaletteImage() (with
+//! tightly packed RGBA source rows), but using one thread per CPU core.
+//! Passing NULL options is the same as passing zero-initialised ones.
+//!
+//! Source layout: Row y starts at byte offset y*SrcStride from SrcPx;
+//! a SrcStride of 0 means tightly packed rows. For bottom-up images
+//! (eg. BMP), either set DITHER_FLAG_BOTTOMUP with SrcPx pointing to
+//! the start of the buffer, or pass SrcPx pointing to the top row (ie.
+//! the last row in memory) with a negative SrcStride. SrcPalette is
+//! only used for DITHER_FORMAT_INDEXED; it holds 256 RGBA entries, which
+//! are converted to the target colourspace only once (rather than once
+//! per pixel).
+//!
+//! Threads: The output is identical for any number of threads. Diffusion
+//! dithers (Floyd-Steinberg, Atkinson) are run as a wavefront, with each
+//! row trailing a few pixels behind the row above. When DiffuseTileSize
+//! is non-zero, diffusion dithers are instead run on independent tiles
+//! of DiffuseTileSize x DiffuseTileSize pixels (overlapping slightly to
+//! hide the seams). This scales better with the number of threads, but
+//! gives slightly different results; these depend only on the tile
+//! size, not on the number of threads.
+//!
+//! Lookup grid: When GridMemory is non-zero, ordered dithers of opaque
+//! images (on opaque palettes) use a lookup grid of up to GridMemory
+//! bytes: the target colourspace is split into cells, and the result
+//! for each cell and threshold is computed once, from the centre of the
+//! cell, and then looked up for every pixel that falls in it. This is
+//! much faster for large images, but only approximates exact dithering
+//! (more memory gives finer cells, and so more accurate results). If
+//! the grid can't be created (eg. GridMemory is too small), dithering
+//! is exact instead. Results don't depend on the number of threads.
+struct DitherOptions_t {
+    int32_t  SrcStride;          //! Bytes from one source row to the next (0 = tightly packed)
+    uint8_t  SrcFormat;          //! DITHER_FORMAT_* (0 = DITHER_FORMAT_RGBA)
+    const uint8_t *SrcPalette;   //! Source palette (DITHER_FORMAT_INDEXED only; may be NULL otherwise)
+    const struct DitherMatrix_t *Matrix; //! Threshold matrix (DITHER_MATRIX only; may be NULL otherwise)
+    uint32_t Flags;              //! Combination of DITHER_FLAG_* values
+    uint32_t nThreads;           //! Threads to use (0 = one per CPU core)
+    uint32_t DiffuseTileSize;    //! Tile size for diffusion dithers (0 = exact wavefront)
+    size_t   GridMemory;         //! Bytes for the lookup grid (0 = no grid)
+    const uint8_t *ClearColour;  //! RGB colour whose pixels are clear, or NULL (DITHER_FLAG_CLEAR0 only)
+    struct DitherStats_t *Stats; //! Receives statistics about the call, or NULL
+};
+
+//! Same as DitherPaletteImage(), but with options (see DitherOptions_t),
+//! which may be NULL for the defaults.
+//! Returns DITHER_OK on success, or a DITHER_ERROR_* code on failure.
+uint8_t DitherPaletteImageEx(
+          uint8_t *DstPx,
+    const uint8_t *SrcPx,
+    const uint8_t *Palette,
+    uint32_t Width,
+    uint32_t Height,
+    uint8_t  DitherType,
+    float    DitherLevel,
+    uint8_t  Colourspace,
+    uint8_t  PremultipliedAlpha,
+    uint32_t nPaletteColours,
+    const struct DitherOptions_t *Options
+);
+
+//! Dither context
+//! This holds a palette prepared for dithering (ie. converted to the
+//! target colourspace, along with its search index), so that many
+//! images can be dithered to the same palette without redoing this
+//! every time. Once created, a context is never modified, so it may
+//! be shared by any number of threads.
+//! Dithering also needs some scratch memory (colour cache, diffusion
+//! rows, etc.), which is kept separately in a DitherScratch_t; each
+//! thread dithering at the same time needs its own.
+struct DitherContext_t;
+struct DitherScratch_t;
+
+//! Create dither context
+//! Flags is a combination of DITHER_FLAG_* values (only
+//! DITHER_FLAG_FASTMATH, DITHER_FLAG_OPAQUE and DITHER_FLAG_CLEAR0
+//! are used here; these then apply to every image dithered with the
+//! context). ClearColour is as for DitherOptions_t.
+//! Returns NULL on failure.
+struct DitherContext_t *DitherContext_Create(
+    const uint8_t *Palette,
+    uint32_t nPaletteColours,
+    uint8_t  Colourspace,
+    uint8_t  PremultipliedAlpha,
+    uint32_t Flags,
+    const uint8_t *ClearColour
+);
+
+//! Destroy dither context
+//! NOTE: All scratch memory and streams using the context must be
+//! destroyed first.
+void DitherContext_Destroy(struct DitherContext_t *Ctx);
+
+//! Create scratch memory for a dither context
+//! Memory for diffusion grows as needed with the image size, and is
+//! kept for later images.
+//! Returns NULL on failure.
+struct DitherScratch_t *DitherScratch_Create(const struct DitherContext_t *Ctx);
+
+//! Get the arena size needed by DitherScratch_CreateInArena()
+//! This is enough for images of up to MaxWidth pixels across (of any
+//! height) with the given dither type (and any non-diffusion type).
+//! NOTE: The palette size doesn't matter here, as the palette itself
+//! is held by the context.
+size_t DitherScratch_ArenaSize(uint32_t MaxWidth, uint8_t DitherType);
+
+//! Create scratch memory for a dither context in a caller-supplied arena
+//! The arena must be at least DitherScratch_ArenaSize() bytes, aligned
+//! to 16 bytes, and must outlive the scratch memory. Nothing is ever
+//! allocated through the returned scratch memory, so images larger
+//! than the limits given here fail with DITHER_ERROR_MEMORY.
+//! Returns NULL if the arena is too small.
+struct DitherScratch_t *DitherScratch_CreateInArena(
+    const struct DitherContext_t *Ctx,
+    void    *Arena,
+    size_t   ArenaSize,
+    uint32_t MaxWidth,
+    uint8_t  DitherType
+);
+
+//! Destroy scratch memory for a dither context
+//! For scratch memory in an arena, this does nothing, and the arena
+//! may simply be released instead.
+void DitherScratch_Destroy(struct DitherScratch_t *Scratch);
+
+//! Dither image data using a dither context
+//! This is the same as DitherPaletteImageEx() on a single thread and
+//! without tiling (or a lookup grid), but using the palette of Ctx and the memory of
+//! Scratch (which must have been created for Ctx).
+//! Flags is a combination of DITHER_FLAG_* values (only
+//! DITHER_FLAG_BOTTOMUP and DITHER_FLAG_OPAQUE are used here).
+//! Returns DITHER_OK on success, or a DITHER_ERROR_* code on failure.
+uint8_t DitherContext_Image(
+    const struct DitherContext_t *Ctx,
+    struct DitherScratch_t       *Scratch,
+          uint8_t *DstPx,
+    const uint8_t *SrcPx,
+    int32_t  SrcStride,
+    uint8_t  SrcFormat,
+    const uint8_t *SrcPalette,
+    uint32_t Width,
+    uint32_t Height,
+    uint8_t  DitherType,
+    float    DitherLevel,
+    const struct DitherMatrix_t *Matrix,
+    uint32_t Flags
+);
+
+//! Streaming dither context
+//! This dithers an image a band of rows at a time, top to bottom, so
+//! that neither the source nor the output image needs to be held in
+//! memory as a whole. Only the diffusion rows (and, per thread, the
+//! colour caches) are kept between bands.
+//! NOTE: The output is identical to that of DitherPaletteImageEx()
+//! without tiling, regardless of how the image is split into bands.
+struct DitherStream_t;
+
+//! Create streaming dither context
+//! Up to MaxRows rows can be passed to each call of DitherStream_Rows().
+//! Flags and ClearColour are as for DitherContext_Create(), and Matrix
+//! and GridMemory are as for DitherOptions_t. The lookup grid is kept
+//! for the lifetime of the stream, so it warms up over bands.
+//! Returns NULL on failure (including if the dither type is invalid,
+//! or if the memory for it could not be allocated).
+struct DitherStream_t *DitherStream_Create(
+    const uint8_t *Palette,
+    uint32_t Width,
+    uint32_t MaxRows,
+    uint8_t  DitherType,
+    float    DitherLevel,
+    const struct DitherMatrix_t *Matrix,
+    uint8_t  Colourspace,
+    uint8_t  PremultipliedAlpha,
+    uint32_t nPaletteColours,
+    uint32_t nThreads,
+    size_t   GridMemory,
+    uint32_t Flags,
+    const uint8_t *ClearColour
+);
+
+//! Create streaming dither context from a dither context
+//! Same as DitherStream_Create(), but uses the palette of Ctx, which
+//! must outlive the stream.
+//! Returns NULL on failure.
+struct DitherStream_t *DitherStream_CreateFromContext(
+    const struct DitherContext_t *Ctx,
+    uint32_t Width,
+    uint32_t MaxRows,
+    uint8_t  DitherType,
+    float    DitherLevel,
+    const struct DitherMatrix_t *Matrix,
+    uint32_t nThreads,
+    size_t   GridMemory
+);
+
+//! Destroy streaming dither context
+void DitherStream_Destroy(struct DitherStream_t *Stream);
+
+//! Dither the next nRows rows of the image
+//! SrcPx and DstPx point to the first of these rows.
+//! Returns DITHER_OK on success, or a DITHER_ERROR_* code on failure
+//! (DITHER_ERROR_ROWS if nRows > MaxRows).
+uint8_t DitherStream_Rows(
+    struct DitherStream_t *Stream,
+          uint8_t *DstPx,
+    const uint8_t *SrcPx,
+    uint32_t nRows
+);
+
+//! Same as DitherStream_Rows(), but reads the source in place in any
+//! of the DITHER_FORMAT_* formats (see DitherOptions_t).
+//! Returns DITHER_OK on success, or a DITHER_ERROR_* code on failure
+//! (DITHER_ERROR_ROWS if nRows > MaxRows, DITHER_ERROR_FORMAT if the
+//! format is invalid).
+uint8_t DitherStream_RowsEx(
+    struct DitherStream_t *Stream,
+          uint8_t *DstPx,
+    const uint8_t *SrcPx,
+    int32_t  SrcStride,
+    uint8_t  SrcFormat,
+    const uint8_t *SrcPalette,
+    uint32_t nRows
+);
+
+//! Get statistics for all rows dithered so far
+void DitherStream_GetStats(const struct DitherStream_t *Stream, struct DitherStats_t *Stats);
+
+//! Get a description of a DITHER_OK or DITHER_ERROR_* code
+const char *DitherImage_ErrorString(uint8_t Error);
+
+//! Decode n source pixels in a DITHER_FORMAT_* format to RGBA
+//! SrcPalette is only used for DITHER_FORMAT_INDEXED (256 RGBA entries).
+//! Dst may be the same as Src for 4-byte formats.
+//! NOTE: This is the same (SIMD) decoder that the dithering uses.
+void DitherImage_DecodeRow(
+          uint8_t *Dst,
+    const uint8_t *Src,
+    uint32_t n,
+    uint8_t  SrcFormat,
+    const uint8_t *SrcPalette
+);
+
 /************************************************/
 //! EOF
 /************************************************/
\ No newline at end of file
@@ -171,6 +171,17 @@ static inline float Vec4f_Dist2(const Vec4f_t *a, const Vec4f_t *b) {
 	return Vec4f_Length2(&x);
 }
 
+//! Same as Vec4f_Dist2(), but over the first three channels only
+//! NOTE: The sum is formed in the same order, so if the last channels
+//! are equal, the result is exactly that of Vec4f_Dist2().
+static inline float Vec4f_Dist2XYZ(const Vec4f_t *a, const Vec4f_t *b) {
+	Vec4f_t x = Vec4f_Sub(a, b);
+	        x = Vec4f_Mul(&x, &x);
+	return x.f32[0] +
+	       x.f32[1] +
+	       x.f32[2] ;
+}
+
 static inline float Vec4f_Dist(const Vec4f_t *a, const Vec4f_t *b) {
 	return sqrtf(Vec4f_Dist2(a, b));
 }
@@ -1,8 +1,20 @@
 /************************************************/
+#ifndef _WIN32
+# define _FILE_OFFSET_BITS 64 //! 64-bit off_t for fseeko() on 32-bit targets
+#endif
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
 /************************************************/
 #include "Bitmap.h"
 /************************************************/
@@ -51,16 +63,64 @@ struct BMIH_t {
 
 /************************************************/
 
-//! Swap ranges of memory
-//! This is very much sub-optimal
-static void SwapRange(void *a_, void *b_, uint32_t Length) {
-    uint8_t *a = (uint8_t *) a_;
-    uint8_t *b = (uint8_t *) b_;
-    while (Length--) {
-        uint8_t t = *a;
-        *a++ = *b;
-        *b++ = t;
+//! Seek to a byte offset from the start of a file
+//! NOTE: fseek() takes a long, which is only 32 bits on Windows and on
+//! 32-bit targets, so files larger than 2GiB need the 64-bit versions.
+//! Returns 0 on success, as with fseek().
+static int FileSeek(FILE *File, uint64_t Offs) {
+#ifdef _WIN32
+    return _fseeki64(File, (__int64) Offs, SEEK_SET);
+#else
+    return fseeko(File, (off_t) Offs, SEEK_SET);
+#endif
+}
+
+//! Expand n BGR pixels to BGRA, with alpha 0xFF
+//! Each pixel is loaded as 4 bytes (the last of which belongs to the
+//! next pixel, and is then replaced by the alpha), so the last pixel
+//! is copied on its own to stay inside the source row.
+//! NOTE: As with the headers, this assumes a little-endian machine.
+static void ExpandBGRRow(BGRA8_t *Dst, const uint8_t *Src, uint32_t n) {
+    uint32_t i, Px;
+    if (!n) return;
+    for (i = 0; i < n - 1; i++) {
+        memcpy(&Px, Src + i * 3, 4);
+        Px |= 0xFF000000u;
+        memcpy(&Dst[i], &Px, 4);
     }
+    Dst[i].b = Src[i * 3 + 0];
+    Dst[i].g = Src[i * 3 + 1];
+    Dst[i].r = Src[i * 3 + 2];
+    Dst[i].a = 255;
+}
+
+/************************************************/
+
+//! Write file headers and palette
+//! Pass Palette=NULL for BGRA.
+//! Returns the offset of the pixel data, or 0 on failure.
+static uint32_t WriteHeaders(FILE *File, uint32_t Width, uint32_t Height, const BGRA8_t *Palette) {
+    struct BMFH_t bmFH;
+    struct BMIH_t bmIH;
+    uint32_t nPxPadded = (((Width * (Palette ? 1 : 4)) + 3) & ~3) * Height;
+    memset(&bmFH, 0, sizeof(bmFH));
+    memset(&bmIH, 0, sizeof(bmIH));
+    bmFH.Type = 'B' | 'M' << 8;
+    bmFH.Size = sizeof(struct BMFH_t) +
+                sizeof(struct BMIH_t) +
+                BMP_PALETTE_COLOURS * (Palette ? sizeof(BGRA8_t) : 0) +
+                nPxPadded * (Palette ? sizeof(uint8_t) : sizeof(BGRA8_t));
+    bmFH.Offs = sizeof(struct BMFH_t) + sizeof(struct BMIH_t) +
+                BMP_PALETTE_COLOURS * (Palette ? sizeof(BGRA8_t) : 0);
+    bmIH.Size = sizeof(struct BMIH_t);
+    bmIH.Width = Width;
+    bmIH.Height = Height;
+    bmIH.nPlanes = 1;
+    bmIH.BitCnt = Palette ? 8 : 32;
+    if (!fwrite(&bmFH, sizeof(bmFH), 1, File)) return 0;
+    if (!fwrite(&bmIH, sizeof(bmIH), 1, File)) return 0;
+    if (Palette) if (!fwrite(Palette, BMP_PALETTE_COLOURS * sizeof(BGRA8_t), 1, File)) return 0;
+    return bmFH.Offs;
 }
 
 /************************************************/
@@ -71,12 +131,12 @@ uint8_t BmpCtx_Create(struct BmpCtx_t *Ctx, uint32_t w, uint32_t h, uint8_t UseP
     Ctx->Height = h;
     if (UsePal) {
         Ctx->Palette = calloc(BMP_PALETTE_COLOURS, sizeof(BGRA8_t));
-        Ctx->PxIdx = calloc(w * h, sizeof(uint8_t));
+        Ctx->PxIdx = calloc((size_t)w * h, sizeof(uint8_t));
         if (!Ctx->Palette || !Ctx->PxIdx)
             DESTROY_AND_RETURN(Ctx, 0);
     } else {
         Ctx->Palette = NULL;
-        Ctx->PxBGR = calloc(w * h, sizeof(BGRA8_t));
+        Ctx->PxBGR = calloc((size_t)w * h, sizeof(BGRA8_t));
         if (!Ctx->PxBGR)
             DESTROY_AND_RETURN(Ctx, 0);
     }
@@ -155,45 +215,38 @@ uint8_t BmpCtx_FromFile(struct BmpCtx_t *Ctx, const char *Filename) {
             //! BGR
             case 24: {
                 //! Read pixels
-                //! Note that we need to skip any padding at end of rows
-                uint32_t x, y, RowPad = (-bmIH.Width * 3) & 3;
+                //! Whole rows (including padding) are read, and then
+                //! expanded to BGRA.
+                uint32_t y, RowStride = (bmIH.Width * 3 + 3) & ~3;
                 fseek(File, bmFH.Offs, SEEK_SET);
                 BGRA8_t *Mem = Ctx->PxBGR = malloc(nPx * sizeof(BGRA8_t));
-                if (!Mem) goto Exit;
+                uint8_t *RowBuf = malloc(RowStride);
+                if (!Mem || !RowBuf) {
+                    free(RowBuf);
+                    goto Exit;
+                }
                 for (y = 0; y < bmIH.Height; y++) {
                     BGRA8_t *Row = Mem + (bmIH.Height - 1 - y) * bmIH.Width;
-                    for (x = 0; x < bmIH.Width; x++) {
-                        //! Read BGR
-                        struct {
-                            uint8_t b, g, r;
-                        } p;
-                        if (!fread(&p, 3, 1, File)) goto Exit;
-
-                        //! Store BGRA
-                        Row[x].b = p.b;
-                        Row[x].g = p.g;
-                        Row[x].r = p.r;
-                        Row[x].a = 255;
+                    if (!fread(RowBuf, RowStride, 1, File)) {
+                        free(RowBuf);
+                        goto Exit;
                     }
-                    fseek(File, RowPad, SEEK_CUR);
+                    ExpandBGRRow(Row, RowBuf, bmIH.Width);
                 }
+                free(RowBuf);
             }
             break;
 
             //! BGRA
             case 32: {
-                //! Everything is prepared already, so straight read
-                fseek(File, bmFH.Offs, SEEK_SET);
-                Ctx->PxBGR = malloc(nPx * sizeof(BGRA8_t));
-                if (!Ctx->PxBGR) goto Exit;
-                if (!fread(Ctx->PxBGR, nPx * sizeof(BGRA8_t), 1, File)) goto Exit;
-
-                //! Unflip image
+                //! Everything is prepared already, so read each row
+                //! straight to its (unflipped) place
                 uint32_t y;
-                BGRA8_t *Mem = Ctx->PxBGR;
-                for (y = 0; y < bmIH.Height / 2; y++) {
-                    SwapRange(Mem + y * bmIH.Width, Mem + (bmIH.Height - 1 - y) * bmIH.Width,
-                              bmIH.Width * sizeof(BGRA8_t));
+                fseek(File, bmFH.Offs, SEEK_SET);
+                BGRA8_t *Mem = Ctx->PxBGR = malloc(nPx * sizeof(BGRA8_t));
+                if (!Mem) goto Exit;
+                for (y = 0; y < bmIH.Height; y++) {
+                    if (!fread(Mem + (bmIH.Height - 1 - y) * bmIH.Width, bmIH.Width * sizeof(BGRA8_t), 1, File)) goto Exit;
                 }
 
                 //! Fix alpha channel if not properly set (many 32-bit BMPs have unused alpha = 0)
@@ -237,36 +290,15 @@ Exit:
 //! Write to file
 uint8_t BmpCtx_ToFile(const struct BmpCtx_t *Ctx, const char *Filename) {
     uint8_t ExitCode = 0;
-    struct BMFH_t bmFH;
-    struct BMIH_t bmIH;
 
     //! Check image is valid
     uint32_t nPx = Ctx->Width * Ctx->Height;
     if (!nPx || (!Ctx->PxBGR && !(Ctx->Palette && Ctx->PxIdx))) return 0;
 
-    //! Open file, write headers
-    uint32_t nPxPadded = (((Ctx->Width * (Ctx->Palette ? 1 : 4)) + 3) & ~3) * Ctx->Height;
+    //! Open file, write headers and palette
     FILE *File = fopen(Filename, "wb");
     if (!File) return 0;
-    memset(&bmFH, 0, sizeof(bmFH));
-    memset(&bmIH, 0, sizeof(bmIH));
-    bmFH.Type = 'B' | 'M' << 8;
-    bmFH.Size = sizeof(struct BMFH_t) +
-                sizeof(struct BMIH_t) +
-                BMP_PALETTE_COLOURS * (Ctx->Palette ? sizeof(BGRA8_t) : 0) +
-                nPxPadded * (Ctx->Palette ? sizeof(uint8_t) : sizeof(BGRA8_t));
-    bmFH.Offs = sizeof(struct BMFH_t) + sizeof(struct BMIH_t) +
-                BMP_PALETTE_COLOURS * (Ctx->Palette ? sizeof(BGRA8_t) : 0);
-    bmIH.Size = sizeof(struct BMIH_t);
-    bmIH.Width = Ctx->Width;
-    bmIH.Height = Ctx->Height;
-    bmIH.nPlanes = 1;
-    bmIH.BitCnt = Ctx->Palette ? 8 : 32;
-    fwrite(&bmFH, 1, sizeof(bmFH), File);
-    fwrite(&bmIH, 1, sizeof(bmIH), File);
-
-    //! Write palette
-    if (Ctx->Palette) if (!fwrite(Ctx->Palette, BMP_PALETTE_COLOURS * sizeof(BGRA8_t), 1, File)) goto Exit;
+    if (!WriteHeaders(File, Ctx->Width, Ctx->Height, Ctx->Palette)) goto Exit;
 
     //! Write pixels (and flip image for storage)
     if (Ctx->Palette) {
@@ -292,6 +324,311 @@ Exit:
     return ExitCode;
 }
 
+/************************************************/
+
+//! Map file
+uint8_t BmpView_Open(struct BmpView_t *View, const char *Filename) {
+    struct BMFH_t bmFH;
+    struct BMIH_t bmIH;
+    View->Map = NULL;
+    View->MapSize = 0;
+
+    //! Map file
+#ifdef _WIN32
+    View->hMap = NULL;
+    View->hFile = CreateFileA(Filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (View->hFile == INVALID_HANDLE_VALUE) return 0;
+    LARGE_INTEGER Size;
+    if (!GetFileSizeEx(View->hFile, &Size)) goto Fail;
+    View->MapSize = (size_t)Size.QuadPart;
+    if (View->MapSize < sizeof(bmFH) + sizeof(bmIH)) goto Fail;
+    View->hMap = CreateFileMappingA(View->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!View->hMap) goto Fail;
+    View->Map = MapViewOfFile(View->hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!View->Map) goto Fail;
+#else
+    int fd = open(Filename, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat St;
+    if (fstat(fd, &St) != 0 || (size_t)St.st_size < sizeof(bmFH) + sizeof(bmIH)) {
+        close(fd);
+        return 0;
+    }
+    View->MapSize = (size_t)St.st_size;
+    View->Map = mmap(NULL, View->MapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (View->Map == MAP_FAILED) {
+        View->Map = NULL;
+        return 0;
+    }
+#endif
+    const uint8_t *Data = (const uint8_t *) View->Map;
+
+    //! Read headers
+    //! Negative heights are top-down files
+    memcpy(&bmFH, Data, sizeof(bmFH));
+    memcpy(&bmIH, Data + sizeof(bmFH), sizeof(bmIH));
+    if (bmFH.Type != ('B' | 'M' << 8)) goto Fail;
+    if (bmIH.CompType != 0 && bmIH.CompType != 3) goto Fail;
+    uint8_t TopDown = ((int32_t) bmIH.Height < 0);
+    View->Width = bmIH.Width;
+    View->Height = TopDown ? (uint32_t) -(int32_t) bmIH.Height : bmIH.Height;
+    View->BitCnt = bmIH.BitCnt;
+    View->PaletteCount = 0;
+    View->AlphaUnused = 0;
+
+    //! Get row size, and read palette
+    uint32_t RowStride;
+    switch (bmIH.BitCnt) {
+        case 8: {
+            if (View->MapSize < sizeof(bmFH) + sizeof(bmIH) + sizeof(View->Palette)) goto Fail;
+            memcpy(View->Palette, Data + sizeof(bmFH) + sizeof(bmIH), sizeof(View->Palette));
+            View->PaletteCount = bmIH.ColUsed ? bmIH.ColUsed : BMP_PALETTE_COLOURS;
+            for (int i = 0; i < BMP_PALETTE_COLOURS; i++) {
+                View->Palette[i].a = 255;
+            }
+            RowStride = (View->Width + 3) & ~3;
+        }
+        break;
+
+        case 24: {
+            RowStride = (View->Width * 3 + 3) & ~3;
+        }
+        break;
+
+        case 32: {
+            RowStride = View->Width * 4;
+        }
+        break;
+
+        default: {
+            goto Fail;
+        }
+        break;
+    }
+
+    //! Check that all pixel data is inside the file
+    if (bmFH.Offs > View->MapSize || (uint64_t) RowStride * View->Height > View->MapSize - bmFH.Offs) goto Fail;
+    if (TopDown) {
+        View->Px = Data + bmFH.Offs;
+        View->Stride = (int32_t) RowStride;
+    } else {
+        View->Px = Data + bmFH.Offs + (size_t) RowStride * (View->Height ? View->Height - 1 : 0);
+        View->Stride = -(int32_t) RowStride;
+    }
+
+    //! Check if all alpha values are 0 (unused alpha channel)
+    if (bmIH.BitCnt == 32) {
+        uint32_t x, y;
+        View->AlphaUnused = 1;
+        for (y = 0; y < View->Height && View->AlphaUnused; y++) {
+            const uint8_t *Row = View->Px + (ptrdiff_t) y * View->Stride;
+            for (x = 0; x < View->Width; x++) {
+                if (Row[x * 4 + 3] != 0) {
+                    View->AlphaUnused = 0;
+                    break;
+                }
+            }
+        }
+    }
+    return 1;
+
+Fail:
+    BmpView_Close(View);
+    return 0;
+}
+
+/************************************************/
+
+//! Unmap file
+void BmpView_Close(struct BmpView_t *View) {
+#ifdef _WIN32
+    if (View->Map) UnmapViewOfFile(View->Map);
+    if (View->hMap) CloseHandle(View->hMap);
+    if (View->hFile != INVALID_HANDLE_VALUE) CloseHandle(View->hFile);
+    View->hMap = NULL;
+    View->hFile = INVALID_HANDLE_VALUE;
+#else
+    if (View->Map) munmap(View->Map, View->MapSize);
+#endif
+    View->Map = NULL;
+    View->MapSize = 0;
+    View->Px = NULL;
+}
+
+/************************************************/
+
+//! Open file for streaming
+uint8_t BmpReader_Open(struct BmpReader_t *Reader, const char *Filename) {
+    struct BMFH_t bmFH;
+    struct BMIH_t bmIH;
+    Reader->PaletteCount = 0;
+    Reader->FixAlpha = 0;
+    Reader->RowBuf = NULL;
+
+    //! Open file, read headers
+    Reader->File = fopen(Filename, "rb");
+    if (!Reader->File) return 0;
+    if (!fread(&bmFH, sizeof(bmFH), 1, Reader->File)) goto Fail;
+    if (!fread(&bmIH, sizeof(bmIH), 1, Reader->File)) goto Fail;
+    if (bmFH.Type != ('B' | 'M' << 8)) goto Fail;
+    Reader->Width = bmIH.Width;
+    Reader->BitCnt = bmIH.BitCnt;
+    Reader->DataOffs = bmFH.Offs;
+
+    //! Negative heights are top-down files (see BmpView_Open())
+    if (bmIH.Height == 0x80000000u) goto Fail;
+    Reader->TopDown = ((int32_t) bmIH.Height < 0);
+    Reader->Height = Reader->TopDown ? (uint32_t) -(int32_t) bmIH.Height : bmIH.Height;
+
+    //! Check that file is not compressed (see BmpCtx_FromFile())
+    if (bmIH.CompType != 0 && bmIH.CompType != 3) goto Fail;
+
+    //! Get row size, and read palette
+    switch (bmIH.BitCnt) {
+        case 8: {
+            if (!fread(Reader->Palette, BMP_PALETTE_COLOURS * sizeof(BGRA8_t), 1, Reader->File)) goto Fail;
+            Reader->PaletteCount = bmIH.ColUsed ? bmIH.ColUsed : BMP_PALETTE_COLOURS;
+            for (int i = 0; i < BMP_PALETTE_COLOURS; i++) {
+                Reader->Palette[i].a = 255;
+            }
+            Reader->RowStride = (bmIH.Width + 3) & ~3;
+        }
+        break;
+
+        case 24: {
+            Reader->RowStride = (bmIH.Width * 3 + 3) & ~3;
+        }
+        break;
+
+        case 32: {
+            Reader->RowStride = bmIH.Width * 4;
+        }
+        break;
+
+        default: {
+            goto Fail;
+        }
+        break;
+    }
+    Reader->RowBuf = malloc(Reader->RowStride);
+    if (!Reader->RowBuf) goto Fail;
+
+    //! Check if all alpha values are 0 (unused alpha channel)
+    if (bmIH.BitCnt == 32) {
+        uint32_t x, y;
+        Reader->FixAlpha = 1;
+        if (FileSeek(Reader->File, Reader->DataOffs) != 0) goto Fail;
+        for (y = 0; y < Reader->Height && Reader->FixAlpha; y++) {
+            if (!fread(Reader->RowBuf, Reader->RowStride, 1, Reader->File)) goto Fail;
+            for (x = 0; x < bmIH.Width; x++) {
+                if (Reader->RowBuf[x * 4 + 3] != 0) {
+                    Reader->FixAlpha = 0;
+                    break;
+                }
+            }
+        }
+    }
+    return 1;
+
+Fail:
+    BmpReader_Close(Reader);
+    return 0;
+}
+
+/************************************************/
+
+//! Close streaming reader
+void BmpReader_Close(struct BmpReader_t *Reader) {
+    if (Reader->File) fclose(Reader->File);
+    free(Reader->RowBuf);
+    Reader->File = NULL;
+    Reader->RowBuf = NULL;
+}
+
+/************************************************/
+
+//! Read rows [y,y+nRows) to BGRA
+uint8_t BmpReader_ReadRows(struct BmpReader_t *Reader, BGRA8_t *Dst, uint32_t y, uint32_t nRows) {
+    uint32_t i, n, x;
+    uint32_t Width = Reader->Width;
+    const uint8_t *Src = Reader->RowBuf;
+    if (y > Reader->Height || nRows > Reader->Height - y) return 0;
+
+    //! Rows are usually stored bottom-up, so read the band from its last
+    //! row upwards (or, for top-down files, from its first row down);
+    //! this keeps the reads sequential within the file
+    uint64_t FileRow = Reader->TopDown ? y : (Reader->Height - y - nRows);
+    if (FileSeek(Reader->File, Reader->DataOffs + FileRow * Reader->RowStride) != 0) return 0;
+    for (i = 0; i < nRows; i++) {
+        n = Reader->TopDown ? i : (nRows - 1 - i);
+        BGRA8_t *Row = Dst + (size_t) n * Width;
+        if (!fread(Reader->RowBuf, Reader->RowStride, 1, Reader->File)) return 0;
+        switch (Reader->BitCnt) {
+            case 8: {
+                for (x = 0; x < Width; x++) Row[x] = Reader->Palette[Src[x]];
+            }
+            break;
+
+            case 24: {
+                ExpandBGRRow(Row, Src, Width);
+            }
+            break;
+
+            case 32: {
+                memcpy(Row, Src, Width * sizeof(BGRA8_t));
+                if (Reader->FixAlpha) for (x = 0; x < Width; x++) Row[x].a = 255;
+            }
+            break;
+        }
+    }
+    return 1;
+}
+
+/************************************************/
+
+//! Create file for streaming
+uint8_t BmpWriter_Open(struct BmpWriter_t *Writer, const char *Filename, uint32_t w, uint32_t h, const BGRA8_t *Palette) {
+    Writer->Width = w;
+    Writer->Height = h;
+    Writer->RowStride = (w + 3) & ~3;
+    Writer->File = fopen(Filename, "wb");
+    if (!Writer->File) return 0;
+    Writer->DataOffs = WriteHeaders(Writer->File, w, h, Palette);
+    if (!Writer->DataOffs) {
+        fclose(Writer->File);
+        Writer->File = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/************************************************/
+
+//! Close streaming writer
+uint8_t BmpWriter_Close(struct BmpWriter_t *Writer) {
+    uint8_t Ok = (fclose(Writer->File) == 0);
+    Writer->File = NULL;
+    return Ok;
+}
+
+/************************************************/
+
+//! Write rows [y,y+nRows) of palette indices
+uint8_t BmpWriter_WriteRows(struct BmpWriter_t *Writer, const uint8_t *PxIdx, uint32_t y, uint32_t nRows) {
+    uint32_t n, RowPad = Writer->RowStride - Writer->Width, Zero = 0;
+    if (y > Writer->Height || nRows > Writer->Height - y) return 0;
+
+    //! Rows are stored bottom-up (see BmpReader_ReadRows())
+    uint64_t FileRow = Writer->Height - y - nRows;
+    if (FileSeek(Writer->File, Writer->DataOffs + FileRow * Writer->RowStride) != 0) return 0;
+    for (n = nRows; n--;) {
+        if (!fwrite(PxIdx + (size_t) n * Writer->Width, Writer->Width * sizeof(uint8_t), 1, Writer->File)) return 0;
+        if (RowPad && !fwrite(&Zero, RowPad, 1, Writer->File)) return 0;
+    }
+    return 1;
+}
+
 /************************************************/
 //! EOF
 /************************************************/
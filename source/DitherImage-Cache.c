@@ -0,0 +1,204 @@
+/************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+/************************************************/
+#include "DitherImage-Cache.h"
+#include "DitherImage-Colourspace.h"
+#include "DitherImage-Kernels.h"
+#include "DitherImage-Search.h"
+#include "Vec4f.h"
+/************************************************/
+
+//! Pixels processed per batch
+//! Misses are gathered over a batch and then converted (and searched)
+//! together, so that the row kernels still see contiguous runs.
+#define COLOURCACHE_BATCH 64
+
+/************************************************/
+
+//! Find entry for colour
+//! Returns the entry for the key if it is in the table, otherwise the
+//! first free entry along the probe sequence (or NULL if none).
+static struct ColourCacheEntry_t *FindEntry(const struct ColourCache_t *Cache, uint32_t Key) {
+	uint32_t n;
+	uint32_t Mask = (1u << COLOURCACHE_SIZE_LOG2) - 1;
+	uint32_t Hash = (Key * 0x9E3779B1u) >> (32 - COLOURCACHE_SIZE_LOG2);
+	for(n=0;n<COLOURCACHE_MAX_PROBE;n++) {
+		struct ColourCacheEntry_t *Entry = &Cache->Entries[(Hash + n) & Mask];
+		if(!Entry->Used || Entry->Key == Key) return Entry;
+	}
+	return NULL;
+}
+
+//! Update hit statistics, and disable the cache if it doesn't pay off
+static void UpdateStats(struct ColourCache_t *Cache, uint32_t nLookups, uint32_t nHits) {
+	Cache->nLookups += nLookups;
+	Cache->nHits    += nHits;
+	if(Cache->nLookups >= COLOURCACHE_TRIAL_LOOKUPS && Cache->nHits*COLOURCACHE_MIN_HIT_RATIO < Cache->nLookups) {
+		Cache->Enabled = 0;
+	}
+}
+
+//! Load packed colour
+static inline uint32_t LoadKey(const uint8_t *Src) {
+	uint32_t Key;
+	memcpy(&Key, Src, sizeof(Key));
+	return Key;
+}
+
+/************************************************/
+
+//! Create colour cache
+uint8_t ColourCache_Create(
+	struct ColourCache_t *Cache,
+	const struct DitherKernels_t *Kernels,
+	uint8_t Colourspace,
+	uint8_t PremultipliedAlpha,
+	uint8_t Approx
+) {
+	void *Mem = malloc(COLOURCACHE_MEM_SIZE);
+	if(!Mem) {
+		Cache->Entries = NULL;
+		Cache->Values  = NULL;
+		Cache->OwnsMem = 0;
+		Cache->Enabled = 0;
+		return 0;
+	}
+	ColourCache_CreateInPlace(Cache, Mem, Kernels, Colourspace, PremultipliedAlpha, Approx);
+	Cache->OwnsMem = 1;
+	return 1;
+}
+
+//! Create colour cache in caller-supplied memory
+void ColourCache_CreateInPlace(
+	struct ColourCache_t *Cache,
+	void *Mem,
+	const struct DitherKernels_t *Kernels,
+	uint8_t Colourspace,
+	uint8_t PremultipliedAlpha,
+	uint8_t Approx
+) {
+	Cache->Values             = (Vec4f_t*)Mem;
+	Cache->Entries            = (struct ColourCacheEntry_t*)(Cache->Values + (1u << COLOURCACHE_SIZE_LOG2));
+	Cache->Kernels            = Kernels;
+	Cache->Colourspace        = Colourspace;
+	Cache->PremultipliedAlpha = PremultipliedAlpha;
+	Cache->Approx             = Approx;
+	Cache->OwnsMem            = 0;
+	Cache->Enabled            = 1;
+	Cache->nLookups           = 0;
+	Cache->nHits              = 0;
+	memset(Cache->Entries, 0, (1u << COLOURCACHE_SIZE_LOG2) * sizeof(struct ColourCacheEntry_t));
+}
+
+/************************************************/
+
+//! Destroy colour cache
+void ColourCache_Destroy(struct ColourCache_t *Cache) {
+	if(Cache->OwnsMem) free(Cache->Values);
+	Cache->Entries = NULL;
+	Cache->Values  = NULL;
+	Cache->Enabled = 0;
+}
+
+/************************************************/
+
+//! Convert RGBA8 pixels to the target colourspace
+void ColourCache_ConvertRow(struct ColourCache_t *Cache, Vec4f_t *Dst, const uint8_t *Src, uint32_t n) {
+	const struct DitherKernels_t *Kernels = Cache->Kernels;
+	while(n) {
+		uint32_t i, nBatch = (n < COLOURCACHE_BATCH) ? n : COLOURCACHE_BATCH;
+		if(!Cache->Enabled) {
+			Kernels->ConvertRow(Dst, Src, n, Cache->Colourspace, Cache->PremultipliedAlpha, Cache->Approx);
+			return;
+		}
+
+		//! Look up colours, gathering misses
+		uint32_t nMiss = 0;
+		uint8_t  MissPos[COLOURCACHE_BATCH];
+		uint8_t  MissSrc[COLOURCACHE_BATCH*4];
+		Vec4f_t  MissPx [COLOURCACHE_BATCH];
+		for(i=0;i<nBatch;i++) {
+			struct ColourCacheEntry_t *Entry = FindEntry(Cache, LoadKey(Src + i*4));
+			if(Entry && Entry->Used) {
+				Dst[i] = Cache->Values[Entry - Cache->Entries];
+			} else {
+				memcpy(MissSrc + nMiss*4, Src + i*4, 4);
+				MissPos[nMiss++] = (uint8_t)i;
+			}
+		}
+
+		//! Convert misses and add them to the cache
+		Kernels->ConvertRow(MissPx, MissSrc, nMiss, Cache->Colourspace, Cache->PremultipliedAlpha, Cache->Approx);
+		for(i=0;i<nMiss;i++) {
+			uint32_t Key = LoadKey(MissSrc + i*4);
+			Dst[MissPos[i]] = MissPx[i];
+			struct ColourCacheEntry_t *Entry = FindEntry(Cache, Key);
+			if(Entry && !Entry->Used) {
+				Entry->Key    = Key;
+				Entry->Used   = 1;
+				Entry->HasIdx = 0;
+				Cache->Values[Entry - Cache->Entries] = MissPx[i];
+			}
+		}
+		UpdateStats(Cache, nBatch, nBatch - nMiss);
+		Dst += nBatch;
+		Src += nBatch*4;
+		n   -= nBatch;
+	}
+}
+
+/************************************************/
+
+//! Map RGBA8 pixels to the closest palette entries (undithered)
+void ColourCache_MapRow(struct ColourCache_t *Cache, uint8_t *Dst, const uint8_t *Src, uint32_t n, const struct PalSearch_t *Pal) {
+	const struct DitherKernels_t *Kernels = Cache->Kernels;
+	while(n) {
+		uint32_t i, nBatch = (n < COLOURCACHE_BATCH) ? n : COLOURCACHE_BATCH;
+
+		//! Look up colours, gathering misses
+		//! When the cache is disabled, everything is simply a miss.
+		uint32_t nMiss = 0;
+		uint8_t  MissPos[COLOURCACHE_BATCH];
+		uint8_t  MissSrc[COLOURCACHE_BATCH*4];
+		uint8_t  MissIdx[COLOURCACHE_BATCH];
+		Vec4f_t  MissPx [COLOURCACHE_BATCH];
+		uint8_t  Enabled = Cache->Enabled;
+		for(i=0;i<nBatch;i++) {
+			struct ColourCacheEntry_t *Entry = Enabled ? FindEntry(Cache, LoadKey(Src + i*4)) : NULL;
+			if(Entry && Entry->Used && Entry->HasIdx) {
+				Dst[i] = Entry->Idx;
+			} else {
+				memcpy(MissSrc + nMiss*4, Src + i*4, 4);
+				MissPos[nMiss++] = (uint8_t)i;
+			}
+		}
+
+		//! Convert and match misses, and add them to the cache
+		Kernels->ConvertRow(MissPx, MissSrc, nMiss, Cache->Colourspace, Cache->PremultipliedAlpha, Cache->Approx);
+		Kernels->DitherRow(MissIdx, MissPx, 0, nMiss, 0, NULL, 0.0f, Pal);
+		for(i=0;i<nMiss;i++) {
+			Dst[MissPos[i]] = MissIdx[i];
+			if(Enabled) {
+				uint32_t Key = LoadKey(MissSrc + i*4);
+				struct ColourCacheEntry_t *Entry = FindEntry(Cache, Key);
+				if(Entry && !Entry->HasIdx) {
+					Entry->Key    = Key;
+					Entry->Used   = 1;
+					Entry->HasIdx = 1;
+					Entry->Idx    = MissIdx[i];
+					Cache->Values[Entry - Cache->Entries] = MissPx[i];
+				}
+			}
+		}
+		if(Enabled) UpdateStats(Cache, nBatch, nBatch - nMiss);
+		Dst += nBatch;
+		Src += nBatch*4;
+		n   -= nBatch;
+	}
+}
+
+/************************************************/
+//! EOF
+/************************************************/
@@ -0,0 +1,210 @@
+/************************************************/
+#include <stdatomic.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+/************************************************/
+#include "DitherImage-Grid.h"
+#include "DitherImage-Kernels.h"
+#include "DitherImage-Search.h"
+#include "Vec4f.h"
+/************************************************/
+
+//! RGB lattice points per axis for finding the range of the grid
+#define DITHERGRID_RANGE_STEPS 33
+
+/************************************************/
+
+//! Matrix entry, for sorting by threshold
+struct MatrixEntry_t {
+	float    Threshold;
+	uint32_t Pos;
+};
+
+//! Compare matrix entries by threshold
+static int CompareEntries(const void *a, const void *b) {
+	const struct MatrixEntry_t *EntryA = (const struct MatrixEntry_t*)a;
+	const struct MatrixEntry_t *EntryB = (const struct MatrixEntry_t*)b;
+	if(EntryA->Threshold != EntryB->Threshold) return (EntryA->Threshold < EntryB->Threshold) ? -1 : +1;
+	return (EntryA->Pos < EntryB->Pos) ? -1 : (EntryA->Pos > EntryB->Pos);
+}
+
+//! Assign threshold levels to matrix entries
+//! Entries with the same threshold give the same results, so they
+//! share a level. Returns the number of levels, or 0 on failure.
+static uint32_t AssignLevels(struct DitherGrid_t *Grid, const struct DitherMatrix_t *Matrix) {
+	uint32_t n, nLevels = 0;
+	uint32_t nEntries = Matrix->Width * Matrix->Height;
+	struct MatrixEntry_t *Entries = malloc(nEntries * sizeof(struct MatrixEntry_t));
+	Grid->MatrixLevel = malloc(nEntries * sizeof(uint16_t));
+	Grid->LevelPos    = malloc(DITHERGRID_MAX_LEVELS * sizeof(uint32_t));
+	if(!Entries || !Grid->MatrixLevel || !Grid->LevelPos) {
+		free(Entries);
+		return 0;
+	}
+	for(n=0;n<nEntries;n++) Entries[n] = (struct MatrixEntry_t){.Threshold = Matrix->Thresholds[n], .Pos = n};
+	qsort(Entries, nEntries, sizeof(struct MatrixEntry_t), CompareEntries);
+	for(n=0;n<nEntries;n++) {
+		if(!n || Entries[n].Threshold != Entries[n-1].Threshold) {
+			if(nLevels == DITHERGRID_MAX_LEVELS) {
+				nLevels = 0;
+				break;
+			}
+			Grid->LevelPos[nLevels++] = Entries[n].Pos;
+		}
+		Grid->MatrixLevel[Entries[n].Pos] = (uint16_t)(nLevels-1);
+	}
+	free(Entries);
+	return nLevels;
+}
+
+//! Find the range of the target colourspace
+//! Every opaque RGB colour must land inside the grid, so this takes
+//! the range over a lattice of them, plus a small margin.
+static void FindRange(struct DitherGrid_t *Grid, uint8_t Colourspace, uint8_t PremultipliedAlpha, uint8_t Approx) {
+	uint32_t c, r, g, b;
+	float Max[3];
+	uint8_t Src[DITHERGRID_RANGE_STEPS*4];
+	Vec4f_t Dst[DITHERGRID_RANGE_STEPS];
+	for(c=0;c<3;c++) Grid->Min[c] = INFINITY, Max[c] = -INFINITY;
+	for(b=0;b<DITHERGRID_RANGE_STEPS;b++) for(g=0;g<DITHERGRID_RANGE_STEPS;g++) {
+		for(r=0;r<DITHERGRID_RANGE_STEPS;r++) {
+			Src[r*4+0] = (uint8_t)((r*255) / (DITHERGRID_RANGE_STEPS-1));
+			Src[r*4+1] = (uint8_t)((g*255) / (DITHERGRID_RANGE_STEPS-1));
+			Src[r*4+2] = (uint8_t)((b*255) / (DITHERGRID_RANGE_STEPS-1));
+			Src[r*4+3] = 0xFF;
+		}
+		Grid->Kernels->ConvertRow(Dst, Src, DITHERGRID_RANGE_STEPS, Colourspace, PremultipliedAlpha, Approx);
+		for(r=0;r<DITHERGRID_RANGE_STEPS;r++) for(c=0;c<3;c++) {
+			if(Dst[r].f32[c] < Grid->Min[c]) Grid->Min[c] = Dst[r].f32[c];
+			if(Dst[r].f32[c] > Max[c])       Max[c]       = Dst[r].f32[c];
+		}
+	}
+	Grid->Alpha = Dst[0].f32[3];
+	for(c=0;c<3;c++) {
+		float Margin = (Max[c] - Grid->Min[c]) * (1.0f/64) + 1.0e-6f;
+		Grid->Min[c] -= Margin;
+		Max[c]       += Margin;
+		Grid->Scale[c] = (float)Grid->nCells / (Max[c] - Grid->Min[c]);
+	}
+}
+
+/************************************************/
+
+//! Create ordered dither lookup grid
+uint8_t DitherGrid_Create(
+	struct DitherGrid_t *Grid,
+	const struct DitherKernels_t *Kernels,
+	uint8_t  Colourspace,
+	uint8_t  PremultipliedAlpha,
+	uint8_t  Approx,
+	const struct DitherMatrix_t *Matrix,
+	float    DitherLevel,
+	size_t   MaxMemory
+) {
+	Grid->Entries     = NULL;
+	Grid->MatrixLevel = NULL;
+	Grid->LevelPos    = NULL;
+	Grid->Matrix      = Matrix;
+	Grid->DitherLevel = DitherLevel;
+	Grid->Kernels     = Kernels;
+	atomic_init(&Grid->nLookups, 0);
+	atomic_init(&Grid->nMisses,  0);
+
+	//! Get threshold levels
+	Grid->nLevels = AssignLevels(Grid, Matrix);
+	if(!Grid->nLevels) {
+		DitherGrid_Destroy(Grid);
+		return 0;
+	}
+
+	//! Fit as many cells as we can into the memory
+	uint32_t nCells = DITHERGRID_MAX_CELLS;
+	while(nCells >= DITHERGRID_MIN_CELLS && DITHERGRID_MEM_SIZE(nCells, Grid->nLevels) > MaxMemory) nCells--;
+	if(nCells < DITHERGRID_MIN_CELLS) {
+		DitherGrid_Destroy(Grid);
+		return 0;
+	}
+	Grid->nCells = nCells;
+
+	//! Allocate entries (all empty)
+	Grid->Entries = calloc(DITHERGRID_MEM_SIZE(nCells, Grid->nLevels), 1);
+	if(!Grid->Entries) {
+		DitherGrid_Destroy(Grid);
+		return 0;
+	}
+	FindRange(Grid, Colourspace, PremultipliedAlpha, Approx);
+	return 1;
+}
+
+/************************************************/
+
+//! Destroy ordered dither lookup grid
+void DitherGrid_Destroy(struct DitherGrid_t *Grid) {
+	free(Grid->Entries);
+	free(Grid->MatrixLevel);
+	free(Grid->LevelPos);
+	Grid->Entries     = NULL;
+	Grid->MatrixLevel = NULL;
+	Grid->LevelPos    = NULL;
+}
+
+/************************************************/
+
+//! Map pixels [x0,x1) of row y through the grid
+void DitherGrid_MapRow(
+	struct DitherGrid_t *Grid,
+	      uint8_t *Dst,
+	const Vec4f_t *Px,
+	uint32_t x0,
+	uint32_t x1,
+	uint32_t y,
+	const struct PalSearch_t *Pal
+) {
+	uint32_t x, c;
+	uint32_t nCells  = Grid->nCells;
+	uint32_t Width   = Grid->Matrix->Width;
+	uint32_t nLookups = 0, nMisses = 0;
+	const uint16_t *LevelRow = Grid->MatrixLevel + (y % Grid->Matrix->Height)*Width;
+	uint32_t Col = x0 % Width;
+	for(x=x0;x<x1;x++,Px++,Dst++) {
+		uint32_t Level = LevelRow[Col];
+		if(++Col == Width) Col = 0;
+
+		//! Find cell, dithering exactly if outside the grid
+		uint32_t Cell[3];
+		for(c=0;c<3;c++) {
+			float f = (Px->f32[c] - Grid->Min[c]) * Grid->Scale[c];
+			if(!(f >= 0.0f && f < (float)nCells)) break;
+			Cell[c] = (uint32_t)f;
+		}
+		if(c < 3) {
+			Grid->Kernels->DitherRow(Dst, Px, x, x+1, y, Grid->Matrix, Grid->DitherLevel, Pal);
+			continue;
+		}
+
+		//! Look up entry, computing it from the cell centre if needed
+		size_t Idx = ((size_t)(Cell[2]*nCells + Cell[1])*nCells + Cell[0])*Grid->nLevels + Level;
+		uint16_t Entry = atomic_load_explicit(&Grid->Entries[Idx], memory_order_relaxed);
+		if(!Entry) {
+			uint8_t  BestIdx;
+			uint32_t Pos = Grid->LevelPos[Level];
+			Vec4f_t Centre;
+			for(c=0;c<3;c++) Centre.f32[c] = Grid->Min[c] + ((float)Cell[c] + 0.5f) / Grid->Scale[c];
+			Centre.f32[3] = Grid->Alpha;
+			Grid->Kernels->DitherRow(&BestIdx, &Centre, Pos % Width, Pos % Width + 1, Pos / Width, Grid->Matrix, Grid->DitherLevel, Pal);
+			Entry = (uint16_t)(BestIdx + 1);
+			atomic_store_explicit(&Grid->Entries[Idx], Entry, memory_order_relaxed);
+			nMisses++;
+		}
+		*Dst = (uint8_t)(Entry - 1);
+		nLookups++;
+	}
+	atomic_fetch_add_explicit(&Grid->nLookups, nLookups, memory_order_relaxed);
+	atomic_fetch_add_explicit(&Grid->nMisses,  nMisses,  memory_order_relaxed);
+}
+
+/************************************************/
+//! EOF
+/************************************************/
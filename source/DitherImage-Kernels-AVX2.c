@@ -0,0 +1,8 @@
+/************************************************/
+//! AVX2 kernels (compiled with -mavx2)
+/************************************************/
+#define DITHERKERNELS_ISA AVX2
+#include "DitherImage-Kernels-Template.h"
+/************************************************/
+//! EOF
+/************************************************/
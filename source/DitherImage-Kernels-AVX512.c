@@ -0,0 +1,8 @@
+/************************************************/
+//! AVX-512 kernels (compiled with -mavx2 -mavx512f)
+/************************************************/
+#define DITHERKERNELS_ISA AVX512
+#include "DitherImage-Kernels-Template.h"
+/************************************************/
+//! EOF
+/************************************************/
@@ -0,0 +1,306 @@
+/************************************************/
+//! Planar colour conversion kernels
+//! This file is included by DitherImage-Kernels-Template.h, so it is
+//! compiled once per instruction set. Pixels are converted in blocks
+//! of CONVERT_WIDTH lanes using GCC vector extensions, which map onto
+//! the widest registers the compiler may use (or plain scalar code).
+//! The arithmetic is done in the same order as ConvertToColourspace(),
+//! so with exact transcendentals the results are bit-identical to it.
+/************************************************/
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+/************************************************/
+#include "DitherImage-Colourspace.h"
+#include "DitherImage-Tables.h"
+#include "Vec4f.h"
+/************************************************/
+
+//! Conversion vector types
+#if defined(__AVX512F__)
+# define CONVERT_WIDTH 16
+#elif defined(__AVX2__)
+# define CONVERT_WIDTH 8
+#else
+# define CONVERT_WIDTH 4
+#endif
+typedef float   ConvVec_t  __attribute__((vector_size(CONVERT_WIDTH*sizeof(float))));
+typedef int32_t ConvVeci_t __attribute__((vector_size(CONVERT_WIDTH*sizeof(int32_t))));
+
+//! Pixels per block for ConvertRow()
+#define CONVERT_BLOCK 64
+
+/************************************************/
+
+//! Broadcast scalar to all lanes
+static inline ConvVec_t ConvVec_Broadcast(float x) {
+	return (ConvVec_t){0} + x;
+}
+
+//! Select lanes from a (where Mask is set) or b
+static inline ConvVec_t ConvVec_Select(ConvVeci_t Mask, ConvVec_t a, ConvVec_t b) {
+	return (ConvVec_t)((Mask & (ConvVeci_t)a) | (~Mask & (ConvVeci_t)b));
+}
+
+//! Cube root (approximate)
+//! The initial estimate is taken from the exponent bits, followed by
+//! two Newton-Raphson iterations.
+//! Maximum relative error: 1.2e-6 (over all normal floats).
+static inline ConvVec_t ConvVec_CbrtApprox(ConvVec_t x) {
+	ConvVeci_t Sign = (ConvVeci_t)x & (int32_t)0x80000000;
+	ConvVec_t  a    = (ConvVec_t)((ConvVeci_t)x & 0x7FFFFFFF);
+	ConvVec_t  y    = (ConvVec_t)(__builtin_convertvector(
+		__builtin_convertvector((ConvVeci_t)a, ConvVec_t) * (1.0f/3),
+		ConvVeci_t
+	) + 0x2A514067);
+	ConvVec_t a3 = a * (1.0f/3);
+	y = y*(2.0f/3) + a3 / (y*y);
+	y = y*(2.0f/3) + a3 / (y*y);
+	y = ConvVec_Select(a > 0.0f, y, ConvVec_Broadcast(0.0f));
+	return (ConvVec_t)((ConvVeci_t)y | Sign);
+}
+
+//! Power function for x > 0, and 0 otherwise (approximate)
+//! This is computed as exp2(p*log2(x)), with log2() from the atanh()
+//! series of the mantissa (to s^7), and exp2() from the Taylor series
+//! of the fractional part over [-0.5,0.5] (to f^6).
+//! Maximum relative error: 1.1e-6 (for x in [2^-20,2], with p = 2.2/3).
+static inline ConvVec_t ConvVec_PowApprox(ConvVec_t x, float p) {
+	ConvVeci_t b = (ConvVeci_t)x;
+	ConvVeci_t e = ((b >> 23) & 0xFF) - 127;
+	ConvVec_t  m = (ConvVec_t)((b & 0x007FFFFF) | 0x3F800000);
+	ConvVeci_t Big = m > 1.41421356f;
+	m  = ConvVec_Select(Big, m * 0.5f, m);
+	e -= Big;
+
+	//! log2(m) = 2/ln(2) * atanh(s), s = (m-1)/(m+1)
+	ConvVec_t s  = (m - 1.0f) / (m + 1.0f);
+	ConvVec_t s2 = s*s;
+	ConvVec_t l  = s*(2.88539008f + s2*(0.961796694f + s2*(0.577078016f + s2*0.412198583f)));
+
+	//! exp2(y) = 2^k * exp2(f), k = round(y)
+	ConvVec_t  y  = (__builtin_convertvector(e, ConvVec_t) + l) * p;
+	           y  = ConvVec_Select(y < -126.0f, ConvVec_Broadcast(-126.0f), y);
+	ConvVec_t  yr = y + 0.5f;
+	ConvVeci_t k  = __builtin_convertvector(yr, ConvVeci_t);
+	           k += (__builtin_convertvector(k, ConvVec_t) > yr);
+	ConvVec_t  f  = y - __builtin_convertvector(k, ConvVec_t);
+	ConvVec_t  r  = 1.0f + f*(0.693147181f + f*(0.240226507f + f*(0.0555041087f + f*(0.00961812911f + f*(0.00133335581f + f*0.000154035304f)))));
+	r = r * (ConvVec_t)((k + 127) << 23);
+	return ConvVec_Select(x > 0.0f, r, ConvVec_Broadcast(0.0f));
+}
+
+//! Cube root
+static inline ConvVec_t ConvVec_Cbrt(ConvVec_t x, uint8_t Approx) {
+	uint32_t i;
+	if(Approx) return ConvVec_CbrtApprox(x);
+	for(i=0;i<CONVERT_WIDTH;i++) x[i] = cbrtf(x[i]);
+	return x;
+}
+
+//! RGBtoVisualRGB()
+static inline ConvVec_t ConvVec_RGBtoVisualRGB(ConvVec_t x, uint8_t Approx) {
+	uint32_t i;
+	if(Approx) return ConvVec_PowApprox(x, (float)(2.2 / 3.0));
+	for(i=0;i<CONVERT_WIDTH;i++) x[i] = RGBtoVisualRGB(x[i]);
+	return x;
+}
+
+//! LABf()
+static inline ConvVec_t ConvVec_LABf(ConvVec_t t, uint8_t Approx) {
+	const float a = 0.008856f;
+	const float b = 7.787037f;
+	return ConvVec_Select(t > a, ConvVec_Cbrt(t, Approx), (float)(4.0/29.0) + b*t);
+}
+
+//! sqrtf(fmaxf(0.0f, x))
+static inline ConvVec_t ConvVec_SqrtPos(ConvVec_t x) {
+	uint32_t i;
+	for(i=0;i<CONVERT_WIDTH;i++) x[i] = sqrtf(fmaxf(0.0f, x[i]));
+	return x;
+}
+
+/************************************************/
+
+//! ConvertTransferredToColourspace() for non-separable colourspaces
+static inline void ConvVec_ConvertTransferred(ConvVec_t *c, uint8_t Colourspace, uint8_t Approx) {
+	ConvVec_t R = c[0], G = c[1], B = c[2];
+	switch(Colourspace) {
+		case COLOURSPACE_YCBCR:
+		case COLOURSPACE_YCBCR_PSY: {
+			c[0] =  0.2126f*R + 0.71520f*G + 0.0722f*B;
+			c[1] = -0.1146f*R - 0.38540f*G + 0.5000f*B;
+			c[2] =  0.5000f*R - 0.45420f*G - 0.0458f*B;
+			if(Colourspace == COLOURSPACE_YCBCR_PSY) {
+				c[0]  = ConvVec_RGBtoVisualRGB(c[0], Approx);
+				c[1] *= 0.5f;
+			}
+		} break;
+		case COLOURSPACE_YCOCG:
+		case COLOURSPACE_YCOCG_PSY: {
+			c[0] =  0.25f*R + 0.5f*G + 0.25f*B;
+			c[1] =  0.50f*R          - 0.50f*B;
+			c[2] = -0.25f*R + 0.5f*G - 0.25f*B;
+			if(Colourspace == COLOURSPACE_YCOCG_PSY) {
+				c[0] = ConvVec_RGBtoVisualRGB(c[0], Approx);
+			}
+		} break;
+		case COLOURSPACE_CIELAB: {
+			ConvVec_t X = 0.412453f*R + 0.357580f*G + 0.180423f*B;
+			ConvVec_t Y = 0.212671f*R + 0.715160f*G + 0.072169f*B;
+			ConvVec_t Z = 0.019334f*R + 0.119193f*G + 0.950227f*B;
+			ConvVec_t Xz = ConvVec_LABf(X / 0.950489f, Approx);
+			ConvVec_t Yz = ConvVec_LABf(Y,             Approx);
+			ConvVec_t Zz = ConvVec_LABf(Z / 1.08884f,  Approx);
+			c[0] = 1.16f*(Yz     ) - 0.16f;
+			c[1] = 5.00f*(Xz - Yz);
+			c[2] = 2.00f*(Yz - Zz);
+		} break;
+		case COLOURSPACE_ICTCP: {
+			//! No approximation here: sqrtf() is correctly rounded, and
+			//! is a hardware instruction that no polynomial would beat.
+			ConvVec_t L = ConvVec_SqrtPos(0.412221f*R + 0.536333f*G + 0.051446f*B);
+			ConvVec_t M = ConvVec_SqrtPos(0.211903f*R + 0.680700f*G + 0.107397f*B);
+			ConvVec_t S = ConvVec_SqrtPos(0.088302f*R + 0.281719f*G + 0.629979f*B);
+			c[0] = 0.500000f*L + 0.500000f*M;
+			c[1] = 0.885010f*L - 1.822510f*M + 0.937500f*S;
+			c[2] = 2.319336f*L - 2.249023f*M - 0.070313f*S;
+		} break;
+		case COLOURSPACE_OKLAB: {
+			ConvVec_t L = ConvVec_Cbrt(0.412221f*R + 0.536333f*G + 0.051446f*B, Approx);
+			ConvVec_t M = ConvVec_Cbrt(0.211903f*R + 0.680700f*G + 0.107397f*B, Approx);
+			ConvVec_t S = ConvVec_Cbrt(0.088302f*R + 0.281719f*G + 0.629979f*B, Approx);
+			c[0] = 0.210454f*L + 0.793618f*M - 0.004072f*S;
+			c[1] = 1.977998f*L - 2.428592f*M + 0.450594f*S;
+			c[2] = 0.025904f*L + 0.782772f*M - 0.808676f*S;
+		} break;
+	}
+}
+
+/************************************************/
+
+//! Convert RGBA8 pixels to the target colourspace, into planar rows
+static void ConvertRowPlanar(
+	float *const   Dst[4],
+	const uint8_t *Src,
+	uint32_t n,
+	uint8_t  Colourspace,
+	uint8_t  PremultipliedAlpha,
+	uint8_t  Approx
+) {
+	uint32_t i, x;
+
+	//! Unknown colourspace? Convert directly
+	const struct ColourTables_t *Tab = ColourTables_Get(Colourspace);
+	if(!Tab) {
+		for(x=0;x<n;x++) {
+			Vec4f_t t;
+			t.f32[0] = Src[x*4+0] / 255.0f;
+			t.f32[1] = Src[x*4+1] / 255.0f;
+			t.f32[2] = Src[x*4+2] / 255.0f;
+			t.f32[3] = Src[x*4+3] / 255.0f;
+			t = ConvertToColourspace(&t, Colourspace);
+			if(!PremultipliedAlpha) {
+				t.f32[0] *= t.f32[3];
+				t.f32[1] *= t.f32[3];
+				t.f32[2] *= t.f32[3];
+			}
+			for(i=0;i<4;i++) Dst[i][x] = t.f32[i];
+		}
+		return;
+	}
+
+	//! Convert blocks of pixels
+	//! Lanes past the end of the row repeat the first pixel of the block.
+	const float *RGB = atomic_load_explicit(&Tab->RGB, memory_order_acquire);
+	for(x=0;x<n;x+=CONVERT_WIDTH) {
+		uint32_t  nLanes = (n-x < CONVERT_WIDTH) ? (n-x) : CONVERT_WIDTH;
+		ConvVec_t c[4];
+		for(i=0;i<CONVERT_WIDTH;i++) {
+			const uint8_t *p = Src + (x + ((i < nLanes) ? i : 0))*4;
+			if(RGB) {
+				const float *Entry = RGB + (p[0] | p[1]<<8 | p[2]<<16)*3;
+				c[0][i] = Entry[0];
+				c[1][i] = Entry[1];
+				c[2][i] = Entry[2];
+			} else {
+				c[0][i] = Tab->Channel[0][p[0]];
+				c[1][i] = Tab->Channel[1][p[1]];
+				c[2][i] = Tab->Channel[2][p[2]];
+			}
+			c[3][i] = p[3];
+		}
+		c[3] = c[3] / 255.0f;
+		if(!RGB && !Tab->Separable) ConvVec_ConvertTransferred(c, Colourspace, Approx);
+		if(!PremultipliedAlpha) {
+			c[0] *= c[3];
+			c[1] *= c[3];
+			c[2] *= c[3];
+		}
+		if(nLanes == CONVERT_WIDTH) {
+			for(i=0;i<4;i++) memcpy(Dst[i] + x, &c[i], sizeof(ConvVec_t));
+		} else {
+			uint32_t Lane;
+			for(i=0;i<4;i++) for(Lane=0;Lane<nLanes;Lane++) Dst[i][x+Lane] = c[i][Lane];
+		}
+	}
+}
+
+//! Convert RGBA8 pixels to the target colourspace
+//! Pixels are converted to planar form in blocks, and then interleaved,
+//! except when the conversion is only a table lookup anyway.
+static void ConvertRow(
+	      Vec4f_t *Dst,
+	const uint8_t *Src,
+	uint32_t n,
+	uint8_t  Colourspace,
+	uint8_t  PremultipliedAlpha,
+	uint8_t  Approx
+) {
+	uint32_t i, x;
+	const struct ColourTables_t *Tab = ColourTables_Get(Colourspace);
+	const float *RGB = Tab ? atomic_load_explicit(&Tab->RGB, memory_order_acquire) : NULL;
+	if(RGB || (Tab && Tab->Separable)) {
+		for(x=0;x<n;x++) {
+			Vec4f_t t;
+			if(RGB) {
+				const float *Entry = RGB + (Src[0] | Src[1]<<8 | Src[2]<<16)*3;
+				t.f32[0] = Entry[0];
+				t.f32[1] = Entry[1];
+				t.f32[2] = Entry[2];
+			} else {
+				t.f32[0] = Tab->Channel[0][Src[0]];
+				t.f32[1] = Tab->Channel[1][Src[1]];
+				t.f32[2] = Tab->Channel[2][Src[2]];
+			}
+			t.f32[3] = Src[3] / 255.0f;
+			if(!PremultipliedAlpha) {
+				t.f32[0] *= t.f32[3];
+				t.f32[1] *= t.f32[3];
+				t.f32[2] *= t.f32[3];
+			}
+			Dst[x] = t;
+			Src += 4;
+		}
+		return;
+	}
+
+	//! Convert via planar rows
+	float Planes[4][CONVERT_BLOCK];
+	float *const Ptr[4] = {Planes[0], Planes[1], Planes[2], Planes[3]};
+	for(x=0;x<n;x+=CONVERT_BLOCK) {
+		uint32_t nPx = (n-x < CONVERT_BLOCK) ? (n-x) : CONVERT_BLOCK;
+		ConvertRowPlanar(Ptr, Src + x*4, nPx, Colourspace, PremultipliedAlpha, Approx);
+		for(i=0;i<nPx;i++) {
+			Dst[x+i].f32[0] = Planes[0][i];
+			Dst[x+i].f32[1] = Planes[1][i];
+			Dst[x+i].f32[2] = Planes[2][i];
+			Dst[x+i].f32[3] = Planes[3][i];
+		}
+	}
+}
+
+/************************************************/
+//! EOF
+/************************************************/
@@ -0,0 +1,118 @@
+/************************************************/
+//! Source row decoding kernels
+//! This file is included by DitherImage-Kernels-Template.h, so it is
+//! compiled once per instruction set. Source rows in any of the
+//! DITHER_FORMAT_* formats are decoded to RGBA8, several pixels at a
+//! time: AVX2 uses byte shuffles (and gathers for indexed pixels),
+//! SSE2 uses 32-bit shifts, and anything else falls back to scalar.
+/************************************************/
+#include <stdint.h>
+#include <string.h>
+/************************************************/
+#if defined(__SSE2__)
+# include <immintrin.h>
+#endif
+/************************************************/
+#include "DitherImage.h"
+/************************************************/
+
+//! Swap R and B of n 4-byte pixels, optionally forcing alpha to 0xFF
+//! Dst may be the same as Src.
+static void DecodeRow_Swizzle(uint8_t *Dst, const uint8_t *Src, uint32_t n, uint8_t Opaque) {
+	uint32_t i = 0;
+#if defined(__AVX2__)
+	const __m256i Shuf = _mm256_setr_epi8(
+		2,1,0,3, 6,5,4,7, 10,9,8,11, 14,13,12,15,
+		2,1,0,3, 6,5,4,7, 10,9,8,11, 14,13,12,15
+	);
+	const __m256i Alpha = _mm256_set1_epi32(Opaque ? (int32_t)0xFF000000 : 0);
+	for(;i+8<=n;i+=8) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(Src + i*4));
+		x = _mm256_or_si256(_mm256_shuffle_epi8(x, Shuf), Alpha);
+		_mm256_storeu_si256((__m256i*)(Dst + i*4), x);
+	}
+#elif defined(__SSE2__)
+	const __m128i MaskAG  = _mm_set1_epi32((int32_t)0xFF00FF00);
+	const __m128i MaskRB  = _mm_set1_epi32(0x000000FF);
+	const __m128i Alpha   = _mm_set1_epi32(Opaque ? (int32_t)0xFF000000 : 0);
+	for(;i+4<=n;i+=4) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(Src + i*4));
+		__m128i y = _mm_and_si128(x, MaskAG);
+		y = _mm_or_si128(y, _mm_and_si128(_mm_srli_epi32(x, 16), MaskRB));
+		y = _mm_or_si128(y, _mm_slli_epi32(_mm_and_si128(x, MaskRB), 16));
+		_mm_storeu_si128((__m128i*)(Dst + i*4), _mm_or_si128(y, Alpha));
+	}
+#endif
+	for(;i<n;i++) {
+		uint8_t b = Src[i*4+0], g = Src[i*4+1], r = Src[i*4+2], a = Src[i*4+3];
+		Dst[i*4+0] = r;
+		Dst[i*4+1] = g;
+		Dst[i*4+2] = b;
+		Dst[i*4+3] = Opaque ? 0xFF : a;
+	}
+}
+
+//! Expand n 3-byte pixels to 4 bytes, with alpha 0xFF
+//! If Swap is set, the first and third bytes are swapped (ie. BGR to
+//! RGBA); otherwise, the byte order is kept (ie. RGB to RGBA, and BGR
+//! to BGRA).
+static void DecodeRow_Expand(uint8_t *Dst, const uint8_t *Src, uint32_t n, uint8_t Swap) {
+	uint32_t i = 0;
+#if defined(__AVX2__)
+	//! Each half loads 16 bytes for 4 pixels (12 bytes), so stop early
+	//! enough that the last load stays inside the source row
+	const __m256i Shuf = Swap ? _mm256_setr_epi8(
+		2,1,0,-1, 5,4,3,-1, 8,7,6,-1, 11,10,9,-1,
+		2,1,0,-1, 5,4,3,-1, 8,7,6,-1, 11,10,9,-1
+	) : _mm256_setr_epi8(
+		0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1,
+		0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1
+	);
+	const __m256i Alpha = _mm256_set1_epi32((int32_t)0xFF000000);
+	for(;i+10<=n;i+=8) {
+		__m128i Lo = _mm_loadu_si128((const __m128i*)(Src + i*3));
+		__m128i Hi = _mm_loadu_si128((const __m128i*)(Src + i*3 + 12));
+		__m256i x  = _mm256_inserti128_si256(_mm256_castsi128_si256(Lo), Hi, 1);
+		x = _mm256_or_si256(_mm256_shuffle_epi8(x, Shuf), Alpha);
+		_mm256_storeu_si256((__m256i*)(Dst + i*4), x);
+	}
+#endif
+	uint8_t c0 = Swap ? 2 : 0, c2 = Swap ? 0 : 2;
+	for(;i<n;i++) {
+		Dst[i*4+0] = Src[i*3+c0];
+		Dst[i*4+1] = Src[i*3+1];
+		Dst[i*4+2] = Src[i*3+c2];
+		Dst[i*4+3] = 0xFF;
+	}
+}
+
+//! Look up n indexed pixels in an RGBA palette of 256 entries
+static void DecodeRow_Indexed(uint8_t *Dst, const uint8_t *Src, uint32_t n, const uint8_t *Palette) {
+	uint32_t i = 0;
+#if defined(__AVX2__)
+	for(;i+8<=n;i+=8) {
+		__m256i Idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(Src + i)));
+		__m256i x   = _mm256_i32gather_epi32((const int*)Palette, Idx, 4);
+		_mm256_storeu_si256((__m256i*)(Dst + i*4), x);
+	}
+#endif
+	for(;i<n;i++) memcpy(Dst + i*4, Palette + Src[i]*4, 4);
+}
+
+/************************************************/
+
+//! Decode n source pixels to RGBA8
+static void DecodeRow(uint8_t *Dst, const uint8_t *Src, uint32_t n, uint8_t Format, const uint8_t *Palette) {
+	switch(Format) {
+		case DITHER_FORMAT_RGBA:    if(Dst != Src) memcpy(Dst, Src, n*4); break;
+		case DITHER_FORMAT_BGRA:    DecodeRow_Swizzle(Dst, Src, n, 0);    break;
+		case DITHER_FORMAT_BGRX:    DecodeRow_Swizzle(Dst, Src, n, 1);    break;
+		case DITHER_FORMAT_RGB:     DecodeRow_Expand (Dst, Src, n, 0);    break;
+		case DITHER_FORMAT_BGR:     DecodeRow_Expand (Dst, Src, n, 1);    break;
+		case DITHER_FORMAT_INDEXED: DecodeRow_Indexed(Dst, Src, n, Palette); break;
+	}
+}
+
+/************************************************/
+//! EOF
+/************************************************/
@@ -0,0 +1,8 @@
+/************************************************/
+//! Generic kernels (baseline instruction set of the target)
+/************************************************/
+#define DITHERKERNELS_ISA Generic
+#include "DitherImage-Kernels-Template.h"
+/************************************************/
+//! EOF
+/************************************************/
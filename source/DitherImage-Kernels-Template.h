@@ -0,0 +1,870 @@
+/************************************************/
+//! Kernel template
+//! This file is included by each DitherImage-Kernels-*.c unit, which
+//! are compiled with different instruction-set flags. Everything here
+//! must be static, apart from the kernel table itself, whose name is
+//! taken from DITHERKERNELS_ISA.
+//! NOTE: The intrinsic paths are selected by what the compiler has
+//! been told it may use (eg. -mavx2), not by DITHERKERNELS_ISA.
+/************************************************/
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+/************************************************/
+#if defined(__SSE2__)
+# include <immintrin.h>
+#endif
+/************************************************/
+#include "DitherImage-Colourspace.h"
+#include "DitherImage-Kernels-Convert.h"
+#include "DitherImage-Kernels-Decode.h"
+#include "DitherImage-Kernels.h"
+#include "DitherImage-Search.h"
+#include "DitherImage-Tables.h"
+#include "Vec4f.h"
+/************************************************/
+#ifndef DITHERKERNELS_ISA
+# error "DITHERKERNELS_ISA must be defined before including this file."
+#endif
+/************************************************/
+
+//! Running best match
+struct BestMatch_t {
+	float    Dist;
+	uint32_t Idx;
+};
+
+//! Update closest match
+//! Because the tree is not traversed in palette order, ties must
+//! explicitly be resolved towards the lowest index to match a scan.
+static inline void UpdateNearest(struct BestMatch_t *Best, float Dist, uint32_t Idx) {
+	if(Dist < Best->Dist || (Dist == Best->Dist && Idx < Best->Idx)) {
+		Best->Dist = Dist;
+		Best->Idx  = Idx;
+	}
+}
+
+//! Update closest two matches
+//! B tracks the closest entry whose distance is strictly greater than A.
+static inline void UpdateNearestTwo(struct BestMatch_t *A, struct BestMatch_t *B, float Dist, uint32_t Idx) {
+	if(Dist < A->Dist) {
+		*B = *A;
+		A->Dist = Dist;
+		A->Idx  = Idx;
+	} else if(Dist == A->Dist) {
+		if(Idx < A->Idx) A->Idx = Idx;
+	} else if(Dist < B->Dist || (Dist == B->Dist && Idx < B->Idx)) {
+		B->Dist = Dist;
+		B->Idx  = Idx;
+	}
+}
+
+//! Get distance between colours
+//! For opaque searches, the alpha channel (which is then the same for
+//! both colours) is skipped; this gives the exact same distance.
+static inline float PalDist2(const Vec4f_t *a, const Vec4f_t *b, uint8_t Opaque) {
+	return Opaque ? Vec4f_Dist2XYZ(a, b) : Vec4f_Dist2(a, b);
+}
+
+/************************************************/
+
+//! Scan the range [Lo,Hi) of the tree-ordered entries
+//! These are the leaf kernels; SIMD versions process entries in
+//! blocks of their vector width, and so may run past Hi (into other
+//! entries or the NaN padding). That is harmless, as extra entries
+//! can never change the exact result, and NaN never compares true.
+//! Distances are summed in the same order as Vec4f_Dist2(), without
+//! contraction, so every lane is bit-exact with the scalar path.
+//! Each lane keeps its own best match(es), seeded from the incoming
+//! ones, and the lanes are then reduced with the same tie-breaking.
+#if defined(__AVX512F__)
+# define PALSEARCH_SIMD_WIDTH 16
+static inline __m512 ScanDist_AVX512(const struct PalSearch_t *Ctx, const __m512 *x, uint32_t n, uint8_t Opaque) {
+	__m512 d0 = _mm512_sub_ps(x[0], _mm512_loadu_ps(Ctx->SoaPt[0] + n));
+	__m512 d1 = _mm512_sub_ps(x[1], _mm512_loadu_ps(Ctx->SoaPt[1] + n));
+	__m512 d2 = _mm512_sub_ps(x[2], _mm512_loadu_ps(Ctx->SoaPt[2] + n));
+	__m512 Dist = _mm512_add_ps(
+		_mm512_add_ps(_mm512_mul_ps(d0, d0), _mm512_mul_ps(d1, d1)),
+		_mm512_mul_ps(d2, d2)
+	);
+	if(Opaque) return Dist;
+	__m512 d3 = _mm512_sub_ps(x[3], _mm512_loadu_ps(Ctx->SoaPt[3] + n));
+	return _mm512_add_ps(Dist, _mm512_mul_ps(d3, d3));
+}
+static inline __mmask16 ScanBetter_AVX512(__m512 Dist, __m512 Idx, __m512 BestD, __m512 BestI) {
+	return _mm512_cmp_ps_mask(Dist, BestD, _CMP_LT_OQ) |
+	      (_mm512_cmp_ps_mask(Dist, BestD, _CMP_EQ_OQ) & _mm512_cmp_ps_mask(Idx, BestI, _CMP_LT_OQ));
+}
+static inline void ScanReduce_AVX512(__m512 D, __m512 I, struct BestMatch_t *Best) {
+	float Dist = _mm512_reduce_min_ps(D);
+	__mmask16 IsMin = _mm512_cmp_ps_mask(D, _mm512_set1_ps(Dist), _CMP_EQ_OQ);
+	Best->Dist = Dist;
+	Best->Idx  = (uint32_t)_mm512_mask_reduce_min_ps(IsMin, I);
+}
+static inline void ScanNearest(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Lo,
+	uint32_t Hi,
+	struct BestMatch_t *Best,
+	uint8_t Opaque
+) {
+	__m512 xv[4] = {
+		_mm512_set1_ps(x->f32[0]),
+		_mm512_set1_ps(x->f32[1]),
+		_mm512_set1_ps(x->f32[2]),
+		_mm512_set1_ps(x->f32[3]),
+	};
+	__m512 BestD = _mm512_set1_ps(Best->Dist);
+	__m512 BestI = _mm512_set1_ps((float)Best->Idx);
+	for(;Lo<Hi;Lo+=16) {
+		__m512 Dist = ScanDist_AVX512(Ctx, xv, Lo, Opaque);
+		__m512 Idx  = _mm512_loadu_ps(Ctx->SoaIdx + Lo);
+		__mmask16 Take = ScanBetter_AVX512(Dist, Idx, BestD, BestI);
+		BestD = _mm512_mask_mov_ps(BestD, Take, Dist);
+		BestI = _mm512_mask_mov_ps(BestI, Take, Idx);
+	}
+	ScanReduce_AVX512(BestD, BestI, Best);
+}
+static inline void ScanNearestTwo(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Lo,
+	uint32_t Hi,
+	struct BestMatch_t *A,
+	struct BestMatch_t *B,
+	uint8_t Opaque
+) {
+	__m512 xv[4] = {
+		_mm512_set1_ps(x->f32[0]),
+		_mm512_set1_ps(x->f32[1]),
+		_mm512_set1_ps(x->f32[2]),
+		_mm512_set1_ps(x->f32[3]),
+	};
+	__m512 BestDA = _mm512_set1_ps(A->Dist);
+	__m512 BestIA = _mm512_set1_ps((float)A->Idx);
+	__m512 BestDB = _mm512_set1_ps(B->Dist);
+	__m512 BestIB = _mm512_set1_ps((float)B->Idx);
+	for(;Lo<Hi;Lo+=16) {
+		__m512 Dist = ScanDist_AVX512(Ctx, xv, Lo, Opaque);
+		__m512 Idx  = _mm512_loadu_ps(Ctx->SoaIdx + Lo);
+		__mmask16 LtA   = _mm512_cmp_ps_mask(Dist, BestDA, _CMP_LT_OQ);
+		__mmask16 EqA   = _mm512_cmp_ps_mask(Dist, BestDA, _CMP_EQ_OQ);
+		__mmask16 TieA  = EqA & _mm512_cmp_ps_mask(Idx, BestIA, _CMP_LT_OQ);
+		__mmask16 TakeB = (__mmask16)~(LtA | EqA) & ScanBetter_AVX512(Dist, Idx, BestDB, BestIB);
+		BestDB = _mm512_mask_mov_ps(BestDB, TakeB, Dist);
+		BestIB = _mm512_mask_mov_ps(BestIB, TakeB, Idx);
+		BestDB = _mm512_mask_mov_ps(BestDB, LtA, BestDA);
+		BestIB = _mm512_mask_mov_ps(BestIB, LtA, BestIA);
+		BestDA = _mm512_mask_mov_ps(BestDA, LtA, Dist);
+		BestIA = _mm512_mask_mov_ps(BestIA, LtA | TieA, Idx);
+	}
+
+	//! The second match is the closest lane A that is further than the
+	//! overall A, or the lane B of any lane whose A equals the overall A
+	ScanReduce_AVX512(BestDA, BestIA, A);
+	__mmask16 UseA = _mm512_cmp_ps_mask(BestDA, _mm512_set1_ps(A->Dist), _CMP_GT_OQ);
+	BestDB = _mm512_mask_mov_ps(BestDB, UseA, BestDA);
+	BestIB = _mm512_mask_mov_ps(BestIB, UseA, BestIA);
+	ScanReduce_AVX512(BestDB, BestIB, B);
+}
+#elif defined(__AVX2__)
+# define PALSEARCH_SIMD_WIDTH 8
+static inline __m256 ScanDist_AVX2(const struct PalSearch_t *Ctx, const __m256 *x, uint32_t n, uint8_t Opaque) {
+	__m256 d0 = _mm256_sub_ps(x[0], _mm256_loadu_ps(Ctx->SoaPt[0] + n));
+	__m256 d1 = _mm256_sub_ps(x[1], _mm256_loadu_ps(Ctx->SoaPt[1] + n));
+	__m256 d2 = _mm256_sub_ps(x[2], _mm256_loadu_ps(Ctx->SoaPt[2] + n));
+	__m256 Dist = _mm256_add_ps(
+		_mm256_add_ps(_mm256_mul_ps(d0, d0), _mm256_mul_ps(d1, d1)),
+		_mm256_mul_ps(d2, d2)
+	);
+	if(Opaque) return Dist;
+	__m256 d3 = _mm256_sub_ps(x[3], _mm256_loadu_ps(Ctx->SoaPt[3] + n));
+	return _mm256_add_ps(Dist, _mm256_mul_ps(d3, d3));
+}
+static inline __m256 ScanBetter_AVX2(__m256 Dist, __m256 Idx, __m256 BestD, __m256 BestI) {
+	return _mm256_or_ps(
+		_mm256_cmp_ps(Dist, BestD, _CMP_LT_OQ),
+		_mm256_and_ps(_mm256_cmp_ps(Dist, BestD, _CMP_EQ_OQ), _mm256_cmp_ps(Idx, BestI, _CMP_LT_OQ))
+	);
+}
+static inline __m256 ScanHMin_AVX2(__m256 x) {
+	x = _mm256_min_ps(x, _mm256_permute2f128_ps(x, x, 0x01));
+	x = _mm256_min_ps(x, _mm256_shuffle_ps(x, x, _MM_SHUFFLE(1,0,3,2)));
+	x = _mm256_min_ps(x, _mm256_shuffle_ps(x, x, _MM_SHUFFLE(2,3,0,1)));
+	return x;
+}
+static inline __m256 ScanReduce_AVX2(__m256 D, __m256 I, struct BestMatch_t *Best) {
+	__m256 Dist = ScanHMin_AVX2(D);
+	__m256 Idx  = _mm256_blendv_ps(_mm256_set1_ps((float)INT32_MAX), I, _mm256_cmp_ps(D, Dist, _CMP_EQ_OQ));
+	Best->Dist = _mm256_cvtss_f32(Dist);
+	Best->Idx  = (uint32_t)_mm256_cvtss_f32(ScanHMin_AVX2(Idx));
+	return Dist;
+}
+static inline void ScanNearest(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Lo,
+	uint32_t Hi,
+	struct BestMatch_t *Best,
+	uint8_t Opaque
+) {
+	__m256 xv[4] = {
+		_mm256_set1_ps(x->f32[0]),
+		_mm256_set1_ps(x->f32[1]),
+		_mm256_set1_ps(x->f32[2]),
+		_mm256_set1_ps(x->f32[3]),
+	};
+	__m256 BestD = _mm256_set1_ps(Best->Dist);
+	__m256 BestI = _mm256_set1_ps((float)Best->Idx);
+	for(;Lo<Hi;Lo+=8) {
+		__m256 Dist = ScanDist_AVX2(Ctx, xv, Lo, Opaque);
+		__m256 Idx  = _mm256_loadu_ps(Ctx->SoaIdx + Lo);
+		__m256 Take = ScanBetter_AVX2(Dist, Idx, BestD, BestI);
+		BestD = _mm256_blendv_ps(BestD, Dist, Take);
+		BestI = _mm256_blendv_ps(BestI, Idx,  Take);
+	}
+	ScanReduce_AVX2(BestD, BestI, Best);
+}
+static inline void ScanNearestTwo(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Lo,
+	uint32_t Hi,
+	struct BestMatch_t *A,
+	struct BestMatch_t *B,
+	uint8_t Opaque
+) {
+	__m256 xv[4] = {
+		_mm256_set1_ps(x->f32[0]),
+		_mm256_set1_ps(x->f32[1]),
+		_mm256_set1_ps(x->f32[2]),
+		_mm256_set1_ps(x->f32[3]),
+	};
+	__m256 BestDA = _mm256_set1_ps(A->Dist);
+	__m256 BestIA = _mm256_set1_ps((float)A->Idx);
+	__m256 BestDB = _mm256_set1_ps(B->Dist);
+	__m256 BestIB = _mm256_set1_ps((float)B->Idx);
+	for(;Lo<Hi;Lo+=8) {
+		__m256 Dist = ScanDist_AVX2(Ctx, xv, Lo, Opaque);
+		__m256 Idx  = _mm256_loadu_ps(Ctx->SoaIdx + Lo);
+		__m256 LtA  = _mm256_cmp_ps(Dist, BestDA, _CMP_LT_OQ);
+		__m256 EqA  = _mm256_cmp_ps(Dist, BestDA, _CMP_EQ_OQ);
+		__m256 TieA = _mm256_and_ps(EqA, _mm256_cmp_ps(Idx, BestIA, _CMP_LT_OQ));
+		__m256 TakeB = _mm256_andnot_ps(_mm256_or_ps(LtA, EqA), ScanBetter_AVX2(Dist, Idx, BestDB, BestIB));
+		BestDB = _mm256_blendv_ps(BestDB, Dist,   TakeB);
+		BestIB = _mm256_blendv_ps(BestIB, Idx,    TakeB);
+		BestDB = _mm256_blendv_ps(BestDB, BestDA, LtA);
+		BestIB = _mm256_blendv_ps(BestIB, BestIA, LtA);
+		BestDA = _mm256_blendv_ps(BestDA, Dist,   LtA);
+		BestIA = _mm256_blendv_ps(BestIA, Idx,    _mm256_or_ps(LtA, TieA));
+	}
+
+	//! The second match is the closest lane A that is further than the
+	//! overall A, or the lane B of any lane whose A equals the overall A
+	__m256 DistA = ScanReduce_AVX2(BestDA, BestIA, A);
+	__m256 UseA  = _mm256_cmp_ps(BestDA, DistA, _CMP_GT_OQ);
+	BestDB = _mm256_blendv_ps(BestDB, BestDA, UseA);
+	BestIB = _mm256_blendv_ps(BestIB, BestIA, UseA);
+	ScanReduce_AVX2(BestDB, BestIB, B);
+}
+#elif defined(__SSE2__)
+# define PALSEARCH_SIMD_WIDTH 4
+static inline __m128 ScanDist_SSE2(const struct PalSearch_t *Ctx, const __m128 *x, uint32_t n, uint8_t Opaque) {
+	__m128 d0 = _mm_sub_ps(x[0], _mm_loadu_ps(Ctx->SoaPt[0] + n));
+	__m128 d1 = _mm_sub_ps(x[1], _mm_loadu_ps(Ctx->SoaPt[1] + n));
+	__m128 d2 = _mm_sub_ps(x[2], _mm_loadu_ps(Ctx->SoaPt[2] + n));
+	__m128 Dist = _mm_add_ps(
+		_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)),
+		_mm_mul_ps(d2, d2)
+	);
+	if(Opaque) return Dist;
+	__m128 d3 = _mm_sub_ps(x[3], _mm_loadu_ps(Ctx->SoaPt[3] + n));
+	return _mm_add_ps(Dist, _mm_mul_ps(d3, d3));
+}
+static inline __m128 ScanSelect_SSE2(__m128 Mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(Mask, a), _mm_andnot_ps(Mask, b));
+}
+static inline __m128 ScanBetter_SSE2(__m128 Dist, __m128 Idx, __m128 BestD, __m128 BestI) {
+	return _mm_or_ps(
+		_mm_cmplt_ps(Dist, BestD),
+		_mm_and_ps(_mm_cmpeq_ps(Dist, BestD), _mm_cmplt_ps(Idx, BestI))
+	);
+}
+static inline __m128 ScanHMin_SSE2(__m128 x) {
+	x = _mm_min_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1,0,3,2)));
+	x = _mm_min_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2,3,0,1)));
+	return x;
+}
+static inline __m128 ScanReduce_SSE2(__m128 D, __m128 I, struct BestMatch_t *Best) {
+	__m128 Dist = ScanHMin_SSE2(D);
+	__m128 Idx  = ScanSelect_SSE2(_mm_cmpeq_ps(D, Dist), I, _mm_set1_ps((float)INT32_MAX));
+	Best->Dist = _mm_cvtss_f32(Dist);
+	Best->Idx  = (uint32_t)_mm_cvtss_f32(ScanHMin_SSE2(Idx));
+	return Dist;
+}
+static inline void ScanNearest(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Lo,
+	uint32_t Hi,
+	struct BestMatch_t *Best,
+	uint8_t Opaque
+) {
+	__m128 xv[4] = {
+		_mm_set1_ps(x->f32[0]),
+		_mm_set1_ps(x->f32[1]),
+		_mm_set1_ps(x->f32[2]),
+		_mm_set1_ps(x->f32[3]),
+	};
+	__m128 BestD = _mm_set1_ps(Best->Dist);
+	__m128 BestI = _mm_set1_ps((float)Best->Idx);
+	for(;Lo<Hi;Lo+=4) {
+		__m128 Dist = ScanDist_SSE2(Ctx, xv, Lo, Opaque);
+		__m128 Idx  = _mm_loadu_ps(Ctx->SoaIdx + Lo);
+		__m128 Take = ScanBetter_SSE2(Dist, Idx, BestD, BestI);
+		BestD = ScanSelect_SSE2(Take, Dist, BestD);
+		BestI = ScanSelect_SSE2(Take, Idx,  BestI);
+	}
+	ScanReduce_SSE2(BestD, BestI, Best);
+}
+static inline void ScanNearestTwo(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Lo,
+	uint32_t Hi,
+	struct BestMatch_t *A,
+	struct BestMatch_t *B,
+	uint8_t Opaque
+) {
+	__m128 xv[4] = {
+		_mm_set1_ps(x->f32[0]),
+		_mm_set1_ps(x->f32[1]),
+		_mm_set1_ps(x->f32[2]),
+		_mm_set1_ps(x->f32[3]),
+	};
+	__m128 BestDA = _mm_set1_ps(A->Dist);
+	__m128 BestIA = _mm_set1_ps((float)A->Idx);
+	__m128 BestDB = _mm_set1_ps(B->Dist);
+	__m128 BestIB = _mm_set1_ps((float)B->Idx);
+	for(;Lo<Hi;Lo+=4) {
+		__m128 Dist = ScanDist_SSE2(Ctx, xv, Lo, Opaque);
+		__m128 Idx  = _mm_loadu_ps(Ctx->SoaIdx + Lo);
+		__m128 LtA  = _mm_cmplt_ps(Dist, BestDA);
+		__m128 EqA  = _mm_cmpeq_ps(Dist, BestDA);
+		__m128 TieA = _mm_and_ps(EqA, _mm_cmplt_ps(Idx, BestIA));
+		__m128 TakeB = _mm_andnot_ps(_mm_or_ps(LtA, EqA), ScanBetter_SSE2(Dist, Idx, BestDB, BestIB));
+		BestDB = ScanSelect_SSE2(TakeB, Dist,   BestDB);
+		BestIB = ScanSelect_SSE2(TakeB, Idx,    BestIB);
+		BestDB = ScanSelect_SSE2(LtA,   BestDA, BestDB);
+		BestIB = ScanSelect_SSE2(LtA,   BestIA, BestIB);
+		BestDA = ScanSelect_SSE2(LtA,   Dist,   BestDA);
+		BestIA = ScanSelect_SSE2(_mm_or_ps(LtA, TieA), Idx, BestIA);
+	}
+
+	//! The second match is the closest lane A that is further than the
+	//! overall A, or the lane B of any lane whose A equals the overall A
+	__m128 DistA = ScanReduce_SSE2(BestDA, BestIA, A);
+	__m128 UseA  = _mm_cmpgt_ps(BestDA, DistA);
+	BestDB = ScanSelect_SSE2(UseA, BestDA, BestDB);
+	BestIB = ScanSelect_SSE2(UseA, BestIA, BestIB);
+	ScanReduce_SSE2(BestDB, BestIB, B);
+}
+#else
+# define PALSEARCH_SIMD_WIDTH 1
+static inline void ScanNearest(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Lo,
+	uint32_t Hi,
+	struct BestMatch_t *Best,
+	uint8_t Opaque
+) {
+	for(;Lo<Hi;Lo++) UpdateNearest(Best, PalDist2(x, &Ctx->TreePt[Lo], Opaque), Ctx->TreeIdx[Lo]);
+}
+static inline void ScanNearestTwo(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Lo,
+	uint32_t Hi,
+	struct BestMatch_t *A,
+	struct BestMatch_t *B,
+	uint8_t Opaque
+) {
+	for(;Lo<Hi;Lo++) UpdateNearestTwo(A, B, PalDist2(x, &Ctx->TreePt[Lo], Opaque), Ctx->TreeIdx[Lo]);
+}
+#endif
+
+/************************************************/
+
+//! Search tree for closest match
+//! NOTE: Every point in the far subtree is at least as far away along
+//! the split axis as the splitting plane is. Because float subtraction,
+//! squaring and the summation in Vec4f_Dist2() are all monotonic, the
+//! squared plane distance is then a strict lower bound on the computed
+//! distance of those points, so pruning never changes the result.
+static void KdNearest(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Lo,
+	uint32_t Hi,
+	struct BestMatch_t *Best,
+	uint8_t Opaque
+) {
+	while(Hi - Lo > PALSEARCH_LEAF_SIZE) {
+		uint32_t Mid = (Lo + Hi) / 2;
+		const Vec4f_t *p = &Ctx->TreePt[Mid];
+		UpdateNearest(Best, PalDist2(x, p, Opaque), Ctx->TreeIdx[Mid]);
+
+		//! Search near side, then far side if it may still hold a match
+		uint8_t Axis = Ctx->TreeAxis[Mid];
+		float d = x->f32[Axis] - p->f32[Axis];
+		if(d < 0.0f) {
+			KdNearest(Ctx, x, Lo, Mid, Best, Opaque);
+			if(d*d > Best->Dist) return;
+			Lo = Mid+1;
+		} else {
+			KdNearest(Ctx, x, Mid+1, Hi, Best, Opaque);
+			if(d*d > Best->Dist) return;
+			Hi = Mid;
+		}
+	}
+	ScanNearest(Ctx, x, Lo, Hi, Best, Opaque);
+}
+
+//! Search tree for closest two matches
+static void KdNearestTwo(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Lo,
+	uint32_t Hi,
+	struct BestMatch_t *A,
+	struct BestMatch_t *B,
+	uint8_t Opaque
+) {
+	while(Hi - Lo > PALSEARCH_LEAF_SIZE) {
+		uint32_t Mid = (Lo + Hi) / 2;
+		const Vec4f_t *p = &Ctx->TreePt[Mid];
+		UpdateNearestTwo(A, B, PalDist2(x, p, Opaque), Ctx->TreeIdx[Mid]);
+
+		uint8_t Axis = Ctx->TreeAxis[Mid];
+		float d = x->f32[Axis] - p->f32[Axis];
+		if(d < 0.0f) {
+			KdNearestTwo(Ctx, x, Lo, Mid, A, B, Opaque);
+			if(d*d > B->Dist) return;
+			Lo = Mid+1;
+		} else {
+			KdNearestTwo(Ctx, x, Mid+1, Hi, A, B, Opaque);
+			if(d*d > B->Dist) return;
+			Hi = Mid;
+		}
+	}
+	ScanNearestTwo(Ctx, x, Lo, Hi, A, B, Opaque);
+}
+
+/************************************************/
+
+//! Search the grid cell of x for the closest match
+//! The list is in palette order, so a plain scan resolves ties the same
+//! way as the linear scan. The match can only be beaten by an entry
+//! outside of the list if it isn't closer than the bound of the cell.
+//! Returns 0 if x is outside the grid, or the match isn't certain.
+static inline uint8_t CellNearest(const struct PalSearch_t *Ctx, const Vec4f_t *x, struct BestMatch_t *Best) {
+	int32_t Cell = PalSearch_CellOf(Ctx, x);
+	if(Cell < 0) return 0;
+	uint32_t n, End = Ctx->CellOffs[Cell+1];
+	for(n=Ctx->CellOffs[Cell];n<End;n++) {
+		uint32_t Idx = Ctx->CellIdx[n];
+		float Dist = PalDist2(x, &Ctx->Pal[Idx], 1);
+		if(Dist < Best->Dist) {
+			Best->Dist = Dist;
+			Best->Idx  = Idx;
+		}
+	}
+	return Best->Dist < Ctx->CellBound[Cell] || Ctx->CellBound[Cell] == INFINITY;
+}
+
+//! Search the grid cell of x for the closest two matches
+//! Returns 0 if x is outside the grid, or the matches aren't certain.
+static inline uint8_t CellNearestTwo(const struct PalSearch_t *Ctx, const Vec4f_t *x, struct BestMatch_t *A, struct BestMatch_t *B) {
+	int32_t Cell = PalSearch_CellOf(Ctx, x);
+	if(Cell < 0) return 0;
+	uint32_t n, End = Ctx->CellOffs[Cell+1];
+	for(n=Ctx->CellOffs[Cell];n<End;n++) {
+		uint32_t Idx = Ctx->CellIdx[n];
+		UpdateNearestTwo(A, B, PalDist2(x, &Ctx->Pal[Idx], 1), Idx);
+	}
+	return B->Dist < Ctx->CellBound[Cell] || Ctx->CellBound[Cell] == INFINITY;
+}
+
+/************************************************/
+
+//! Get distance between colours, stopping early if it is above Limit
+//! Squares are never negative, so the partial sum of the first two
+//! channels (formed in the same order as PalDist2()) is a lower bound
+//! on the full distance; if that is already above Limit, it is
+//! returned instead, as it can no longer change a match.
+static inline float PalDist2Below(const Vec4f_t *a, const Vec4f_t *b, float Limit, uint8_t Opaque) {
+	Vec4f_t x = Vec4f_Sub(a, b);
+	        x = Vec4f_Mul(&x, &x);
+	float Dist = x.f32[0] + x.f32[1];
+	if(Dist > Limit) return Dist;
+	Dist += x.f32[2];
+	return Opaque ? Dist : (Dist + x.f32[3]);
+}
+
+//! Search pairwise lists for closest match
+//! Best must hold the match to start from (or no match at all). Its
+//! list is scanned for as long as entries may be closer than twice the
+//! distance of the match, moving to the list of any better match.
+//! NOTE: Entries are only skipped if they are strictly further away
+//! than the match (see PALSEARCH_PAIRS_SLACK), so ties are resolved by
+//! UpdateNearest() exactly as in a full scan.
+static void PairNearest(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	struct BestMatch_t *Best,
+	uint32_t *nEvals,
+	uint8_t   Opaque
+) {
+	uint32_t n, Centre, nDistinct = Ctx->nDistinct, Evals = 0;
+	do {
+		Centre = Best->Idx;
+		float Limit = 2.0f*sqrtf(Best->Dist);
+		const uint8_t *Idx  = Ctx->PairIdx  + Centre*nDistinct;
+		const float   *Dist = Ctx->PairDist + Centre*nDistinct;
+		for(n=0;n<nDistinct;n++) {
+			if(Dist[n] > Limit) break;
+			float d = PalDist2Below(x, &Ctx->Pal[Idx[n]], Best->Dist, Opaque);
+			Evals++;
+			if(d <= Best->Dist) {
+				UpdateNearest(Best, d, Idx[n]);
+				if(Best->Idx != Centre) break;
+			}
+		}
+	} while(Best->Idx != Centre);
+	*nEvals += Evals;
+}
+
+//! Search pairwise lists for closest two matches
+//! The search starts from the list of Seed, and entries are scanned for
+//! as long as they may be closer than the second match, ie. while their
+//! distance from the first match is below the sum of both distances.
+static void PairNearestTwo(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint32_t Seed,
+	struct BestMatch_t *A,
+	struct BestMatch_t *B,
+	uint32_t *nEvals,
+	uint8_t   Opaque
+) {
+	uint32_t n, Centre = Seed, nDistinct = Ctx->nDistinct, Evals = 0;
+	for(;;) {
+		float Limit = sqrtf(A->Dist) + sqrtf(B->Dist);
+		const uint8_t *Idx  = Ctx->PairIdx  + Centre*nDistinct;
+		const float   *Dist = Ctx->PairDist + Centre*nDistinct;
+		for(n=0;n<nDistinct;n++) {
+			if(Dist[n] > Limit) break;
+			float d = PalDist2Below(x, &Ctx->Pal[Idx[n]], B->Dist, Opaque);
+			Evals++;
+			if(d <= B->Dist) {
+				UpdateNearestTwo(A, B, d, Idx[n]);
+				if(A->Idx != Centre) break;
+				Limit = sqrtf(A->Dist) + sqrtf(B->Dist);
+			}
+		}
+		if(A->Idx == Centre) break;
+		Centre = A->Idx;
+	}
+	*nEvals += Evals;
+}
+
+/************************************************/
+
+//! Find closest colour in palette
+//! NOTE: This is instantiated separately for opaque searches (see
+//! FindNearestColour()), so that Opaque is a constant throughout.
+static inline uint8_t FindNearestColour_(const struct PalSearch_t *Ctx, const Vec4f_t *x, uint8_t Opaque) {
+	struct BestMatch_t Best = {INFINITY, 0};
+	if(Opaque && Ctx->UseCells) {
+		if(CellNearest(Ctx, x, &Best)) return (uint8_t)Best.Idx;
+		Best = (struct BestMatch_t){INFINITY, 0};
+	}
+	if(Ctx->UseTree) {
+		KdNearest(Ctx, x, 0, Ctx->nDistinct, &Best, Opaque);
+	} else if(Ctx->SoaMem) {
+		ScanNearest(Ctx, x, 0, Ctx->nDistinct, &Best, Opaque);
+	} else {
+		uint32_t n;
+		for(n=Ctx->FirstCol;n<Ctx->nCols;n++) {
+			float Dist = PalDist2(x, &Ctx->Pal[n], Opaque);
+			if(Dist < Best.Dist) {
+				Best.Idx  = n;
+				Best.Dist = Dist;
+			}
+		}
+	}
+	return (uint8_t)Best.Idx;
+}
+static uint8_t FindNearestColour(const struct PalSearch_t *Ctx, const Vec4f_t *x) {
+	return Ctx->Opaque ? FindNearestColour_(Ctx, x, 1) : FindNearestColour_(Ctx, x, 0);
+}
+
+//! Find closest two colours in palette
+static inline void FindNearestTwoColours_(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint8_t *IdxA,
+	float   *DistA,
+	uint8_t *IdxB,
+	float   *DistB,
+	uint8_t  Opaque
+) {
+	struct BestMatch_t A = {INFINITY, 0};
+	struct BestMatch_t B = {INFINITY, 0};
+	if(Opaque && Ctx->UseCells) {
+		if(CellNearestTwo(Ctx, x, &A, &B)) {
+			*IdxA  = (uint8_t)A.Idx;
+			*DistA = A.Dist;
+			*IdxB  = (uint8_t)B.Idx;
+			*DistB = B.Dist;
+			return;
+		}
+		A = B = (struct BestMatch_t){INFINITY, 0};
+	}
+	if(Ctx->UseTree) {
+		KdNearestTwo(Ctx, x, 0, Ctx->nDistinct, &A, &B, Opaque);
+	} else if(Ctx->SoaMem) {
+		ScanNearestTwo(Ctx, x, 0, Ctx->nDistinct, &A, &B, Opaque);
+	} else {
+		uint32_t n;
+		for(n=Ctx->FirstCol;n<Ctx->nCols;n++) {
+			float Dist = PalDist2(x, &Ctx->Pal[n], Opaque);
+			if(Dist < A.Dist) {
+				B = A;
+				A.Idx  = n;
+				A.Dist = Dist;
+			} else if(Dist < B.Dist && Dist > A.Dist) {
+				B.Idx  = n;
+				B.Dist = Dist;
+			}
+		}
+	}
+	*IdxA  = (uint8_t)A.Idx;
+	*DistA = A.Dist;
+	*IdxB  = (uint8_t)B.Idx;
+	*DistB = B.Dist;
+}
+static void FindNearestTwoColours(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint8_t *IdxA,
+	float   *DistA,
+	uint8_t *IdxB,
+	float   *DistB
+) {
+	if(Ctx->Opaque) FindNearestTwoColours_(Ctx, x, IdxA, DistA, IdxB, DistB, 1);
+	else            FindNearestTwoColours_(Ctx, x, IdxA, DistA, IdxB, DistB, 0);
+}
+
+//! Find closest colour to a biased point between the closest two
+//! NOTE: This is instantiated separately for opaque searches (see
+//! FindNearestDitheredColour()), so that Opaque is a constant throughout.
+static inline uint8_t FindNearestDitheredColour_(
+	const Vec4f_t *x,
+	const Vec4f_t *Bias,
+	const struct PalSearch_t *Pal,
+	uint8_t  *Hint,
+	uint32_t *nEvals,
+	uint8_t   Opaque
+) {
+	//! Find closest two matches
+	//! Note that we ensure to not find a duplicate entry,
+	//! and if we only have one match, we use it anyway.
+	struct BestMatch_t A = {INFINITY, 0};
+	struct BestMatch_t B = {INFINITY, 0};
+	if(Pal->UsePairs) {
+		PairNearestTwo(Pal, x, *Hint, &A, &B, nEvals, Opaque);
+	} else {
+		uint8_t IdxA, IdxB;
+		FindNearestTwoColours_(Pal, x, &IdxA, &A.Dist, &IdxB, &B.Dist, Opaque);
+		A.Idx = IdxA, B.Idx = IdxB;
+		*nEvals += Pal->nDistinct;
+	}
+	*Hint = (uint8_t)A.Idx;
+	if(B.Dist == INFINITY) return (uint8_t)A.Idx;
+	if(A.Dist < 0.25f*B.Dist) { //! DistA/DistB < (1/2)^2
+		//! We are very out of range, so don't bother dithering
+		return (uint8_t)A.Idx;
+	}
+
+	//! Scale the bias by their differences, and find closest match to this
+	//! The closest two are usually also the closest to the biased point
+	//! (or close to it), so they make a good start for the search.
+	const Vec4f_t *PalA = &Pal->Pal[A.Idx];
+	const Vec4f_t *PalB = &Pal->Pal[B.Idx];
+	Vec4f_t xNew = Vec4f_Sub(PalA, PalB);
+	        xNew = Vec4f_Abs(&xNew);
+	        xNew = Vec4f_Mul(&xNew, Bias);
+	        xNew = Vec4f_Add(&xNew, x);
+	if(Pal->UsePairs) {
+		struct BestMatch_t Best = {INFINITY, 0};
+		UpdateNearest(&Best, PalDist2(&xNew, PalA, Opaque), A.Idx);
+		UpdateNearest(&Best, PalDist2(&xNew, PalB, Opaque), B.Idx);
+		*nEvals += 2;
+		PairNearest(Pal, &xNew, &Best, nEvals, Opaque);
+		return (uint8_t)Best.Idx;
+	}
+	*nEvals += Pal->nDistinct;
+	return FindNearestColour_(Pal, &xNew, Opaque);
+}
+static uint8_t FindNearestDitheredColour(
+	const struct PalSearch_t *Pal,
+	const Vec4f_t *x,
+	const Vec4f_t *Bias,
+	uint8_t  *Hint,
+	uint32_t *nEvals
+) {
+	return Pal->Opaque ?
+		FindNearestDitheredColour_(x, Bias, Pal, Hint, nEvals, 1) :
+		FindNearestDitheredColour_(x, Bias, Pal, Hint, nEvals, 0);
+}
+
+/************************************************/
+
+//! Propagate error to neighbouring pixels (Floyd-Steinberg)
+static inline void FloydSteinberg_PropagateError(const Vec4f_t *Error, Vec4f_t *y0, Vec4f_t *y1) {
+	Vec4f_t t;
+	t = Vec4f_Muli(Error, 7.0f/16); //! {x+1,y}   @ 7/16
+	y0[+1] = Vec4f_Add(&y0[+1], &t);
+	t = Vec4f_Muli(Error, 3.0f/16); //! {x-1,y+1} @ 3/16
+	y1[-1] = Vec4f_Add(&y1[-1], &t);
+	t = Vec4f_Muli(Error, 5.0f/16); //! {x+0,y+1} @ 5/16
+	y1[+0] = Vec4f_Add(&y1[+0], &t);
+	t = Vec4f_Muli(Error, 1.0f/16); //! {x+1,y+1} @ 1/16
+	y1[+1] = Vec4f_Add(&y1[+1], &t);
+}
+
+//! Propagate error to neighbouring pixels (Atkinson diffusion)
+static inline void Atkinson_PropagateError(const Vec4f_t *Error, Vec4f_t *y0, Vec4f_t *y1, Vec4f_t *y2) {
+	Vec4f_t t = Vec4f_Muli(Error, 1.0f/8);
+	y0[+1] = Vec4f_Add(&y0[+1], &t);
+	y0[+2] = Vec4f_Add(&y0[+2], &t);
+	y1[-1] = Vec4f_Add(&y1[-1], &t);
+	y1[ 0] = Vec4f_Add(&y1[ 0], &t);
+	y1[+1] = Vec4f_Add(&y1[+1], &t);
+	y2[ 0] = Vec4f_Add(&y2[ 0], &t);
+}
+
+/************************************************/
+
+//! Map pixels without diffusion
+static void DitherRow(
+	      uint8_t *Dst,
+	const Vec4f_t *Px,
+	uint32_t x0,
+	uint32_t x1,
+	uint32_t y,
+	const struct DitherMatrix_t *Matrix,
+	float    DitherLevel,
+	const struct PalSearch_t *Pal
+) {
+	uint32_t x;
+	if(!Matrix) {
+		for(x=x0;x<x1;x++) *Dst++ = FindNearestColour(Pal, Px++);
+		return;
+	}
+
+	//! Adjust for dither matrix
+	//! The matrix column wraps around as we go, so no division is
+	//! needed per pixel, whatever the matrix size.
+	//! Each search starts from the closest match of the previous pixel.
+	const float *Row = Matrix->Thresholds + (y % Matrix->Height)*Matrix->Width;
+	uint32_t     Col = x0 % Matrix->Width;
+	uint8_t  Hint   = 0;
+	uint32_t nEvals = 0;
+	for(x=x0;x<x1;x++) {
+		Vec4f_t vOffs = Vec4f_Broadcast(Row[Col] * DitherLevel);
+		*Dst++ = FindNearestDitheredColour(Pal, Px++, &vOffs, &Hint, &nEvals);
+		if(++Col == Matrix->Width) Col = 0;
+	}
+}
+
+//! Map pixels with Floyd-Steinberg diffusion
+static void DiffuseRow_FloydSteinberg(
+	      uint8_t *Dst,
+	const Vec4f_t *Px,
+	uint32_t x0,
+	uint32_t x1,
+	float    DitherLevel,
+	const struct PalSearch_t *Pal,
+	Vec4f_t *y0,
+	Vec4f_t *y1
+) {
+	uint32_t x;
+	for(x=x0;x<x1;x++) {
+		//! Subtract diffused error and propagate new error
+		Vec4f_t t = Vec4f_Muli(&y0[x], DitherLevel);
+		        t = Vec4f_Add (&t, Px);
+		uint8_t BestFitIdx = FindNearestColour(Pal, &t);
+		Vec4f_t Error = Vec4f_Sub(Px++, &Pal->Pal[BestFitIdx]);
+		FloydSteinberg_PropagateError(&Error, y0+x, y1+x);
+		*Dst++ = BestFitIdx;
+	}
+}
+
+//! Map pixels with Atkinson diffusion
+static void DiffuseRow_Atkinson(
+	      uint8_t *Dst,
+	const Vec4f_t *Px,
+	uint32_t x0,
+	uint32_t x1,
+	float    DitherLevel,
+	const struct PalSearch_t *Pal,
+	Vec4f_t *y0,
+	Vec4f_t *y1,
+	Vec4f_t *y2
+) {
+	uint32_t x;
+	for(x=x0;x<x1;x++) {
+		Vec4f_t t = Vec4f_Muli(&y0[x], DitherLevel);
+		        t = Vec4f_Add (&t, Px);
+		uint8_t BestFitIdx = FindNearestColour(Pal, &t);
+		Vec4f_t Error = Vec4f_Sub(Px++, &Pal->Pal[BestFitIdx]);
+		Atkinson_PropagateError(&Error, y0+x, y1+x, y2+x);
+		*Dst++ = BestFitIdx;
+	}
+}
+
+/************************************************/
+
+//! Kernel table
+#if defined(__AVX512F__)
+# define DITHERKERNELS_NAME "AVX-512"
+#elif defined(__AVX2__)
+# define DITHERKERNELS_NAME "AVX2"
+#elif defined(__SSE2__)
+# define DITHERKERNELS_NAME "SSE2"
+#else
+# define DITHERKERNELS_NAME "Scalar"
+#endif
+#define DITHERKERNELS_TABLE_(Isa) DitherKernels_##Isa
+#define DITHERKERNELS_TABLE(Isa)  DITHERKERNELS_TABLE_(Isa)
+const struct DitherKernels_t DITHERKERNELS_TABLE(DITHERKERNELS_ISA) = {
+	.Name      = DITHERKERNELS_NAME,
+	.SimdWidth = PALSEARCH_SIMD_WIDTH,
+	.FindNearest               = FindNearestColour,
+	.FindNearestTwo            = FindNearestTwoColours,
+	.FindNearestDithered       = FindNearestDitheredColour,
+	.ConvertRow                = ConvertRow,
+	.ConvertRowPlanar          = ConvertRowPlanar,
+	.DecodeRow                 = DecodeRow,
+	.DitherRow                 = DitherRow,
+	.DiffuseRow_FloydSteinberg = DiffuseRow_FloydSteinberg,
+	.DiffuseRow_Atkinson       = DiffuseRow_Atkinson,
+};
+
+/************************************************/
+//! EOF
+/************************************************/
@@ -0,0 +1,37 @@
+/************************************************/
+#include <stdlib.h>
+#include <string.h>
+/************************************************/
+#include "DitherImage-Kernels.h"
+/************************************************/
+
+//! Active kernel set
+const struct DitherKernels_t *DitherKernels = &DitherKernels_Generic;
+
+/************************************************/
+
+//! Select kernels at load time
+//! NOTE: __builtin_cpu_supports() also checks that the OS has enabled
+//! the wider register state, so this is safe to rely on.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+__attribute__((constructor)) static void DitherKernels_Init(void) {
+	__builtin_cpu_init();
+	uint8_t HasAVX2   = __builtin_cpu_supports("avx2")    ? 1 : 0;
+	uint8_t HasAVX512 = __builtin_cpu_supports("avx512f") ? HasAVX2 : 0;
+
+	//! Choose best available set
+	if(HasAVX512)    DitherKernels = &DitherKernels_AVX512;
+	else if(HasAVX2) DitherKernels = &DitherKernels_AVX2;
+
+	//! Allow forcing a narrower set (for testing/benchmarking)
+	const char *Isa = getenv("IMGDITHER_ISA");
+	if(Isa) {
+		if(!strcmp(Isa, "generic")) DitherKernels = &DitherKernels_Generic;
+		else if(!strcmp(Isa, "avx2") && HasAVX2) DitherKernels = &DitherKernels_AVX2;
+	}
+}
+#endif
+
+/************************************************/
+//! EOF
+/************************************************/
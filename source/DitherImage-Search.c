@@ -0,0 +1,525 @@
+/************************************************/
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+/************************************************/
+#include "DitherImage-Kernels.h"
+#include "DitherImage-Search.h"
+#include "Vec4f.h"
+/************************************************/
+
+//! Minimum palette size to use a tree (or the grid)
+//! Wider SIMD makes linear scans cheaper, moving the crossover point;
+//! with AVX-512, a 256-colour palette is still faster to scan linearly.
+//! The grid lists are short, so they pay off sooner than the tree with
+//! narrow SIMD, but as they are scanned one entry at a time, wider SIMD
+//! moves their crossover point further: about 32 colours for Generic,
+//! 128 for AVX2, and past 256 for AVX-512.
+//! NOTE: These are compared against the number of distinct colours.
+#define PALSEARCH_TREE_MIN_COLS  (DitherKernels->SimdWidth * 24)
+#define PALSEARCH_CELLS_MIN_COLS (DitherKernels->SimdWidth * DitherKernels->SimdWidth * 2)
+
+//! Margin around the palette for the grid (fraction of the range)
+//! Diffused and dithered colours stray a little outside the palette,
+//! so the grid extends past it to keep those on the fast path.
+#define PALSEARCH_CELLS_MARGIN 0.25
+
+//! Padding of each cell when finding its candidates (fraction of a cell)
+//! Colours are placed into cells with float arithmetic, so they may
+//! land very slightly outside of the exact bounds of their cell.
+#define PALSEARCH_CELLS_PAD 1.0e-4
+
+//! Slack on the distance bound for entries outside a list
+//! Computed distances are within a few ulps of the exact ones, so
+//! scaling the bound down by this much keeps it a strict lower bound.
+#define PALSEARCH_CELLS_SLACK (1.0 - 1.0e-5)
+
+//! Minimum palette size to use the pairwise lists
+//! Dithered searches from a nearby match usually end after a handful
+//! of entries, so the lists pay off at about half the size of the tree.
+#define PALSEARCH_PAIRS_MIN_COLS (DitherKernels->SimdWidth * 12)
+
+//! Slack on pairwise distances
+//! The lists are only pruned against distances computed in float at
+//! search time, so these are scaled down to keep the pruning strict.
+#define PALSEARCH_PAIRS_SLACK (1.0 - 1.0e-5)
+
+/************************************************/
+
+//! Build tree over the range [Lo,Hi)
+static void KdBuild(struct PalSearch_t *Ctx, uint32_t Lo, uint32_t Hi) {
+	uint32_t i, j;
+	if(Hi - Lo <= PALSEARCH_LEAF_SIZE) return;
+
+	//! Split along the axis of greatest spread
+	uint8_t Axis = 0; {
+		Vec4f_t Min = Ctx->TreePt[Lo], Max = Ctx->TreePt[Lo];
+		for(i=Lo+1;i<Hi;i++) {
+			Min = Vec4f_Min(&Min, &Ctx->TreePt[i]);
+			Max = Vec4f_Max(&Max, &Ctx->TreePt[i]);
+		}
+		Vec4f_t Spread = Vec4f_Sub(&Max, &Min);
+		for(i=1;i<4;i++) if(Spread.f32[i] > Spread.f32[Axis]) Axis = (uint8_t)i;
+	}
+
+	//! Sort range along this axis
+	//! Palettes are small (256 entries at most), so insertion sort
+	//! is perfectly adequate here. Ties are ordered by index so that
+	//! the tree layout is deterministic.
+	for(i=Lo+1;i<Hi;i++) {
+		Vec4f_t Pt  = Ctx->TreePt [i];
+		uint8_t Idx = Ctx->TreeIdx[i];
+		for(j=i;j>Lo;j--) {
+			float c = Ctx->TreePt[j-1].f32[Axis];
+			if(c < Pt.f32[Axis] || (c == Pt.f32[Axis] && Ctx->TreeIdx[j-1] < Idx)) break;
+			Ctx->TreePt [j] = Ctx->TreePt [j-1];
+			Ctx->TreeIdx[j] = Ctx->TreeIdx[j-1];
+		}
+		Ctx->TreePt [j] = Pt;
+		Ctx->TreeIdx[j] = Idx;
+	}
+
+	//! Recurse into children
+	uint32_t Mid = (Lo + Hi) / 2;
+	Ctx->TreeAxis[Mid] = Axis;
+	KdBuild(Ctx, Lo,    Mid);
+	KdBuild(Ctx, Mid+1, Hi);
+}
+
+/************************************************/
+
+//! Get candidates for a box
+//! U is the smallest distance that is guaranteed to hold two distinct
+//! palette colours anywhere in the box (ie. the second lowest of their
+//! maximum distances over the box), so any entry whose minimum distance
+//! over the box is above U can never be one of the closest two, and is
+//! left out. Bound is lowered to the lowest minimum distance of these.
+//! Entries are only taken from In[], which must hold every entry that
+//! could be a candidate, so this may be run on the list of an enclosing
+//! box (with its bound) instead of the whole palette.
+//! Returns the number of candidates stored to Out[].
+static uint32_t BoxCandidates(
+	const Vec4f_t *Pal,
+	const double   Lo[3],
+	const double   Hi[3],
+	const uint8_t *In,
+	uint32_t       nIn,
+	uint8_t       *Out,
+	double        *Bound,
+	double        *MinDist //! Scratch [nIn]
+) {
+	uint32_t n, nOut = 0;
+
+	//! Get distance range of each entry, and the closest two
+	//! (distinct) colours by their maximum distance
+	//! At most one of a and b is positive, so their clamped sum is the
+	//! distance to the box along that axis.
+	double MaxDistA = INFINITY, U = INFINITY;
+	const Vec4f_t *BestA = NULL;
+	for(n=0;n<nIn;n++) {
+		const Vec4f_t *p = &Pal[In[n]];
+		double ax = Lo[0] - p->f32[0], bx = p->f32[0] - Hi[0];
+		double ay = Lo[1] - p->f32[1], by = p->f32[1] - Hi[1];
+		double az = Lo[2] - p->f32[2], bz = p->f32[2] - Hi[2];
+		double dx = ((ax > 0.0) ? ax : 0.0) + ((bx > 0.0) ? bx : 0.0);
+		double dy = ((ay > 0.0) ? ay : 0.0) + ((by > 0.0) ? by : 0.0);
+		double dz = ((az > 0.0) ? az : 0.0) + ((bz > 0.0) ? bz : 0.0);
+		double mx = (ax*ax > bx*bx) ? ax*ax : bx*bx;
+		double my = (ay*ay > by*by) ? ay*ay : by*by;
+		double mz = (az*az > bz*bz) ? az*az : bz*bz;
+		double dMin = dx*dx + dy*dy + dz*dz;
+		double dMax = mx + my + mz;
+		MinDist[n] = dMin;
+		if(dMax < U) {
+			if(!BestA || p->f32[0] != BestA->f32[0] || p->f32[1] != BestA->f32[1] || p->f32[2] != BestA->f32[2]) {
+				if(dMax < MaxDistA) U = MaxDistA, MaxDistA = dMax, BestA = p;
+				else                U = dMax;
+			} else if(dMax < MaxDistA) MaxDistA = dMax;
+		}
+	}
+	if(U == INFINITY) U = MaxDistA;
+
+	//! Store candidates
+	for(n=0;n<nIn;n++) {
+		if(MinDist[n] <= U) Out[nOut++] = In[n];
+		else if(MinDist[n] < *Bound) *Bound = MinDist[n];
+	}
+	return nOut;
+}
+
+//! Grid build state
+struct CellsBuild_t {
+	struct PalSearch_t *Ctx;
+	double    Width[3];   //! Size of a cell along each axis
+	uint8_t  *Lists;      //! Candidates at each level of subdivision [Levels][nCols]
+	double   *MinDist;    //! Scratch for BoxCandidates() [nCols]
+	uint32_t *CellStart;  //! Start of the list of each cell in CellIdx (in build order)
+	uint32_t *CellLen;    //! Length of the list of each cell
+	uint32_t  nIdx;       //! Entries stored to CellIdx so far
+};
+
+//! Find candidates for a cube of Size^3 cells, and then for each of
+//! its octants, down to single cells
+//! In[] holds the candidates of the enclosing cube (with its bound).
+static void CellsSubdivide(
+	struct CellsBuild_t *Build,
+	uint32_t x, uint32_t y, uint32_t z,
+	uint32_t Size,
+	const uint8_t *In,
+	uint32_t nIn,
+	double   Bound
+) {
+	uint32_t c;
+	struct PalSearch_t *Ctx = Build->Ctx;
+	double Lo[3], Hi[3];
+	uint32_t Pos[3] = {x, y, z};
+	for(c=0;c<3;c++) {
+		Lo[c] = Ctx->CellMin[c] + (Pos[c]        - PALSEARCH_CELLS_PAD) * Build->Width[c];
+		Hi[c] = Ctx->CellMin[c] + (Pos[c] + Size + PALSEARCH_CELLS_PAD) * Build->Width[c];
+	}
+
+	//! Single cells store their list straight into the grid
+	if(Size == 1) {
+		uint32_t Cell = (z*PALSEARCH_CELLS + y)*PALSEARCH_CELLS + x;
+		Build->CellStart[Cell] = Build->nIdx;
+		Build->CellLen  [Cell] = BoxCandidates(Ctx->Pal, Lo, Hi, In, nIn, Ctx->CellIdx + Build->nIdx, &Bound, Build->MinDist);
+		Build->nIdx += Build->CellLen[Cell];
+		Ctx->CellBound[Cell] = (float)(Bound * PALSEARCH_CELLS_SLACK);
+		return;
+	}
+
+	//! Otherwise, narrow down the list for the octants
+	//! Each level has its own list (of up to nCols entries), which is
+	//! placed after that of the level above.
+	uint8_t *List = (uint8_t*)In + Ctx->nCols;
+	uint32_t nList = BoxCandidates(Ctx->Pal, Lo, Hi, In, nIn, List, &Bound, Build->MinDist);
+	Size /= 2;
+	for(c=0;c<8;c++) {
+		CellsSubdivide(Build, x + (c&1)*Size, y + (c>>1&1)*Size, z + (c>>2)*Size, Size, List, nList, Bound);
+	}
+}
+
+//! Build grid cell lists
+//! Distinct[] holds the palette index of each distinct entry, ascending.
+//! Returns 0 on failure, or 1 on success.
+static uint8_t CellsBuild(struct PalSearch_t *Ctx, const uint8_t *Distinct) {
+	uint32_t c, n, Cell;
+	uint32_t nCols     = Ctx->nCols;
+	uint32_t nDistinct = Ctx->nDistinct;
+	uint32_t nCells = PALSEARCH_CELLS*PALSEARCH_CELLS*PALSEARCH_CELLS;
+	uint32_t nLevels = 1; for(n=PALSEARCH_CELLS;n>1;n/=2) nLevels++;
+	const Vec4f_t *Pal = Ctx->Pal;
+
+	//! Place grid over the palette
+	for(c=0;c<3;c++) {
+		float Min = Pal[0].f32[c], Max = Pal[0].f32[c];
+		for(n=1;n<nCols;n++) {
+			if(Pal[n].f32[c] < Min) Min = Pal[n].f32[c];
+			if(Pal[n].f32[c] > Max) Max = Pal[n].f32[c];
+		}
+		if(!(Max - Min < INFINITY)) return 0; //! Non-finite palette
+		float Margin = (float)((Max - Min) * PALSEARCH_CELLS_MARGIN) + 1.0e-3f;
+		Ctx->CellMin  [c] = Min - Margin;
+		Ctx->CellScale[c] = (float)PALSEARCH_CELLS / ((Max + Margin) - Ctx->CellMin[c]);
+	}
+
+	//! Allocate lists for the worst case, and trim them afterwards
+	struct CellsBuild_t Build = {
+		.Ctx       = Ctx,
+		.Lists     = malloc(nLevels * nCols),
+		.MinDist   = malloc(nCols * sizeof(double)),
+		.CellStart = malloc(nCells * sizeof(uint32_t)),
+		.CellLen   = malloc(nCells * sizeof(uint32_t)),
+		.nIdx      = 0,
+	};
+	uint8_t *BuildIdx = malloc(nCells * nCols);
+	Ctx->CellOffs  = malloc((nCells+1) * sizeof(uint32_t));
+	Ctx->CellBound = malloc(nCells * sizeof(float));
+	uint8_t Ok = (Build.Lists && Build.MinDist && Build.CellStart && Build.CellLen && BuildIdx && Ctx->CellOffs && Ctx->CellBound);
+	if(Ok) {
+		//! Subdivide the whole grid, starting from every entry
+		Ctx->CellIdx = BuildIdx;
+		for(c=0;c<3;c++) Build.Width[c] = 1.0 / Ctx->CellScale[c];
+		for(n=0;n<nDistinct;n++) Build.Lists[n] = Distinct[n];
+		CellsSubdivide(&Build, 0, 0, 0, PALSEARCH_CELLS, Build.Lists, nDistinct, INFINITY);
+
+		//! Store lists in cell order
+		Ctx->CellIdx = malloc(Build.nIdx ? Build.nIdx : 1);
+		if(Ctx->CellIdx) {
+			uint32_t nIdx = 0;
+			for(Cell=0;Cell<nCells;Cell++) {
+				Ctx->CellOffs[Cell] = nIdx;
+				for(n=0;n<Build.CellLen[Cell];n++) Ctx->CellIdx[nIdx++] = BuildIdx[Build.CellStart[Cell] + n];
+			}
+			Ctx->CellOffs[nCells] = nIdx;
+		} else Ok = 0;
+	}
+	free(Build.Lists);
+	free(Build.MinDist);
+	free(Build.CellStart);
+	free(Build.CellLen);
+	free(BuildIdx);
+	return Ok;
+}
+
+/************************************************/
+
+//! Pairwise list entry, for sorting by distance
+struct PairEntry_t {
+	double   Dist;
+	uint32_t Idx;
+};
+
+//! Compare pairwise list entries by distance
+//! Ties are ordered by index so that the lists are deterministic.
+static int ComparePairs(const void *a, const void *b) {
+	const struct PairEntry_t *EntryA = (const struct PairEntry_t*)a;
+	const struct PairEntry_t *EntryB = (const struct PairEntry_t*)b;
+	if(EntryA->Dist != EntryB->Dist) return (EntryA->Dist < EntryB->Dist) ? -1 : +1;
+	return (EntryA->Idx < EntryB->Idx) ? -1 : (EntryA->Idx > EntryB->Idx);
+}
+
+//! Build pairwise distance lists
+//! Distances are taken over all four channels, so that they hold for
+//! both the full and opaque searches (whose palettes have equal alpha).
+//! Every palette index gets a list (so that matches can be used to
+//! find them directly), but the lists only hold the distinct entries.
+//! Returns 0 on failure, or 1 on success.
+static uint8_t PairsBuild(struct PalSearch_t *Ctx, const uint8_t *Distinct) {
+	uint32_t i, j, c;
+	uint32_t nCols     = Ctx->nCols;
+	uint32_t nDistinct = Ctx->nDistinct;
+	const Vec4f_t *Pal = Ctx->Pal;
+	struct PairEntry_t *Row = malloc(nDistinct * sizeof(struct PairEntry_t));
+	Ctx->PairIdx  = malloc(nCols * nDistinct * sizeof(uint8_t));
+	Ctx->PairDist = malloc(nCols * nDistinct * sizeof(float));
+	uint8_t Ok = (Row && Ctx->PairIdx && Ctx->PairDist);
+	for(i=0;i<nCols && Ok;i++) {
+		for(j=0;j<nDistinct;j++) {
+			double d2 = 0.0;
+			for(c=0;c<4;c++) {
+				double d = (double)Pal[i].f32[c] - (double)Pal[Distinct[j]].f32[c];
+				d2 += d*d;
+			}
+			if(!(d2 < INFINITY)) Ok = 0; //! Non-finite palette
+			Row[j] = (struct PairEntry_t){.Dist = sqrt(d2), .Idx = Distinct[j]};
+		}
+		qsort(Row, nDistinct, sizeof(struct PairEntry_t), ComparePairs);
+		for(j=0;j<nDistinct;j++) {
+			Ctx->PairIdx [i*nDistinct+j] = (uint8_t)Row[j].Idx;
+			Ctx->PairDist[i*nDistinct+j] = (float)(Row[j].Dist * PALSEARCH_PAIRS_SLACK);
+		}
+	}
+	free(Row);
+	return Ok;
+}
+
+/************************************************/
+
+//! Create search index
+//! When All is set, the tree and grid are built even for palettes
+//! that are too small for them to pay off.
+static uint8_t Create(struct PalSearch_t *Ctx, const Vec4f_t *Pal, uint32_t nCols, uint32_t FirstCol, uint8_t All) {
+	uint32_t n, i;
+	if(FirstCol > nCols) FirstCol = nCols;
+	Ctx->nCols    = nCols;
+	Ctx->FirstCol = FirstCol;
+	Ctx->nDistinct = nCols - FirstCol;
+	Ctx->UseTree  = 0;
+	Ctx->UseCells = 0;
+	Ctx->UsePairs = 0;
+	Ctx->Opaque   = 0;
+	Ctx->Pal      = Pal;
+	Ctx->CellOffs  = NULL;
+	Ctx->CellIdx   = NULL;
+	Ctx->CellBound = NULL;
+	Ctx->PairIdx   = NULL;
+	Ctx->PairDist  = NULL;
+	Ctx->TreePt   = NULL;
+	Ctx->TreeIdx  = NULL;
+	Ctx->TreeAxis = NULL;
+	Ctx->SoaIdx   = NULL;
+	Ctx->SoaMem   = NULL;
+	for(n=0;n<4;n++) Ctx->SoaPt[n] = NULL;
+
+	//! Allocate tree arrays
+	//! The SoA arrays share one allocation, aligned to 64 bytes.
+	uint32_t nSoa = (nCols + PALSEARCH_SOA_PAD + 15) &~ 15;
+	Ctx->TreePt   = malloc(nCols * sizeof(Vec4f_t));
+	Ctx->TreeIdx  = malloc(nCols * sizeof(uint8_t));
+	Ctx->TreeAxis = malloc(nCols * sizeof(uint8_t));
+	Ctx->SoaMem   = malloc(nSoa * 5*sizeof(float) + 63);
+	uint8_t *Distinct = malloc(nCols ? nCols : 1);
+	if(!Ctx->TreePt || !Ctx->TreeIdx || !Ctx->TreeAxis || !Ctx->SoaMem || !Distinct) {
+		//! Fall back to linear search
+		PalSearch_Destroy(Ctx);
+		free(Distinct);
+		Ctx->nCols     = nCols;
+		Ctx->FirstCol  = FirstCol;
+		Ctx->nDistinct = nCols - FirstCol;
+		Ctx->Pal       = Pal;
+		return 1;
+	}
+
+	//! Collapse duplicate entries
+	//! Only the lowest index of identical colours can ever be matched
+	//! (the others are at the same distance from everything), so the
+	//! rest are left out of the search. Entries keep their palette
+	//! index, so results need no remapping, and as the distinct entries
+	//! stay in palette order, ties still go to the lowest index.
+	//! Palettes are small (256 entries at most), so a quadratic search
+	//! is perfectly adequate here.
+	//! Entries below FirstCol are left out the same way.
+	Ctx->nDistinct = 0;
+	for(n=FirstCol;n<nCols;n++) {
+		for(i=0;i<Ctx->nDistinct;i++) {
+			const Vec4f_t *p = &Pal[Distinct[i]];
+			if(p->f32[0] == Pal[n].f32[0] && p->f32[1] == Pal[n].f32[1] && p->f32[2] == Pal[n].f32[2] && p->f32[3] == Pal[n].f32[3]) break;
+		}
+		if(i == Ctx->nDistinct) Distinct[Ctx->nDistinct++] = (uint8_t)n;
+	}
+	uint32_t nDistinct = Ctx->nDistinct;
+	for(n=0;n<nDistinct;n++) {
+		Ctx->TreePt  [n] = Pal[Distinct[n]];
+		Ctx->TreeIdx [n] = Distinct[n];
+		Ctx->TreeAxis[n] = 0;
+	}
+
+	//! Build tree only when it pays off; small palettes are
+	//! faster to scan linearly with SIMD (in palette order)
+	if(nDistinct >= PALSEARCH_TREE_MIN_COLS || All) {
+		Ctx->UseTree = 1;
+		KdBuild(Ctx, 0, nDistinct);
+	}
+
+	//! Store tree-ordered entries as SoA
+	float *SoaBase = (float*)(((uintptr_t)Ctx->SoaMem + 63) &~ (uintptr_t)63);
+	for(n=0;n<4;n++) Ctx->SoaPt[n] = SoaBase + n*nSoa;
+	Ctx->SoaIdx = SoaBase + 4*nSoa;
+	for(n=0;n<nSoa;n++) {
+		if(n < nDistinct) {
+			Ctx->SoaPt[0][n] = Ctx->TreePt[n].f32[0];
+			Ctx->SoaPt[1][n] = Ctx->TreePt[n].f32[1];
+			Ctx->SoaPt[2][n] = Ctx->TreePt[n].f32[2];
+			Ctx->SoaPt[3][n] = Ctx->TreePt[n].f32[3];
+			Ctx->SoaIdx  [n] = (float)Ctx->TreeIdx[n];
+		} else {
+			Ctx->SoaPt[0][n] = NAN;
+			Ctx->SoaPt[1][n] = NAN;
+			Ctx->SoaPt[2][n] = NAN;
+			Ctx->SoaPt[3][n] = NAN;
+			Ctx->SoaIdx  [n] = (float)INT32_MAX;
+		}
+	}
+
+	//! Build grid cells
+	//! If we have no memory, the other searches are used instead.
+	if(nDistinct >= PALSEARCH_CELLS_MIN_COLS || (All && nDistinct)) {
+		Ctx->UseCells = CellsBuild(Ctx, Distinct);
+		if(!Ctx->UseCells) {
+			free(Ctx->CellOffs);
+			free(Ctx->CellIdx);
+			free(Ctx->CellBound);
+			Ctx->CellOffs  = NULL;
+			Ctx->CellIdx   = NULL;
+			Ctx->CellBound = NULL;
+		}
+	}
+
+	//! Build pairwise lists
+	if(nDistinct >= PALSEARCH_PAIRS_MIN_COLS || (All && nDistinct)) {
+		Ctx->UsePairs = PairsBuild(Ctx, Distinct);
+		if(!Ctx->UsePairs) {
+			free(Ctx->PairIdx);
+			free(Ctx->PairDist);
+			Ctx->PairIdx  = NULL;
+			Ctx->PairDist = NULL;
+		}
+	}
+	free(Distinct);
+	return 1;
+}
+
+//! Create search index
+uint8_t PalSearch_Create(struct PalSearch_t *Ctx, const Vec4f_t *Pal, uint32_t nCols, uint32_t FirstCol) {
+	return Create(Ctx, Pal, nCols, FirstCol, 0);
+}
+
+//! Create search index with all search methods
+uint8_t PalSearch_CreateAll(struct PalSearch_t *Ctx, const Vec4f_t *Pal, uint32_t nCols, uint32_t FirstCol) {
+	return Create(Ctx, Pal, nCols, FirstCol, 1);
+}
+
+/************************************************/
+
+//! Get opaque view of search index
+struct PalSearch_t PalSearch_Opaque(const struct PalSearch_t *Ctx) {
+	struct PalSearch_t View = *Ctx;
+	View.Opaque = 1;
+	return View;
+}
+
+/************************************************/
+
+//! Destroy search index
+void PalSearch_Destroy(struct PalSearch_t *Ctx) {
+	uint32_t n;
+	free(Ctx->TreePt);
+	free(Ctx->TreeIdx);
+	free(Ctx->TreeAxis);
+	free(Ctx->SoaMem);
+	free(Ctx->CellOffs);
+	free(Ctx->CellIdx);
+	free(Ctx->CellBound);
+	free(Ctx->PairIdx);
+	free(Ctx->PairDist);
+	Ctx->nCols    = 0;
+	Ctx->FirstCol = 0;
+	Ctx->nDistinct = 0;
+	Ctx->UseTree  = 0;
+	Ctx->UseCells = 0;
+	Ctx->UsePairs = 0;
+	Ctx->CellOffs  = NULL;
+	Ctx->CellIdx   = NULL;
+	Ctx->CellBound = NULL;
+	Ctx->PairIdx   = NULL;
+	Ctx->PairDist  = NULL;
+	Ctx->Opaque   = 0;
+	Ctx->Pal      = NULL;
+	Ctx->TreePt   = NULL;
+	Ctx->TreeIdx  = NULL;
+	Ctx->TreeAxis = NULL;
+	Ctx->SoaIdx   = NULL;
+	Ctx->SoaMem   = NULL;
+	for(n=0;n<4;n++) Ctx->SoaPt[n] = NULL;
+}
+
+/************************************************/
+
+//! Find closest colour in palette
+uint8_t PalSearch_FindNearest(const struct PalSearch_t *Ctx, const Vec4f_t *x) {
+	return DitherKernels->FindNearest(Ctx, x);
+}
+
+//! Find closest two colours in palette
+void PalSearch_FindNearestTwo(
+	const struct PalSearch_t *Ctx,
+	const Vec4f_t *x,
+	uint8_t *IdxA,
+	float   *DistA,
+	uint8_t *IdxB,
+	float   *DistB
+) {
+	DitherKernels->FindNearestTwo(Ctx, x, IdxA, DistA, IdxB, DistB);
+}
+
+//! Get candidates for a colour
+uint32_t PalSearch_CellCandidates(const struct PalSearch_t *Ctx, const Vec4f_t *x) {
+	int32_t Cell = Ctx->UseCells ? PalSearch_CellOf(Ctx, x) : -1;
+	if(Cell < 0) return 0;
+	return Ctx->CellOffs[Cell+1] - Ctx->CellOffs[Cell];
+}
+
+/************************************************/
+//! EOF
+/************************************************/
@@ -0,0 +1,131 @@
+/************************************************/
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+/************************************************/
+#include "DitherImage-Colourspace.h"
+#include "DitherImage-Tables.h"
+#include "DitherImage-ThreadPool.h"
+#include "Vec4f.h"
+/************************************************/
+
+//! Tables for each colourspace
+static struct ColourTables_t Tables[COLOURTABLES_COUNT];
+static pthread_once_t  TablesOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t TablesLock = PTHREAD_MUTEX_INITIALIZER;
+
+/************************************************/
+
+//! Build per-channel tables for all colourspaces
+static void BuildTables(void) {
+	uint32_t Colourspace, n;
+	for(Colourspace=0;Colourspace<COLOURTABLES_COUNT;Colourspace++) {
+		struct ColourTables_t *Tab = &Tables[Colourspace];
+		Tab->Separable = (
+			Colourspace == COLOURSPACE_SRGB       ||
+			Colourspace == COLOURSPACE_RGB_LINEAR ||
+			Colourspace == COLOURSPACE_RGB_PSY
+		);
+		for(n=0;n<256;n++) {
+			Vec4f_t t = Vec4f_Broadcast(n / 255.0f);
+			if(Tab->Separable) {
+				t = ConvertToColourspace(&t, Colourspace);
+			} else {
+				t.f32[0] = ColourspaceTransfer(t.f32[0], Colourspace);
+				t.f32[1] = ColourspaceTransfer(t.f32[1], Colourspace);
+				t.f32[2] = ColourspaceTransfer(t.f32[2], Colourspace);
+			}
+			Tab->Channel[0][n] = t.f32[0];
+			Tab->Channel[1][n] = t.f32[1];
+			Tab->Channel[2][n] = t.f32[2];
+		}
+		atomic_init(&Tab->RGB, NULL);
+	}
+}
+
+/************************************************/
+
+//! Get tables for colourspace
+const struct ColourTables_t *ColourTables_Get(uint8_t Colourspace) {
+	if(Colourspace >= COLOURTABLES_COUNT) return NULL;
+	pthread_once(&TablesOnce, BuildTables);
+	return &Tables[Colourspace];
+}
+
+/************************************************/
+
+//! Full table build job
+struct BuildRGBJob_t {
+	const struct ColourTables_t *Tab;
+	float  *RGB;
+	uint8_t Colourspace;
+};
+
+//! Thread pool job: Build the part of the full table for one value of B
+static void BuildRGBJob(void *Arg, uint32_t b, uint32_t Thread) {
+	const struct BuildRGBJob_t *Job = (const struct BuildRGBJob_t*)Arg;
+	uint32_t r, g;
+	float *Dst = Job->RGB + (b << 16)*3;
+	(void)Thread;
+	for(g=0;g<256;g++) for(r=0;r<256;r++) {
+		Vec4f_t t = {{
+			Job->Tab->Channel[0][r],
+			Job->Tab->Channel[1][g],
+			Job->Tab->Channel[2][b],
+			1.0f
+		}};
+		t = ConvertTransferredToColourspace(&t, Job->Colourspace);
+		*Dst++ = t.f32[0];
+		*Dst++ = t.f32[1];
+		*Dst++ = t.f32[2];
+	}
+}
+
+//! Build full 24-bit RGB table for colourspace
+uint8_t ColourTables_CreateRGB(uint8_t Colourspace, uint32_t nThreads) {
+	struct ColourTables_t *Tab = (struct ColourTables_t*)ColourTables_Get(Colourspace);
+	if(!Tab) return 0;
+	if(Tab->Separable) return 1;
+
+	//! Already built?
+	uint8_t Ok = 1;
+	pthread_mutex_lock(&TablesLock);
+	if(!atomic_load_explicit(&Tab->RGB, memory_order_relaxed)) {
+		struct BuildRGBJob_t Job = {
+			.Tab         = Tab,
+			.RGB         = malloc(COLOURTABLES_RGB_SIZE),
+			.Colourspace = Colourspace,
+		};
+		if(Job.RGB) {
+			struct ThreadPool_t Pool;
+			if(ThreadPool_Create(&Pool, nThreads)) {
+				ThreadPool_Run(&Pool, 256, BuildRGBJob, &Job);
+				ThreadPool_Destroy(&Pool);
+			} else {
+				uint32_t b;
+				for(b=0;b<256;b++) BuildRGBJob(&Job, b, 0);
+			}
+			atomic_store_explicit(&Tab->RGB, Job.RGB, memory_order_release);
+		} else Ok = 0;
+	}
+	pthread_mutex_unlock(&TablesLock);
+	return Ok;
+}
+
+/************************************************/
+
+//! Release all full 24-bit RGB tables
+void ColourTables_DestroyRGB(void) {
+	uint32_t n;
+	pthread_once(&TablesOnce, BuildTables);
+	pthread_mutex_lock(&TablesLock);
+	for(n=0;n<COLOURTABLES_COUNT;n++) {
+		free(atomic_exchange(&Tables[n].RGB, NULL));
+	}
+	pthread_mutex_unlock(&TablesLock);
+}
+
+/************************************************/
+//! EOF
+/************************************************/
@@ -0,0 +1,167 @@
+/************************************************/
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+/************************************************/
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
+/************************************************/
+#include "DitherImage-ThreadPool.h"
+/************************************************/
+
+//! Worker thread arguments
+struct WorkerArgs_t {
+	struct ThreadPool_t *Pool;
+	uint32_t Thread;
+};
+
+/************************************************/
+
+//! Run jobs from the current batch until none remain
+static void RunJobs(struct ThreadPool_t *Pool, uint32_t Thread) {
+	uint32_t Job;
+	while((Job = atomic_fetch_add(&Pool->NextJob, 1)) < Pool->nJobs) {
+		Pool->Func(Pool->Arg, Job, Thread);
+	}
+}
+
+//! Worker thread main loop
+static void *WorkerMain(void *Arg) {
+	struct WorkerArgs_t Args = *(struct WorkerArgs_t*)Arg;
+	struct ThreadPool_t *Pool = Args.Pool;
+	free(Arg);
+
+	//! Workers are started before any batch is published, so start
+	//! from the initial generation rather than reading it here (this
+	//! thread may only get scheduled after the first batch is posted)
+	uint32_t Seen = 0;
+	pthread_mutex_lock(&Pool->Lock);
+	for(;;) {
+		while(!Pool->Quit && Pool->Generation == Seen) {
+			pthread_cond_wait(&Pool->WorkCond, &Pool->Lock);
+		}
+		if(Pool->Quit) break;
+		Seen = Pool->Generation;
+		pthread_mutex_unlock(&Pool->Lock);
+
+		RunJobs(Pool, Args.Thread);
+
+		pthread_mutex_lock(&Pool->Lock);
+		if(--Pool->nBusy == 0) pthread_cond_signal(&Pool->DoneCond);
+	}
+	pthread_mutex_unlock(&Pool->Lock);
+	return NULL;
+}
+
+/************************************************/
+
+//! Get number of CPU cores available
+uint32_t ThreadPool_CpuCount(void) {
+#if defined(_WIN32)
+	SYSTEM_INFO Info;
+	GetSystemInfo(&Info);
+	return Info.dwNumberOfProcessors ? (uint32_t)Info.dwNumberOfProcessors : 1;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (uint32_t)n : 1;
+#endif
+}
+
+/************************************************/
+
+//! Create thread pool
+uint8_t ThreadPool_Create(struct ThreadPool_t *Pool, uint32_t nThreads) {
+	if(!nThreads) nThreads = ThreadPool_CpuCount();
+	Pool->nThreads   = 1;
+	Pool->Workers    = NULL;
+	Pool->Generation = 0;
+	Pool->nBusy      = 0;
+	Pool->Quit       = 0;
+	Pool->Func       = NULL;
+	Pool->Arg        = NULL;
+	Pool->nJobs      = 0;
+	atomic_init(&Pool->NextJob, 0);
+	if(pthread_mutex_init(&Pool->Lock, NULL) != 0) return 0;
+	if(pthread_cond_init(&Pool->WorkCond, NULL) != 0) {
+		pthread_mutex_destroy(&Pool->Lock);
+		return 0;
+	}
+	if(pthread_cond_init(&Pool->DoneCond, NULL) != 0) {
+		pthread_cond_destroy(&Pool->WorkCond);
+		pthread_mutex_destroy(&Pool->Lock);
+		return 0;
+	}
+
+	//! Start workers
+	if(nThreads > 1) {
+		Pool->Workers = malloc((nThreads-1) * sizeof(pthread_t));
+		if(Pool->Workers) while(Pool->nThreads < nThreads) {
+			struct WorkerArgs_t *Args = malloc(sizeof(struct WorkerArgs_t));
+			if(!Args) break;
+			Args->Pool   = Pool;
+			Args->Thread = Pool->nThreads;
+			if(pthread_create(&Pool->Workers[Pool->nThreads-1], NULL, WorkerMain, Args) != 0) {
+				free(Args);
+				break;
+			}
+			Pool->nThreads++;
+		}
+	}
+	return 1;
+}
+
+/************************************************/
+
+//! Destroy thread pool
+void ThreadPool_Destroy(struct ThreadPool_t *Pool) {
+	uint32_t n;
+	pthread_mutex_lock(&Pool->Lock);
+	Pool->Quit = 1;
+	pthread_cond_broadcast(&Pool->WorkCond);
+	pthread_mutex_unlock(&Pool->Lock);
+	for(n=1;n<Pool->nThreads;n++) pthread_join(Pool->Workers[n-1], NULL);
+	free(Pool->Workers);
+	pthread_cond_destroy(&Pool->DoneCond);
+	pthread_cond_destroy(&Pool->WorkCond);
+	pthread_mutex_destroy(&Pool->Lock);
+	Pool->nThreads = 0;
+	Pool->Workers  = NULL;
+}
+
+/************************************************/
+
+//! Run jobs and wait for them to complete
+void ThreadPool_Run(struct ThreadPool_t *Pool, uint32_t nJobs, ThreadPool_JobFunc_t Func, void *Arg) {
+	uint32_t Job;
+
+	//! Nothing to share?
+	if(Pool->nThreads <= 1 || nJobs <= 1) {
+		for(Job=0;Job<nJobs;Job++) Func(Arg, Job, 0);
+		return;
+	}
+
+	//! Publish batch and wake workers
+	pthread_mutex_lock(&Pool->Lock);
+	Pool->Func  = Func;
+	Pool->Arg   = Arg;
+	Pool->nJobs = nJobs;
+	atomic_store(&Pool->NextJob, 0);
+	Pool->nBusy = Pool->nThreads - 1;
+	Pool->Generation++;
+	pthread_cond_broadcast(&Pool->WorkCond);
+	pthread_mutex_unlock(&Pool->Lock);
+
+	//! Help out, then wait for the workers to finish
+	RunJobs(Pool, 0);
+	pthread_mutex_lock(&Pool->Lock);
+	while(Pool->nBusy) pthread_cond_wait(&Pool->DoneCond, &Pool->Lock);
+	pthread_mutex_unlock(&Pool->Lock);
+}
+
+/************************************************/
+//! EOF
+/************************************************/
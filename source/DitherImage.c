@@ -1,105 +1,772 @@
 /************************************************/
+#include <math.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 /************************************************/
 #include "DitherImage.h"
+#include "DitherImage-Cache.h"
 #include "DitherImage-Colourspace.h"
+#include "DitherImage-Grid.h"
+#include "DitherImage-Kernels.h"
+#include "DitherImage-Search.h"
+#include "DitherImage-ThreadPool.h"
 #include "Vec4f.h"
 /************************************************/
 
-//! Find closest colour in given palette
-static uint8_t FindNearestColour(const Vec4f_t *x, const Vec4f_t *Pal, uint32_t nCols) {
-	uint32_t n;
-	uint8_t BestIdx = 0;
-	float BestDist = INFINITY;
-	for(n=0;n<nCols;n++) {
-		float Dist = Vec4f_Dist2(x, &Pal[n]);
-		if(Dist < BestDist) {
-			BestIdx  = (uint8_t)n;
-			BestDist = Dist;
+//! Pixels converted per row chunk
+//! Source pixels are converted to the target colourspace in chunks
+//! of this many pixels, held on the stack, before being dithered.
+#define DITHER_CHUNK_SIZE 256
+
+//! Rows per band for multithreaded dithering
+//! Bands are claimed dynamically by the threads, so keeping these
+//! small balances the load without much overhead.
+#define DITHER_BAND_ROWS 4
+
+//! Pixels per wavefront step for multithreaded diffusion
+//! Each row publishes its progress after every step, and the row
+//! below waits for the row above to be far enough ahead before
+//! starting a step. Smaller steps let rows follow more closely.
+#define DITHER_WAVEFRONT_STEP 64
+
+//! Diffusion rows needed for serial diffusion
+//! Row y reads from its own diffusion row, and writes to up to two
+//! rows below, so one more than that keeps the ring from wrapping
+//! onto a row that is still in use.
+#define DITHER_SCRATCH_DIFFUSE_ROWS 4
+
+//! Alignment of each block carved out of a scratch arena
+#define ARENA_ALIGNMENT 64
+#define ARENA_ALIGN(x) (((x) + ARENA_ALIGNMENT-1) & ~(size_t)(ARENA_ALIGNMENT-1))
+
+//! Overlap between tiles for tiled (approximate) diffusion
+//! Diffusion for each tile starts this many pixels to the left,
+//! right and above the tile itself, and the results for those pixels
+//! are discarded; this lets the error settle before reaching the
+//! tile, so that the seams between tiles don't show.
+#define DITHER_TILE_OVERLAP 16
+
+/************************************************/
+
+//! Dithering job
+struct DitherJob_t {
+	      uint8_t *DstPx;
+	const uint8_t *SrcPx;         //! First row of source
+	ptrdiff_t      SrcStride;     //! Bytes from one source row to the next
+	uint8_t        SrcFormat;     //! DITHER_FORMAT_*
+	const uint8_t *SrcPalette;    //! Source palette (DITHER_FORMAT_INDEXED only)
+	const Vec4f_t *SrcPalPx;      //! Source palette in target colourspace (DITHER_FORMAT_INDEXED only)
+	const uint8_t *SrcPalIdx;     //! Source palette mapped to the palette (DITHER_FORMAT_INDEXED with DITHER_NONE only)
+	uint32_t Width;
+	uint32_t Height;
+	uint8_t  DitherType;
+	float    DitherLevel;
+	const struct DitherMatrix_t  *Matrix; //! Threshold matrix (ordered dithers only)
+	uint8_t  Colourspace;
+	uint8_t  PremultipliedAlpha;
+	uint8_t  Approx;              //! Use approximate colour conversion
+	const struct PalSearch_t     *Pal;
+	const struct DitherKernels_t *Kernels;
+	struct ColourCache_t         *Caches; //! Colour cache for each thread (or NULL)
+	struct DitherGrid_t          *Grid;   //! Lookup grid (opaque ordered dithers only; or NULL)
+	uint32_t RowOffs;             //! Image row of the first row of SrcPx/DstPx (streaming)
+
+	//! Clear pixels (DITHER_FLAG_CLEAR0 only)
+	uint8_t  Clear;               //! Source may have clear pixels
+	uint8_t  HasClearCol;
+	uint8_t  ClearCol[3];         //! Clear colour (RGB)
+	const uint8_t *SrcPalClear;   //! Source palette entries that are clear (DITHER_FORMAT_INDEXED only)
+	uint32_t BoundX0, BoundX1;    //! Bounding box of pixels that aren't clear
+	uint32_t BoundY0, BoundY1;
+
+	//! Wavefront state (multithreaded diffusion only)
+	Vec4f_t     *DiffuseMem;   //! Ring of diffusion rows [nDiffuseRows][Width+3]
+	uint32_t     nDiffuseRows;
+	atomic_uint *RowProgress;  //! Pixels completed in each row [Height] (NULL when rows run in order on one thread)
+
+	//! Tile state (tiled diffusion only)
+	uint32_t     TileSize;
+	uint32_t     nTilesX;
+	Vec4f_t     *TileMem;      //! Scratch memory for each thread [nThreads][TileMemStride]
+	uint32_t     TileMemStride;
+};
+
+//! Source palette state (DITHER_FORMAT_INDEXED only)
+//! Indexed sources have at most 256 distinct colours, so these are
+//! converted (and, for undithered output, matched) only once, and then
+//! looked up for every pixel.
+struct DitherSourcePalette_t {
+	uint8_t Valid;
+	uint8_t RGBA[256*4]; //! Source palette that the below were computed from
+	Vec4f_t Px [256];
+	uint8_t Idx[256];
+	uint8_t Clear[256];  //! Entry is clear (DITHER_FLAG_CLEAR0 only)
+};
+
+//! Dither context
+//! NOTE: This is never modified after creation.
+struct DitherContext_t {
+	const struct DitherKernels_t *Kernels;
+	Vec4f_t            *NewPal;    //! Palette in target colourspace
+	struct PalSearch_t  PalSearch;
+	struct PalSearch_t  PalSearchOpaque; //! Opaque view of PalSearch (if Opaque)
+	float              *Thresholds; //! Memory for the matrices below
+	struct DitherMatrix_t Ordered[DITHER_ORDERED_MAX]; //! Matrix for DITHER_ORDERED(n+1)
+	struct DitherMatrix_t Checker;
+	uint8_t             Colourspace;
+	uint8_t             PremultipliedAlpha;
+	uint8_t             Approx;    //! Use approximate colour conversion
+	uint8_t             Opaque;    //! Palette is opaque
+	uint8_t             AssumeOpaque; //! Images are known to be opaque (DITHER_FLAG_OPAQUE)
+	uint8_t             Clear0;    //! Colour 0 is transparent (DITHER_FLAG_CLEAR0)
+	uint8_t             HasClearCol;
+	uint8_t             ClearCol[3]; //! Clear colour (RGB)
+};
+
+//! Scratch memory for a dither context
+struct DitherScratch_t {
+	const struct DitherContext_t *Ctx;
+	struct ColourCache_t Cache;
+	uint8_t              HasCache;
+	struct DitherSourcePalette_t SrcPal;
+	Vec4f_t             *DiffuseMem;   //! Diffusion ring [DITHER_SCRATCH_DIFFUSE_ROWS][DiffuseWidth+3]
+	uint32_t             DiffuseWidth;
+	uint8_t              InArena;      //! Memory is caller-supplied, and never grows
+};
+
+//! Streaming dither context
+struct DitherStream_t {
+	struct DitherJob_t  Job;
+	const struct DitherContext_t *Ctx;
+	struct DitherContext_t *OwnedCtx; //! Ctx, if created along with the stream (or NULL)
+	struct ThreadPool_t Pool;
+	uint8_t             UsePool;
+	uint32_t            nCaches;   //! Number of colour caches (one per thread)
+	uint32_t            MaxRows;   //! Maximum rows per call
+	uint8_t             HasAlpha;  //! Rows with alpha have been diffused
+	struct DitherSourcePalette_t SrcPal;
+	struct DitherGrid_t Grid;
+	uint8_t             HasGrid;
+};
+
+/************************************************/
+
+//! Bytes per pixel for each source format
+static const uint8_t SourceBytesPerPixel[] = {
+	[DITHER_FORMAT_RGBA]    = 4,
+	[DITHER_FORMAT_BGRA]    = 4,
+	[DITHER_FORMAT_BGRX]    = 4,
+	[DITHER_FORMAT_RGB]     = 3,
+	[DITHER_FORMAT_BGR]     = 3,
+	[DITHER_FORMAT_INDEXED] = 1,
+};
+
+//! Check that a source format is valid
+static uint8_t SourceFormatValid(uint8_t Format, const uint8_t *Palette) {
+	if(Format > DITHER_FORMAT_INDEXED) return 0;
+	if(Format == DITHER_FORMAT_INDEXED && !Palette) return 0;
+	return 1;
+}
+
+//! Check that a dither type is valid
+static uint8_t DitherTypeValid(uint8_t DitherType, const struct DitherMatrix_t *Matrix) {
+	switch(DitherType) {
+		case DITHER_NONE:
+		case DITHER_CHECKER:
+		case DITHER_FLOYDSTEINBERG:
+		case DITHER_ATKINSON: return 1;
+		case DITHER_MATRIX:   return Matrix && Matrix->Width && Matrix->Height && Matrix->Thresholds;
+	}
+	return DitherType <= DITHER_ORDERED(DITHER_ORDERED_MAX);
+}
+
+//! Get threshold matrix for a dither type
+//! Returns NULL for dither types that don't use one.
+static const struct DitherMatrix_t *SelectMatrix(const struct DitherContext_t *Ctx, uint8_t DitherType, const struct DitherMatrix_t *Matrix) {
+	switch(DitherType) {
+		case DITHER_NONE:
+		case DITHER_FLOYDSTEINBERG:
+		case DITHER_ATKINSON: return NULL;
+		case DITHER_CHECKER:  return &Ctx->Checker;
+		case DITHER_MATRIX:   return Matrix;
+	}
+	return &Ctx->Ordered[DitherType-1];
+}
+
+//! Resolve source layout
+//! Bottom-up sources are read from their last row in memory, stepping
+//! backwards, so that no copy is needed.
+static void ResolveSourceLayout(const uint8_t **SrcPx, int32_t *SrcStride, uint8_t SrcFormat, uint32_t Width, uint32_t Height, uint32_t Flags) {
+	if(!*SrcStride) *SrcStride = (int32_t)(Width * SourceBytesPerPixel[SrcFormat]);
+	if((Flags & DITHER_FLAG_BOTTOMUP) && Height) {
+		*SrcPx    += (ptrdiff_t)(Height-1) * *SrcStride;
+		*SrcStride = -*SrcStride;
+	}
+}
+
+//! Prepare job for a dither context
+//! NOTE: We can't clamp values here, because the input colourspaces
+//! do not necessarily have a nominal range of 0.0 to 1.0. This may
+//! cause issues at times, but hopefully this is minor.
+//! NOTE: The dither type must have been checked with DitherTypeValid().
+static void InitJob(struct DitherJob_t *Job, const struct DitherContext_t *Ctx, uint32_t Width, uint8_t DitherType, float DitherLevel, const struct DitherMatrix_t *Matrix) {
+	*Job = (struct DitherJob_t){
+		.DstPx              = NULL,
+		.SrcPx              = NULL,
+		.SrcStride          = 0,
+		.SrcFormat          = DITHER_FORMAT_RGBA,
+		.SrcPalette         = NULL,
+		.SrcPalPx           = NULL,
+		.SrcPalIdx          = NULL,
+		.Width              = Width,
+		.Height             = 0,
+		.DitherType         = DitherType,
+		.DitherLevel        = DitherLevel,
+		.Matrix             = SelectMatrix(Ctx, DitherType, Matrix),
+		.Colourspace        = Ctx->Colourspace,
+		.PremultipliedAlpha = Ctx->PremultipliedAlpha,
+		.Approx             = Ctx->Approx,
+		.Pal                = &Ctx->PalSearch,
+		.Kernels            = Ctx->Kernels,
+		.Caches             = NULL,
+		.Grid               = NULL,
+		.RowOffs            = 0,
+		.Clear              = 0,
+		.HasClearCol        = Ctx->HasClearCol,
+		.ClearCol           = {Ctx->ClearCol[0], Ctx->ClearCol[1], Ctx->ClearCol[2]},
+		.SrcPalClear        = NULL,
+		.BoundX0            = 0,
+		.BoundX1            = Width,
+		.BoundY0            = 0,
+		.BoundY1            = 0,
+		.DiffuseMem         = NULL,
+		.nDiffuseRows       = 0,
+		.RowProgress        = NULL,
+		.TileSize           = 0,
+		.nTilesX            = 0,
+		.TileMem            = NULL,
+		.TileMemStride      = 0,
+	};
+}
+
+//! Set source and output of job
+//! Only sources with alpha, or a source palette (whose colour 0 is
+//! clear), can have clear pixels without a clear colour.
+static void SetSource(
+	struct DitherJob_t *Job,
+	const struct DitherContext_t *Ctx,
+	      uint8_t *DstPx,
+	const uint8_t *SrcPx,
+	ptrdiff_t      SrcStride,
+	uint8_t        SrcFormat,
+	const uint8_t *SrcPalette,
+	uint32_t       Height
+) {
+	Job->DstPx      = DstPx;
+	Job->SrcPx      = SrcPx;
+	Job->SrcStride  = SrcStride;
+	Job->SrcFormat  = SrcFormat;
+	Job->SrcPalette = SrcPalette;
+	Job->Height     = Height;
+	Job->Clear      = Ctx->Clear0 && (
+		Ctx->HasClearCol ||
+		SrcFormat == DITHER_FORMAT_RGBA ||
+		SrcFormat == DITHER_FORMAT_BGRA ||
+		SrcFormat == DITHER_FORMAT_INDEXED
+	);
+}
+
+//! Get n source pixels of row y, starting at x, as RGBA
+//! RGBA sources are read in place; all others are decoded to Tmp[n*4].
+static const uint8_t *SourcePixels(const struct DitherJob_t *Job, uint8_t *Tmp, uint32_t x, uint32_t y, uint32_t n) {
+	const uint8_t *Src = Job->SrcPx + (ptrdiff_t)y*Job->SrcStride + x*SourceBytesPerPixel[Job->SrcFormat];
+	if(Job->SrcFormat == DITHER_FORMAT_RGBA) return Src;
+	Job->Kernels->DecodeRow(Tmp, Src, n, Job->SrcFormat, Job->SrcPalette);
+	return Tmp;
+}
+
+//! Check if an RGBA pixel is clear
+static inline uint8_t PixelClear(const struct DitherJob_t *Job, const uint8_t *Px) {
+	if(Px[3] == 0) return 1;
+	return Job->HasClearCol && Px[0] == Job->ClearCol[0] && Px[1] == Job->ClearCol[1] && Px[2] == Job->ClearCol[2];
+}
+
+//! Check if source pixel x of a row is clear
+//! NOTE: Indexed sources must have had their palette prepared.
+static inline uint8_t SourcePixelClear(const struct DitherJob_t *Job, const uint8_t *Row, uint32_t x) {
+	uint8_t Px[4];
+	const uint8_t *Src = Row + x*SourceBytesPerPixel[Job->SrcFormat];
+	switch(Job->SrcFormat) {
+		case DITHER_FORMAT_RGBA:    return PixelClear(Job, Src);
+		case DITHER_FORMAT_INDEXED: return Job->SrcPalClear[*Src];
+		case DITHER_FORMAT_RGB:     Px[0] = Src[0], Px[1] = Src[1], Px[2] = Src[2], Px[3] = 0xFF;   break;
+		case DITHER_FORMAT_BGR:
+		case DITHER_FORMAT_BGRX:    Px[0] = Src[2], Px[1] = Src[1], Px[2] = Src[0], Px[3] = 0xFF;   break;
+		case DITHER_FORMAT_BGRA:
+		default:                    Px[0] = Src[2], Px[1] = Src[1], Px[2] = Src[0], Px[3] = Src[3]; break;
+	}
+	return PixelClear(Job, Px);
+}
+
+//! Flag the clear pixels of n RGBA pixels
+//! Returns the number of clear pixels.
+static uint32_t ClearPixels(const struct DitherJob_t *Job, uint8_t *Clear, const uint8_t *Src, uint32_t n) {
+	uint32_t i, nClear = 0;
+	for(i=0;i<n;i++) nClear += (Clear[i] = PixelClear(Job, Src + i*4));
+	return nClear;
+}
+
+//! Get the next run [a,b) of pixels that aren't clear
+//! Start with a=b=0; a NULL Clear has no clear pixels at all.
+//! Returns 0 once there are no runs left.
+static inline uint8_t NextRun(const uint8_t *Clear, uint32_t n, uint32_t *a, uint32_t *b) {
+	uint32_t i = *b;
+	if(Clear) while(i < n && Clear[i]) i++;
+	if(i >= n) return 0;
+	*a = i;
+	if(Clear) while(i < n && !Clear[i]) i++;
+	else i = n;
+	*b = i;
+	return 1;
+}
+
+//! Check if all source pixels are opaque
+//! Indexed sources are checked over the whole source palette.
+//! Clear pixels are never searched for, so count as opaque here.
+static uint8_t SourceOpaque(const struct DitherJob_t *Job) {
+	uint32_t x, y;
+	uint8_t  a = 0xFF;
+	uint8_t  ClearAlpha = Job->Clear ? 0xFF : 0x00;
+	switch(Job->SrcFormat) {
+		case DITHER_FORMAT_RGBA:
+		case DITHER_FORMAT_BGRA: {
+			for(y=0;y<Job->Height && a == 0xFF;y++) {
+				const uint8_t *Src = Job->SrcPx + (ptrdiff_t)y*Job->SrcStride;
+				for(x=0;x<Job->Width;x++) a &= Src[x*4+3] ? Src[x*4+3] : ClearAlpha;
+			}
+		} break;
+		case DITHER_FORMAT_INDEXED: {
+			for(x=0;x<256;x++) a &= Job->SrcPalette[x*4+3] ? Job->SrcPalette[x*4+3] : ClearAlpha;
+		} break;
+	}
+	return a == 0xFF;
+}
+
+//! Select palette search for the job
+//! Opaque sources on opaque palettes use the opaque search, which
+//! skips the alpha channel, but otherwise gives identical results.
+//! Returns whether the opaque search was selected.
+//! NOTE: This must be called once the source has been set, and before
+//! PrepareSourcePalette().
+static uint8_t SelectSearch(struct DitherJob_t *Job, const struct DitherContext_t *Ctx, uint8_t AssumeOpaque) {
+	uint8_t Opaque = Ctx->Opaque && (AssumeOpaque || SourceOpaque(Job));
+	Job->Pal = Opaque ? &Ctx->PalSearchOpaque : &Ctx->PalSearch;
+	return Opaque;
+}
+
+//! Convert n source pixels of row y, starting at x
+//! Clear pixels are flagged in Clear[], and are left unconverted.
+//! Returns the number of clear pixels; if this is 0, Clear[] is unset.
+//! NOTE: n must not exceed DITHER_CHUNK_SIZE.
+static uint32_t ConvertPixels(const struct DitherJob_t *Job, Vec4f_t *Dst, uint8_t *Clear, uint32_t x, uint32_t y, uint32_t n, uint32_t Thread) {
+	uint32_t a = 0, b = 0, nClear = 0;
+	if(Job->SrcPalPx) {
+		uint32_t i;
+		const uint8_t *Src = Job->SrcPx + (ptrdiff_t)y*Job->SrcStride + x;
+		for(i=0;i<n;i++) Dst[i] = Job->SrcPalPx[Src[i]];
+		if(Job->SrcPalClear) for(i=0;i<n;i++) nClear += (Clear[i] = Job->SrcPalClear[Src[i]]);
+		return nClear;
+	}
+	uint8_t Tmp[DITHER_CHUNK_SIZE*4];
+	const uint8_t *Src = SourcePixels(Job, Tmp, x, y, n);
+	if(Job->Clear) nClear = ClearPixels(Job, Clear, Src, n);
+	while(NextRun(nClear ? Clear : NULL, n, &a, &b)) {
+		if(Job->Caches) ColourCache_ConvertRow(&Job->Caches[Thread], Dst + a, Src + a*4, b-a);
+		else Job->Kernels->ConvertRow(Dst + a, Src + a*4, b-a, Job->Colourspace, Job->PremultipliedAlpha, Job->Approx);
+	}
+	return nClear;
+}
+
+//! Dither rows [y0,y1) without diffusion
+//! Every pixel depends only on its own value and position, so any
+//! set of rows can be processed independently of the others.
+static void DitherRows(const struct DitherJob_t *Job, uint32_t y0, uint32_t y1, uint32_t Thread) {
+	uint32_t x, y;
+	uint32_t Width = Job->Width;
+
+	//! Undithered indexed pixels are simply remapped
+	if(Job->SrcPalIdx) {
+		for(y=y0;y<y1;y++) {
+			const uint8_t *Src = Job->SrcPx + (ptrdiff_t)y*Job->SrcStride;
+			uint8_t *Dst = Job->DstPx + y*Width;
+			for(x=0;x<Width;x++) Dst[x] = Job->SrcPalIdx[Src[x]];
+		}
+		return;
+	}
+
+	for(y=y0;y<y1;y++) {
+		//! Pixels outside of the bounding box are all clear
+		uint8_t *DstRow = Job->DstPx + y*Width;
+		if(y < Job->BoundY0 || y >= Job->BoundY1) {
+			memset(DstRow, 0, Width);
+			continue;
+		}
+		memset(DstRow, 0, Job->BoundX0);
+		memset(DstRow + Job->BoundX1, 0, Width - Job->BoundX1);
+		for(x=Job->BoundX0;x<Job->BoundX1;x+=DITHER_CHUNK_SIZE) {
+			uint8_t  Clear[DITHER_CHUNK_SIZE];
+			uint32_t a = 0, b = 0, nClear;
+			uint32_t nPx = (Job->BoundX1-x < DITHER_CHUNK_SIZE) ? (Job->BoundX1-x) : DITHER_CHUNK_SIZE;
+			uint8_t *Dst = DstRow + x;
+			if(Job->DitherType == DITHER_NONE && Job->Caches) {
+				//! Undithered pixels can be looked up straight from the cache
+				uint8_t Tmp[DITHER_CHUNK_SIZE*4];
+				const uint8_t *Src = SourcePixels(Job, Tmp, x, y, nPx);
+				nClear = Job->Clear ? ClearPixels(Job, Clear, Src, nPx) : 0;
+				if(nClear) memset(Dst, 0, nPx);
+				while(NextRun(nClear ? Clear : NULL, nPx, &a, &b)) {
+					ColourCache_MapRow(&Job->Caches[Thread], Dst + a, Src + a*4, b-a, Job->Pal);
+				}
+			} else {
+				Vec4f_t Px[DITHER_CHUNK_SIZE];
+				nClear = ConvertPixels(Job, Px, Clear, x, y, nPx, Thread);
+				if(nClear) memset(Dst, 0, nPx);
+				while(NextRun(nClear ? Clear : NULL, nPx, &a, &b)) {
+					if(Job->Grid) DitherGrid_MapRow(Job->Grid, Dst + a, Px + a, x+a, x+b, Job->RowOffs + y, Job->Pal);
+					else Job->Kernels->DitherRow(Dst + a, Px + a, x+a, x+b, Job->RowOffs + y, Job->Matrix, Job->DitherLevel, Job->Pal);
+				}
+			}
 		}
 	}
-	return BestIdx;
 }
-static uint8_t FindNearestDitheredColour(const Vec4f_t *x, const Vec4f_t *Bias, const Vec4f_t *Pal, uint32_t nCols) {
-	uint32_t n;
 
-	//! Find closest two matches
-	//! Note that we ensure to not find a duplicate entry,
-	//! and if we only have one match, we use it anyway.
-	uint8_t BestIdxA = 0, BestIdxB = 0;
-	float BestDistA = INFINITY;
-	float BestDistB = INFINITY;
-	for(n=0;n<nCols;n++) {
-		float Dist = Vec4f_Dist2(x, &Pal[n]);
-		if(Dist < BestDistA) {
-			BestIdxB  = BestIdxA;
-			BestDistB = BestDistA;
-			BestIdxA  = (uint8_t)n;
-			BestDistA = Dist;
-		} else if(Dist < BestDistB && Dist > BestDistA) {
-			BestIdxB  = (uint8_t)n;
-			BestDistB = Dist;
+//! Thread pool job: Dither a band of rows
+static void DitherBandJob(void *Arg, uint32_t Band, uint32_t Thread) {
+	const struct DitherJob_t *Job = (const struct DitherJob_t*)Arg;
+	uint32_t y0 = Band * DITHER_BAND_ROWS;
+	uint32_t y1 = (Job->Height-y0 < DITHER_BAND_ROWS) ? Job->Height : (y0 + DITHER_BAND_ROWS);
+	DitherRows(Job, y0, y1, Thread);
+}
+
+//! Diffuse pixels [x0,x1) of a row
+//! Dst, Px and Clear (which may be NULL) start at pixel x0. Clear
+//! pixels are set to index 0, and are skipped over, so that they
+//! neither take nor pass on any error.
+static void DiffusePixels(
+	const struct DitherJob_t *Job,
+	      uint8_t *Dst,
+	const Vec4f_t *Px,
+	const uint8_t *Clear,
+	uint32_t x0,
+	uint32_t x1,
+	Vec4f_t *Diffuse_y0,
+	Vec4f_t *Diffuse_y1,
+	Vec4f_t *Diffuse_y2
+) {
+	uint32_t a = 0, b = 0;
+	if(Clear) memset(Dst, 0, x1-x0);
+	while(NextRun(Clear, x1-x0, &a, &b)) {
+		if(Job->DitherType == DITHER_FLOYDSTEINBERG) {
+			Job->Kernels->DiffuseRow_FloydSteinberg(Dst + a, Px + a, x0+a, x0+b, Job->DitherLevel, Job->Pal, Diffuse_y0, Diffuse_y1);
+		} else {
+			Job->Kernels->DiffuseRow_Atkinson(Dst + a, Px + a, x0+a, x0+b, Job->DitherLevel, Job->Pal, Diffuse_y0, Diffuse_y1, Diffuse_y2);
+		}
+	}
+}
+
+//! Get diffusion row for row y in the wavefront ring
+//! Each row has one pixel of padding on the left and two on the
+//! right, so that propagation past the edges stays inside the row.
+//! NOTE: The ring is indexed by image row, so that diffusion carries
+//! over from one call of DitherStream_Rows() to the next.
+static Vec4f_t *WavefrontRow(const struct DitherJob_t *Job, uint32_t y) {
+	return Job->DiffuseMem + ((Job->RowOffs + y) % Job->nDiffuseRows)*(Job->Width+3) + 1;
+}
+
+//! Wait until at least n pixels of row y have been completed
+//! Without progress counters, rows are run in order, so row y has
+//! always finished already.
+static void WavefrontWait(const struct DitherJob_t *Job, uint32_t y, uint32_t n) {
+	if(!Job->RowProgress) return;
+	while(atomic_load_explicit(&Job->RowProgress[y], memory_order_acquire) < n) sched_yield();
+}
+
+//! Mark n pixels of row y as completed
+static void WavefrontPublish(const struct DitherJob_t *Job, uint32_t y, uint32_t n) {
+	if(Job->RowProgress) atomic_store_explicit(&Job->RowProgress[y], n, memory_order_release);
+}
+
+//! Thread pool job: Dither row y with error diffusion
+//! Every diffusion cell must receive its contributions in the same
+//! order as in the serial loop for the output to be identical. This
+//! holds as long as each pixel is only processed once the row above
+//! has finished every pixel that diffuses into it or into the cells
+//! this pixel diffuses into on its own row: that is, Lead pixels to
+//! the right (2 for Floyd-Steinberg, 3 for Atkinson). Rows further
+//! up are then always further ahead still.
+//! NOTE: Rows are claimed in order, so the lowest unfinished row
+//! never waits, and the wavefront can't deadlock. Likewise, running
+//! the rows in order on a single thread never waits at all.
+//! NOTE: Rows from previous calls of DitherStream_Rows() have all
+//! finished, so there is nothing to wait for across calls.
+static void DiffuseRowJob(void *Arg, uint32_t y, uint32_t Thread) {
+	const struct DitherJob_t *Job = (const struct DitherJob_t*)Arg;
+	uint32_t n, x;
+	uint32_t Width   = Job->Width;
+	uint8_t  IsFloyd = (Job->DitherType == DITHER_FLOYDSTEINBERG);
+	uint32_t Lead    = IsFloyd ? 2 : 3;
+	uint32_t nBelow  = IsFloyd ? 1 : 2; //! Rows below that we diffuse into
+
+	//! Clear the lowest diffusion row we write to, once the row
+	//! that last used its slot (as its own row) has finished
+	if(y + nBelow >= Job->nDiffuseRows) {
+		WavefrontWait(Job, y + nBelow - Job->nDiffuseRows, Width);
+	}
+	Vec4f_t *Diffuse_y0 = WavefrontRow(Job, y);
+	Vec4f_t *Diffuse_y1 = WavefrontRow(Job, y+1);
+	Vec4f_t *Diffuse_y2 = WavefrontRow(Job, y+2);
+	{
+		Vec4f_t *Clear = WavefrontRow(Job, y + nBelow) - 1;
+		for(n=0;n<Width+3;n++) Clear[n] = VEC4F_EMPTY;
+	}
+
+	//! Pixels outside of the bounding box are all clear, and so
+	//! take no part in the diffusion
+	//! NOTE: The row must still not finish before the row above, as
+	//! the clearing of diffusion rows above relies on rows further up
+	//! always being further ahead.
+	uint8_t *DstRow = Job->DstPx + y*Width;
+	if(y < Job->BoundY0 || y >= Job->BoundY1) {
+		memset(DstRow, 0, Width);
+		if(y > 0) WavefrontWait(Job, y-1, Width);
+		WavefrontPublish(Job, y, Width);
+		return;
+	}
+	memset(DstRow, 0, Job->BoundX0);
+	memset(DstRow + Job->BoundX1, 0, Width - Job->BoundX1);
+
+	//! Dither row, step by step behind the row above
+	for(x=Job->BoundX0;x<Job->BoundX1;x+=DITHER_CHUNK_SIZE) {
+		Vec4f_t  Px[DITHER_CHUNK_SIZE];
+		uint8_t  Clear[DITHER_CHUNK_SIZE];
+		uint32_t nPx    = (Job->BoundX1-x < DITHER_CHUNK_SIZE) ? (Job->BoundX1-x) : DITHER_CHUNK_SIZE;
+		uint32_t nClear = ConvertPixels(Job, Px, Clear, x, y, nPx, Thread);
+		for(n=0;n<nPx;n+=DITHER_WAVEFRONT_STEP) {
+			uint32_t x0 = x + n;
+			uint32_t x1 = (nPx-n < DITHER_WAVEFRONT_STEP) ? (x+nPx) : (x0 + DITHER_WAVEFRONT_STEP);
+			if(y > 0) WavefrontWait(Job, y-1, (Width-x1 < Lead) ? Width : (x1 + Lead));
+			DiffusePixels(Job, DstRow + x0, Px+n, nClear ? (Clear+n) : NULL, x0, x1, Diffuse_y0, Diffuse_y1, Diffuse_y2);
+			WavefrontPublish(Job, y, x1);
+		}
+	}
+	WavefrontPublish(Job, y, Width);
+}
+
+//! Thread pool job: Dither a tile with error diffusion
+//! Each tile is diffused on its own (starting DITHER_TILE_OVERLAP
+//! pixels outside of the tile), so the result depends only on the
+//! tile size, and not on the number of threads or the order that
+//! tiles are processed in.
+static void DiffuseTileJob(void *Arg, uint32_t Tile, uint32_t Thread) {
+	const struct DitherJob_t *Job = (const struct DitherJob_t*)Arg;
+	uint32_t n, x, y;
+	uint32_t Width    = Job->Width;
+	uint32_t TileSize = Job->TileSize;
+
+	//! Get tile area, and the area to diffuse over
+	uint32_t TileX0 = (Tile % Job->nTilesX) * TileSize;
+	uint32_t TileY0 = (Tile / Job->nTilesX) * TileSize;
+	uint32_t TileX1 = (Width       - TileX0 < TileSize) ? Width       : (TileX0 + TileSize);
+	uint32_t TileY1 = (Job->Height - TileY0 < TileSize) ? Job->Height : (TileY0 + TileSize);
+	uint32_t x0 = (TileX0 > DITHER_TILE_OVERLAP) ? (TileX0 - DITHER_TILE_OVERLAP) : 0;
+	uint32_t y0 = (TileY0 > DITHER_TILE_OVERLAP) ? (TileY0 - DITHER_TILE_OVERLAP) : 0;
+	uint32_t x1 = (Width - TileX1 < DITHER_TILE_OVERLAP) ? Width : (TileX1 + DITHER_TILE_OVERLAP);
+
+	//! Get scratch memory for this thread
+	//! The diffusion rows are indexed by absolute x (with one pixel of
+	//! padding on the left and two on the right), and only the area
+	//! being diffused over is cleared. Three rows are rotated for both
+	//! modes; Floyd-Steinberg simply never writes to the third.
+	Vec4f_t *Scratch    = Job->TileMem + Thread*Job->TileMemStride;
+	Vec4f_t *Diffuse_y0 = Scratch + 1;
+	Vec4f_t *Diffuse_y1 = Diffuse_y0 + Width+3;
+	Vec4f_t *Diffuse_y2 = Diffuse_y1 + Width+3;
+	uint8_t *DstRow     = (uint8_t*)(Diffuse_y2 + Width+2);
+	for(n=x0;n<x1+3;n++) Diffuse_y1[(int32_t)n-1] = VEC4F_EMPTY;
+	for(n=x0;n<x1+3;n++) Diffuse_y2[(int32_t)n-1] = VEC4F_EMPTY;
+
+	//! Begin dithering
+	for(y=y0;y<TileY1;y++) {
+		//! Swap diffusion buffers and clear for the next line
+		Vec4f_t *t = Diffuse_y0;
+		Diffuse_y0 = Diffuse_y1;
+		Diffuse_y1 = Diffuse_y2;
+		Diffuse_y2 = t;
+		for(n=x0;n<x1+3;n++) Diffuse_y2[(int32_t)n-1] = VEC4F_EMPTY;
+
+		//! Only the part inside of the bounding box needs diffusing
+		uint32_t bx0 = (x0 > Job->BoundX0) ? x0 : Job->BoundX0;
+		uint32_t bx1 = (x1 < Job->BoundX1) ? x1 : Job->BoundX1;
+		if(y < Job->BoundY0 || y >= Job->BoundY1 || bx0 > bx1) bx0 = bx1 = x0;
+		memset(DstRow + x0,  0, bx0 - x0);
+		memset(DstRow + bx1, 0, x1 - bx1);
+		for(x=bx0;x<bx1;x+=DITHER_CHUNK_SIZE) {
+			Vec4f_t  Px[DITHER_CHUNK_SIZE];
+			uint8_t  Clear[DITHER_CHUNK_SIZE];
+			uint32_t nPx    = (bx1-x < DITHER_CHUNK_SIZE) ? (bx1-x) : DITHER_CHUNK_SIZE;
+			uint32_t nClear = ConvertPixels(Job, Px, Clear, x, y, nPx, Thread);
+			DiffusePixels(Job, DstRow + x, Px, nClear ? Clear : NULL, x, x+nPx, Diffuse_y0, Diffuse_y1, Diffuse_y2);
 		}
+
+		//! Store the pixels that belong to this tile
+		if(y >= TileY0) memcpy(Job->DstPx + y*Width + TileX0, DstRow + TileX0, TileX1 - TileX0);
 	}
-	if(BestDistB == INFINITY) return BestIdxA;
-	if(BestDistA < 0.25f*BestDistB) { //! DistA/DistB < (1/2)^2
-		//! We are very out of range, so don't bother dithering
-		return BestIdxA;
+}
+
+//! Prepare source palette for dithering
+//! This converts the source palette to the target colourspace (and
+//! matches it, for undithered output) if it differs from the last
+//! one, and points the job at the results. Clear entries are matched
+//! to index 0.
+//! NOTE: Source palette state must only ever be used with one context,
+//! as the results depend on its palette and clear pixel settings.
+static void PrepareSourcePalette(struct DitherJob_t *Job, struct DitherSourcePalette_t *SrcPal) {
+	uint32_t n;
+	Job->SrcPalPx    = NULL;
+	Job->SrcPalIdx   = NULL;
+	Job->SrcPalClear = NULL;
+	if(Job->SrcFormat != DITHER_FORMAT_INDEXED) return;
+	if(!SrcPal->Valid || memcmp(SrcPal->RGBA, Job->SrcPalette, sizeof(SrcPal->RGBA))) {
+		memcpy(SrcPal->RGBA, Job->SrcPalette, sizeof(SrcPal->RGBA));
+		Job->Kernels->ConvertRow(SrcPal->Px, SrcPal->RGBA, 256, Job->Colourspace, Job->PremultipliedAlpha, Job->Approx);
+		Job->Kernels->DitherRow(SrcPal->Idx, SrcPal->Px, 0, 256, 0, NULL, 0.0f, Job->Pal);
+		for(n=0;n<256;n++) {
+			SrcPal->Clear[n] = Job->Clear && (n == 0 || PixelClear(Job, SrcPal->RGBA + n*4));
+			if(SrcPal->Clear[n]) SrcPal->Idx[n] = 0;
+		}
+		SrcPal->Valid = 1;
 	}
+	Job->SrcPalPx = SrcPal->Px;
+	if(Job->Clear) Job->SrcPalClear = SrcPal->Clear;
+	if(Job->DitherType == DITHER_NONE) Job->SrcPalIdx = SrcPal->Idx;
+}
 
-	//! Scale the bias by their differences, and find closest match to this
-	Vec4f_t xNew = Vec4f_Sub(&Pal[BestIdxA], &Pal[BestIdxB]);
-	        xNew = Vec4f_Abs(&xNew);
-	        xNew = Vec4f_Mul(&xNew, Bias);
-	        xNew = Vec4f_Add(&xNew, x);
-	return FindNearestColour(&xNew, Pal, nCols);
+//! Check if all pixels of row y are clear
+static uint8_t SourceRowClear(const struct DitherJob_t *Job, uint32_t y) {
+	uint32_t x;
+	const uint8_t *Row = Job->SrcPx + (ptrdiff_t)y*Job->SrcStride;
+	for(x=0;x<Job->Width;x++) if(!SourcePixelClear(Job, Row, x)) return 0;
+	return 1;
 }
 
-//! Calculate checkered dithering offset
-static inline float CheckerDitherOffset(uint32_t x, uint32_t y) {
-	return (float)((x^y) & 1) - 0.5f;
+//! Find bounding box of the pixels that aren't clear
+//! Rows are first trimmed from the top and bottom; each remaining row
+//! then only needs to be scanned up to the box found so far from
+//! either side, so that opaque images cost next to nothing here.
+static void FindBounds(struct DitherJob_t *Job) {
+	uint32_t x, y;
+	uint32_t Width = Job->Width;
+	Job->BoundX0 = 0, Job->BoundX1 = Width;
+	Job->BoundY0 = 0, Job->BoundY1 = Job->Height;
+	if(!Job->Clear) return;
+
+	uint32_t x0 = Width, x1 = 0, y0, y1;
+	for(y0=0;y0<Job->Height && SourceRowClear(Job, y0);y0++);
+	for(y1=Job->Height;y1>y0 && SourceRowClear(Job, y1-1);y1--);
+	for(y=y0;y<y1;y++) {
+		const uint8_t *Row = Job->SrcPx + (ptrdiff_t)y*Job->SrcStride;
+		for(x=0;x<x0 && SourcePixelClear(Job, Row, x);x++);
+		x0 = x;
+		for(x=Width;x>x1 && SourcePixelClear(Job, Row, x-1);x--);
+		x1 = x;
+	}
+	if(y0 == y1) x0 = x1 = 0;
+	Job->BoundX0 = x0, Job->BoundX1 = x1;
+	Job->BoundY0 = y0, Job->BoundY1 = y1;
 }
 
-//! Calculate ordered dithering offset
-static inline float OrderedDitherOffset(uint32_t x, uint32_t y, uint8_t Log2Size) {
-	uint8_t Bit = Log2Size;
-	uint32_t Threshold = 0, xKey = x, yKey = x^y;
-	do {
-		Threshold = Threshold*2 + (yKey & 1), yKey >>= 1; //! <- Hopefully turned into "SHR, ADC"
-		Threshold = Threshold*2 + (xKey & 1), xKey >>= 1;
-	} while(--Bit);
-	return (float)Threshold * (1.0f / (float)(1 << (2*Log2Size))) - 0.5f;
+//! Prepare source for dithering
+//! NOTE: This must be called after SelectSearch().
+static void PrepareSource(struct DitherJob_t *Job, struct DitherSourcePalette_t *SrcPal) {
+	PrepareSourcePalette(Job, SrcPal);
+	FindBounds(Job);
 }
 
-//! Propagate error to neighbouring pixels (Floyd-Steinberg)
-static inline void FloydSteinberg_PropagateError(const Vec4f_t *Error, Vec4f_t *y0, Vec4f_t *y1) {
-	Vec4f_t t;
-	t = Vec4f_Muli(Error, 7.0f/16); //! {x+1,y}   @ 7/16
-	y0[+1] = Vec4f_Add(&y0[+1], &t);
-	t = Vec4f_Muli(Error, 3.0f/16); //! {x-1,y+1} @ 3/16
-	y1[-1] = Vec4f_Add(&y1[-1], &t);
-	t = Vec4f_Muli(Error, 5.0f/16); //! {x+0,y+1} @ 5/16
-	y1[+0] = Vec4f_Add(&y1[+0], &t);
-	t = Vec4f_Muli(Error, 1.0f/16); //! {x+1,y+1} @ 1/16
-	y1[+1] = Vec4f_Add(&y1[+1], &t);
+//! Dither image with tiled error diffusion
+//! Pool may be NULL to process all tiles on the calling thread.
+//! Returns 0 if memory for the scratch buffers could not be allocated.
+static uint8_t DiffuseImageTiled(const struct DitherJob_t *SrcJob, struct ThreadPool_t *Pool, uint32_t TileSize) {
+	uint32_t nThreads = Pool ? Pool->nThreads : 1;
+	if(TileSize < DITHER_TILE_OVERLAP) TileSize = DITHER_TILE_OVERLAP;
+
+	//! Allocate scratch memory for each thread
+	//! Each thread needs three diffusion rows, plus one row of output.
+	struct DitherJob_t Job = *SrcJob;
+	Job.TileSize      = TileSize;
+	Job.nTilesX       = (Job.Width + TileSize-1) / TileSize;
+	Job.TileMemStride = 3*(Job.Width+3) + (Job.Width + sizeof(Vec4f_t)-1) / sizeof(Vec4f_t);
+	Job.TileMem       = malloc(nThreads * Job.TileMemStride * sizeof(Vec4f_t));
+	if(!Job.TileMem) return 0;
+
+	//! Dither tiles
+	uint32_t nTiles = Job.nTilesX * ((Job.Height + TileSize-1) / TileSize);
+	if(Pool) ThreadPool_Run(Pool, nTiles, DiffuseTileJob, &Job);
+	else {
+		uint32_t Tile;
+		for(Tile=0;Tile<nTiles;Tile++) DiffuseTileJob(&Job, Tile, 0);
+	}
+
+	//! Release memory
+	free(Job.TileMem);
+	return 1;
 }
 
-//! Propagate error to neighbouring pixels (Atkinson diffusion)
-static inline void Atkinson_PropagateError(const Vec4f_t *Error, Vec4f_t *y0, Vec4f_t *y1, Vec4f_t *y2) {
-	Vec4f_t t = Vec4f_Muli(Error, 1.0f/8);
-	y0[+1] = Vec4f_Add(&y0[+1], &t);
-	y0[+2] = Vec4f_Add(&y0[+2], &t);
-	y1[-1] = Vec4f_Add(&y1[-1], &t);
-	y1[ 0] = Vec4f_Add(&y1[ 0], &t);
-	y1[+1] = Vec4f_Add(&y1[+1], &t);
-	y2[ 0] = Vec4f_Add(&y2[ 0], &t);
+//! Build threshold matrices for the built-in ordered dithers
+//! The rank of each entry of the Bayer matrix of size 2^n is found by
+//! interleaving the bits of x^y and x (lowest bits first, as the
+//! highest bits of the rank). Building these once means that the row
+//! kernels only need a table lookup for each pixel.
+//! Returns 0 on failure, or 1 on success.
+static uint8_t CreateBuiltinMatrices(struct DitherContext_t *Ctx) {
+	uint32_t n, x, y, Bit;
+
+	//! Allocate memory for all matrices
+	size_t nThresholds = 2*2;
+	for(n=1;n<=DITHER_ORDERED_MAX;n++) nThresholds += (size_t)1 << (2*n);
+	float *Thresholds = malloc(nThresholds * sizeof(float));
+	if(!Thresholds) return 0;
+	Ctx->Thresholds = Thresholds;
+
+	//! Checkerboard
+	for(y=0;y<2;y++) for(x=0;x<2;x++) Thresholds[y*2+x] = (float)((x^y) & 1) - 0.5f;
+	Ctx->Checker = (struct DitherMatrix_t){.Width = 2, .Height = 2, .Thresholds = Thresholds};
+	Thresholds += 2*2;
+
+	//! Bayer matrices
+	for(n=1;n<=DITHER_ORDERED_MAX;n++) {
+		uint32_t Size = 1u << n;
+		for(y=0;y<Size;y++) for(x=0;x<Size;x++) {
+			uint32_t Rank = 0, xKey = x, yKey = x^y;
+			for(Bit=0;Bit<n;Bit++) {
+				Rank = Rank*2 + (yKey & 1), yKey >>= 1;
+				Rank = Rank*2 + (xKey & 1), xKey >>= 1;
+			}
+			Thresholds[y*Size+x] = (float)Rank * (1.0f / (float)(1 << (2*n))) - 0.5f;
+		}
+		Ctx->Ordered[n-1] = (struct DitherMatrix_t){.Width = Size, .Height = Size, .Thresholds = Thresholds};
+		Thresholds += Size*Size;
+	}
+	return 1;
 }
 
 /************************************************/
 
 //! Dither palettized, tiled image data
-void DitherPaletteImage(
+uint8_t DitherPaletteImage(
 	      uint8_t *DstPx,
 	const uint8_t *SrcPx,   //! RGBA
 	const uint8_t *Palette, //! RGBA
@@ -111,126 +778,505 @@ void DitherPaletteImage(
 	uint8_t  PremultipliedAlpha,
 	uint32_t nPaletteColours
 ) {
-	uint32_t n;
+	const struct DitherOptions_t Options = {.nThreads = 1};
+	return DitherPaletteImageEx(
+		DstPx,
+		SrcPx,
+		Palette,
+		Width,
+		Height,
+		DitherType,
+		DitherLevel,
+		Colourspace,
+		PremultipliedAlpha,
+		nPaletteColours,
+		&Options
+	);
+}
+
+//! Dither palettized image data with options
+uint8_t DitherPaletteImageEx(
+	      uint8_t *DstPx,
+	const uint8_t *SrcPx,
+	const uint8_t *Palette, //! RGBA
+	uint32_t Width,
+	uint32_t Height,
+	uint8_t  DitherType,
+	float    DitherLevel,
+	uint8_t  Colourspace,
+	uint8_t  PremultipliedAlpha,
+	uint32_t nPaletteColours,
+	const struct DitherOptions_t *Options
+) {
+	static const struct DitherOptions_t Defaults = {0};
+	if(!Options) Options = &Defaults;
+	int32_t  SrcStride  = Options->SrcStride;
+	uint8_t  SrcFormat  = Options->SrcFormat;
+	const uint8_t *SrcPalette = Options->SrcPalette;
+	const struct DitherMatrix_t *Matrix = Options->Matrix;
+	uint32_t Flags      = Options->Flags;
+	struct DitherStats_t *Stats = Options->Stats;
+	if(Stats) *Stats = (struct DitherStats_t){0};
+	if(!SourceFormatValid(SrcFormat, SrcPalette)) return DITHER_ERROR_FORMAT;
+	if(!DitherTypeValid(DitherType, Matrix)) return DITHER_ERROR_DITHER;
+
+	ResolveSourceLayout(&SrcPx, &SrcStride, SrcFormat, Width, Height, Flags);
+
+	//! The whole image is dithered as a single band
+	struct DitherStream_t *Stream = DitherStream_Create(
+		Palette,
+		Width,
+		Height,
+		DitherType,
+		DitherLevel,
+		Matrix,
+		Colourspace,
+		PremultipliedAlpha,
+		nPaletteColours,
+		Options->nThreads,
+		Options->GridMemory,
+		Flags,
+		Options->ClearColour
+	);
+	if(!Stream) return DITHER_ERROR_MEMORY;
+
+	//! Tiled diffusion works on the whole image at once, so run
+	//! that directly; if we have no memory, fall back to the exact
+	//! (wavefront) path instead
+	struct DitherJob_t *Job = &Stream->Job;
+	uint8_t Done = 0, Error = DITHER_OK;
+	uint32_t DiffuseTileSize = Options->DiffuseTileSize;
+	if(DiffuseTileSize && (Job->DitherType == DITHER_FLOYDSTEINBERG || Job->DitherType == DITHER_ATKINSON)) {
+		struct DitherJob_t TileJob = *Job;
+		SetSource(&TileJob, Stream->Ctx, DstPx, SrcPx, SrcStride, SrcFormat, SrcPalette, Height);
+		SelectSearch(&TileJob, Stream->Ctx, Stream->Ctx->AssumeOpaque);
+		PrepareSource(&TileJob, &Stream->SrcPal);
+		Done = DiffuseImageTiled(&TileJob, Stream->UsePool ? &Stream->Pool : NULL, DiffuseTileSize);
+	}
+	if(!Done) Error = DitherStream_RowsEx(Stream, DstPx, SrcPx, SrcStride, SrcFormat, SrcPalette, Height);
+
+	//! Clean up
+	if(Stats) DitherStream_GetStats(Stream, Stats);
+	DitherStream_Destroy(Stream);
+	return Error;
+}
+
+/************************************************/
+
+//! Create dither context
+struct DitherContext_t *DitherContext_Create(
+	const uint8_t *Palette, //! RGBA
+	uint32_t nPaletteColours,
+	uint8_t  Colourspace,
+	uint8_t  PremultipliedAlpha,
+	uint32_t Flags,
+	const uint8_t *ClearColour //! RGB
+) {
+	const struct DitherKernels_t *Kernels = DitherKernels;
+
+	//! Allocate context
+	struct DitherContext_t *Ctx = malloc(sizeof(struct DitherContext_t));
+	if(!Ctx) return NULL;
+	Ctx->Kernels            = Kernels;
+	Ctx->Colourspace        = Colourspace;
+	Ctx->PremultipliedAlpha = PremultipliedAlpha;
+	Ctx->Approx             = (Flags & DITHER_FLAG_FASTMATH) ? 1 : 0;
+	Ctx->AssumeOpaque       = (Flags & DITHER_FLAG_OPAQUE)   ? 1 : 0;
+	Ctx->Clear0             = (Flags & DITHER_FLAG_CLEAR0)   ? 1 : 0;
+	Ctx->HasClearCol        = (Ctx->Clear0 && ClearColour)   ? 1 : 0;
+	memset(Ctx->ClearCol, 0, sizeof(Ctx->ClearCol));
+	if(Ctx->HasClearCol) memcpy(Ctx->ClearCol, ClearColour, sizeof(Ctx->ClearCol));
 
 	//! Convert palette to target colourspace
-	Vec4f_t *NewPal = malloc(nPaletteColours * sizeof(Vec4f_t));
-	for(n=0;n<nPaletteColours;n++) {
-		Vec4f_t t;
-		t.f32[0] = Palette[n*4+0] / 255.0f;
-		t.f32[1] = Palette[n*4+1] / 255.0f;
-		t.f32[2] = Palette[n*4+2] / 255.0f;
-		t.f32[3] = Palette[n*4+3] / 255.0f;
-		t = ConvertToColourspace(&t, Colourspace);
-		if(!PremultipliedAlpha) {
-			t.f32[0] *= t.f32[3];
-			t.f32[1] *= t.f32[3];
-			t.f32[2] *= t.f32[3];
-		}
-		NewPal[n] = t;
-	}
-
-	//! If we requested a diffusion dither, allocate buffer
-	Vec4f_t *DitherBuffer = NULL;
-	Vec4f_t *Diffuse_y0   = NULL;
-	Vec4f_t *Diffuse_y1   = NULL;
-	Vec4f_t *Diffuse_y2   = NULL;
-	if(DitherType == DITHER_FLOYDSTEINBERG) {
-		DitherBuffer = (Vec4f_t*)malloc((Width*2+3) * sizeof(Vec4f_t));
-		if(DitherBuffer) {
-			Diffuse_y0 = DitherBuffer + 1;
-			Diffuse_y1 = Diffuse_y0   + Width+1;
-			for(n=0;n<Width;n++) Diffuse_y1[n] = VEC4F_EMPTY;
-		} else {
-			//! If we have no memory, disable dithering
-			DitherType = DITHER_NONE;
-		}
-	} else if(DitherType == DITHER_ATKINSON) {
-		DitherBuffer = (Vec4f_t*)malloc((Width*3+7) * sizeof(Vec4f_t));
-		if(DitherBuffer) {
-			Diffuse_y0 = DitherBuffer + 1;
-			Diffuse_y1 = Diffuse_y0   + Width+2;
-			Diffuse_y2 = Diffuse_y1   + Width+2;
-			for(n=0;n<Width;n++) Diffuse_y1[n] = VEC4F_EMPTY;
-			for(n=0;n<Width;n++) Diffuse_y2[n] = VEC4F_EMPTY;
-		} else {
-			//! If we have no memory, disable dithering
-			DitherType = DITHER_NONE;
-		}
+	Ctx->NewPal = malloc(nPaletteColours * sizeof(Vec4f_t));
+	if(!Ctx->NewPal) {
+		free(Ctx);
+		return NULL;
 	}
+	Kernels->ConvertRow(Ctx->NewPal, Palette, nPaletteColours, Colourspace, PremultipliedAlpha, Ctx->Approx);
 
-	//! Begin dithering
-	//! NOTE: We can't clamp values here, because the input colourspaces
-	//! do not necessarily have a nominal range of 0.0 to 1.0. This may
-	//! cause issues at times, but hopefully this is minor.
-	uint32_t x, y;
-	for(y=0;y<Height;y++) {
-		//! Swap diffusion buffers and clear for the next line
-		if(DitherType == DITHER_FLOYDSTEINBERG) {
-			Vec4f_t *t = Diffuse_y0;
-			Diffuse_y0 = Diffuse_y1;
-			Diffuse_y1 = t;
-			for(n=0;n<Width;n++) Diffuse_y1[n] = VEC4F_EMPTY;
-		} else if(DitherType == DITHER_ATKINSON) {
-			Vec4f_t *t = Diffuse_y0;
-			Diffuse_y0 = Diffuse_y1;
-			Diffuse_y1 = Diffuse_y2;
-			Diffuse_y2 = t;
-			for(n=0;n<Width;n++) Diffuse_y2[n] = VEC4F_EMPTY;
+	//! Build search index over converted palette
+	//! With DITHER_FLAG_CLEAR0, index 0 is reserved for clear pixels,
+	//! so it is left out of the search for all the others.
+	if(!PalSearch_Create(&Ctx->PalSearch, Ctx->NewPal, nPaletteColours, Ctx->Clear0)) {
+		free(Ctx->NewPal);
+		free(Ctx);
+		return NULL;
+	}
+
+	//! Build threshold matrices
+	if(!CreateBuiltinMatrices(Ctx)) {
+		PalSearch_Destroy(&Ctx->PalSearch);
+		free(Ctx->NewPal);
+		free(Ctx);
+		return NULL;
+	}
+
+	//! Check for opaque palette
+	uint32_t n;
+	uint8_t  a = 0xFF;
+	for(n=0;n<nPaletteColours;n++) a &= Palette[n*4+3];
+	Ctx->Opaque          = (a == 0xFF);
+	Ctx->PalSearchOpaque = PalSearch_Opaque(&Ctx->PalSearch);
+	return Ctx;
+}
+
+/************************************************/
+
+//! Destroy dither context
+void DitherContext_Destroy(struct DitherContext_t *Ctx) {
+	PalSearch_Destroy(&Ctx->PalSearch);
+	free(Ctx->Thresholds);
+	free(Ctx->NewPal);
+	free(Ctx);
+}
+
+/************************************************/
+
+//! Create scratch memory for a dither context
+struct DitherScratch_t *DitherScratch_Create(const struct DitherContext_t *Ctx) {
+	struct DitherScratch_t *Scratch = malloc(sizeof(struct DitherScratch_t));
+	if(!Scratch) return NULL;
+	Scratch->Ctx          = Ctx;
+	Scratch->SrcPal.Valid = 0;
+	Scratch->DiffuseMem   = NULL;
+	Scratch->DiffuseWidth = 0;
+	Scratch->InArena      = 0;
+
+	//! If we have no memory for the cache, simply run without it
+	Scratch->HasCache = ColourCache_Create(&Scratch->Cache, Ctx->Kernels, Ctx->Colourspace, Ctx->PremultipliedAlpha, Ctx->Approx);
+	return Scratch;
+}
+
+/************************************************/
+
+//! Get arena size for scratch memory
+//! The arena holds the scratch context, then the colour cache, then
+//! (for diffusion) the diffusion ring.
+size_t DitherScratch_ArenaSize(uint32_t MaxWidth, uint8_t DitherType) {
+	size_t Size = ARENA_ALIGN(sizeof(struct DitherScratch_t)) + ARENA_ALIGN(COLOURCACHE_MEM_SIZE);
+	if(DitherType == DITHER_FLOYDSTEINBERG || DitherType == DITHER_ATKINSON) {
+		Size += ARENA_ALIGN((size_t)DITHER_SCRATCH_DIFFUSE_ROWS * (MaxWidth+3) * sizeof(Vec4f_t));
+	}
+	return Size;
+}
+
+/************************************************/
+
+//! Create scratch memory for a dither context in an arena
+struct DitherScratch_t *DitherScratch_CreateInArena(
+	const struct DitherContext_t *Ctx,
+	void    *Arena,
+	size_t   ArenaSize,
+	uint32_t MaxWidth,
+	uint8_t  DitherType
+) {
+	if(ArenaSize < DitherScratch_ArenaSize(MaxWidth, DitherType)) return NULL;
+
+	//! Carve up arena
+	uint8_t *Mem = (uint8_t*)Arena;
+	struct DitherScratch_t *Scratch = (struct DitherScratch_t*)Mem;
+	Mem += ARENA_ALIGN(sizeof(struct DitherScratch_t));
+	ColourCache_CreateInPlace(&Scratch->Cache, Mem, Ctx->Kernels, Ctx->Colourspace, Ctx->PremultipliedAlpha, Ctx->Approx);
+	Mem += ARENA_ALIGN(COLOURCACHE_MEM_SIZE);
+	Scratch->Ctx          = Ctx;
+	Scratch->HasCache     = 1;
+	Scratch->SrcPal.Valid = 0;
+	Scratch->DiffuseMem   = NULL;
+	Scratch->DiffuseWidth = 0;
+	Scratch->InArena      = 1;
+	if(DitherType == DITHER_FLOYDSTEINBERG || DitherType == DITHER_ATKINSON) {
+		Scratch->DiffuseMem   = (Vec4f_t*)Mem;
+		Scratch->DiffuseWidth = MaxWidth;
+	}
+	return Scratch;
+}
+
+/************************************************/
+
+//! Destroy scratch memory for a dither context
+void DitherScratch_Destroy(struct DitherScratch_t *Scratch) {
+	if(Scratch->InArena) return;
+	if(Scratch->HasCache) ColourCache_Destroy(&Scratch->Cache);
+	free(Scratch->DiffuseMem);
+	free(Scratch);
+}
+
+/************************************************/
+
+//! Dither image data using a dither context
+uint8_t DitherContext_Image(
+	const struct DitherContext_t *Ctx,
+	struct DitherScratch_t       *Scratch,
+	      uint8_t *DstPx,
+	const uint8_t *SrcPx,
+	int32_t  SrcStride,
+	uint8_t  SrcFormat,
+	const uint8_t *SrcPalette, //! RGBA
+	uint32_t Width,
+	uint32_t Height,
+	uint8_t  DitherType,
+	float    DitherLevel,
+	const struct DitherMatrix_t *Matrix,
+	uint32_t Flags
+) {
+	uint32_t y;
+	size_t   n;
+	if(Scratch->Ctx != Ctx) return DITHER_ERROR_CONTEXT;
+	if(!SourceFormatValid(SrcFormat, SrcPalette)) return DITHER_ERROR_FORMAT;
+	if(!DitherTypeValid(DitherType, Matrix)) return DITHER_ERROR_DITHER;
+	ResolveSourceLayout(&SrcPx, &SrcStride, SrcFormat, Width, Height, Flags);
+
+	//! Prepare job
+	struct DitherJob_t Job;
+	InitJob(&Job, Ctx, Width, DitherType, DitherLevel, Matrix);
+	SetSource(&Job, Ctx, DstPx, SrcPx, SrcStride, SrcFormat, SrcPalette, Height);
+	Job.Caches = Scratch->HasCache ? &Scratch->Cache : NULL;
+	SelectSearch(&Job, Ctx, Ctx->AssumeOpaque || (Flags & DITHER_FLAG_OPAQUE));
+	PrepareSource(&Job, &Scratch->SrcPal);
+	if(DitherType != DITHER_FLOYDSTEINBERG && DitherType != DITHER_ATKINSON) {
+		DitherRows(&Job, 0, Height, 0);
+		return DITHER_OK;
+	}
+
+	//! Grow diffusion ring as needed
+	//! The rows are processed in order on this thread, so the ring
+	//! only needs the rows that a single row reads from and writes to,
+	//! and no progress counters are needed (see WavefrontWait()).
+	//! Arena memory never grows, so it must already be large enough.
+	Job.nDiffuseRows = DITHER_SCRATCH_DIFFUSE_ROWS;
+	if(Width > Scratch->DiffuseWidth) {
+		if(Scratch->InArena) return DITHER_ERROR_MEMORY;
+		Vec4f_t *Mem = realloc(Scratch->DiffuseMem, (size_t)Job.nDiffuseRows * (Width+3) * sizeof(Vec4f_t));
+		if(!Mem) return DITHER_ERROR_MEMORY;
+		Scratch->DiffuseMem   = Mem;
+		Scratch->DiffuseWidth = Width;
+	}
+	Job.DiffuseMem  = Scratch->DiffuseMem;
+	Job.RowProgress = NULL;
+
+	//! Dither rows
+	for(n=0;n<(size_t)Job.nDiffuseRows*(Width+3);n++) Job.DiffuseMem[n] = VEC4F_EMPTY;
+	for(y=0;y<Height;y++) DiffuseRowJob(&Job, y, 0);
+	return DITHER_OK;
+}
+
+/************************************************/
+
+//! Create streaming dither context
+struct DitherStream_t *DitherStream_Create(
+	const uint8_t *Palette, //! RGBA
+	uint32_t Width,
+	uint32_t MaxRows,
+	uint8_t  DitherType,
+	float    DitherLevel,
+	const struct DitherMatrix_t *Matrix,
+	uint8_t  Colourspace,
+	uint8_t  PremultipliedAlpha,
+	uint32_t nPaletteColours,
+	uint32_t nThreads,
+	size_t   GridMemory,
+	uint32_t Flags,
+	const uint8_t *ClearColour //! RGB
+) {
+	struct DitherContext_t *Ctx = DitherContext_Create(Palette, nPaletteColours, Colourspace, PremultipliedAlpha, Flags, ClearColour);
+	if(!Ctx) return NULL;
+	struct DitherStream_t *Stream = DitherStream_CreateFromContext(Ctx, Width, MaxRows, DitherType, DitherLevel, Matrix, nThreads, GridMemory);
+	if(!Stream) {
+		DitherContext_Destroy(Ctx);
+		return NULL;
+	}
+	Stream->OwnedCtx = Ctx;
+	return Stream;
+}
+
+//! Create streaming dither context from a dither context
+struct DitherStream_t *DitherStream_CreateFromContext(
+	const struct DitherContext_t *Ctx,
+	uint32_t Width,
+	uint32_t MaxRows,
+	uint8_t  DitherType,
+	float    DitherLevel,
+	const struct DitherMatrix_t *Matrix,
+	uint32_t nThreads,
+	size_t   GridMemory
+) {
+	uint32_t n;
+	if(!DitherTypeValid(DitherType, Matrix)) return NULL;
+
+	//! Allocate context
+	struct DitherStream_t *Stream = malloc(sizeof(struct DitherStream_t));
+	if(!Stream) return NULL;
+	Stream->Ctx          = Ctx;
+	Stream->OwnedCtx     = NULL;
+	Stream->MaxRows      = MaxRows;
+	Stream->HasAlpha     = 0;
+	Stream->SrcPal.Valid = 0;
+	Stream->HasGrid      = 0;
+
+	//! Prepare job
+	struct DitherJob_t *Job = &Stream->Job;
+	InitJob(Job, Ctx, Width, DitherType, DitherLevel, Matrix);
+	Stream->UsePool = (nThreads != 1 && MaxRows > 1 && ThreadPool_Create(&Stream->Pool, nThreads));
+
+	//! Create colour cache for each thread
+	//! If we have no memory, simply run without caching.
+	Stream->nCaches = Stream->UsePool ? Stream->Pool.nThreads : 1;
+	Job->Caches = malloc(Stream->nCaches * sizeof(struct ColourCache_t));
+	if(Job->Caches) for(n=0;n<Stream->nCaches;n++) {
+		if(!ColourCache_Create(&Job->Caches[n], Ctx->Kernels, Ctx->Colourspace, Ctx->PremultipliedAlpha, Ctx->Approx)) {
+			while(n) ColourCache_Destroy(&Job->Caches[--n]);
+			free(Job->Caches);
+			Job->Caches = NULL;
+			break;
 		}
-		for(x=0;x<Width;x++) {
-			//! Grab pixel and apply dithering, palette mapping
-			Vec4f_t Px, PxOrig; {
-				const uint8_t *Src = SrcPx + (y*Width+x)*4;
-				Vec4f_t t;
-				t.f32[0] = Src[0] / 255.0f;
-				t.f32[1] = Src[1] / 255.0f;
-				t.f32[2] = Src[2] / 255.0f;
-				t.f32[3] = Src[3] / 255.0f;
-				t = ConvertToColourspace(&t, Colourspace);
-				if(!PremultipliedAlpha) {
-					t.f32[0] *= t.f32[3];
-					t.f32[1] *= t.f32[3];
-					t.f32[2] *= t.f32[3];
-				}
-				PxOrig = t;
-			}
-			uint8_t BestFitIdx = 0;
-			if(DitherType != DITHER_NONE) {
-				if(DitherType == DITHER_FLOYDSTEINBERG || DitherType == DITHER_ATKINSON) {
-					//! Subtract diffused error and propagate new error
-					Px = Diffuse_y0[x];
-					Px = Vec4f_Muli (&Px, DitherLevel);
-					Px = Vec4f_Add  (&Px, &PxOrig);
-					BestFitIdx = FindNearestColour(&Px, NewPal, nPaletteColours);
-					Px = NewPal[BestFitIdx];
-					Vec4f_t Error = Vec4f_Sub(&PxOrig, &Px);
-					if(DitherType == DITHER_FLOYDSTEINBERG) {
-						FloydSteinberg_PropagateError(&Error, Diffuse_y0+x, Diffuse_y1+x);
-					} else {
-						Atkinson_PropagateError(&Error, Diffuse_y0+x, Diffuse_y1+x, Diffuse_y2+x);
-					}
-				} else {
-					//! Adjust for dither matrix
-					float Offs;
-					if(DitherType != DITHER_CHECKER) {
-						Offs = OrderedDitherOffset(x, y, DitherType);
-					} else {
-						Offs = CheckerDitherOffset(x, y);
-					}
-					Vec4f_t vOffs = Vec4f_Broadcast(Offs * DitherLevel);
-					BestFitIdx = FindNearestDitheredColour(&PxOrig, &vOffs, NewPal, nPaletteColours);
-				}
-			} else {
-				BestFitIdx = FindNearestColour(&PxOrig, NewPal, nPaletteColours);
-			}
-			DstPx[y*Width+x] = BestFitIdx;
+	}
+
+	//! Create lookup grid for ordered dithers
+	//! As with the caches, if this fails, simply run without it.
+	if(GridMemory && Job->Matrix) {
+		Stream->HasGrid = DitherGrid_Create(
+			&Stream->Grid,
+			Ctx->Kernels,
+			Ctx->Colourspace,
+			Ctx->PremultipliedAlpha,
+			Ctx->Approx,
+			Job->Matrix,
+			DitherLevel,
+			GridMemory
+		);
+	}
+
+	//! Allocate diffusion ring and progress counters
+	//! Only about one row per thread is in flight at any time, so
+	//! the ring only needs to be a little larger than that.
+	if(DitherType == DITHER_FLOYDSTEINBERG || DitherType == DITHER_ATKINSON) {
+		Job->nDiffuseRows = Stream->nCaches + 3;
+		Job->DiffuseMem   = malloc((size_t)Job->nDiffuseRows * (Width+3) * sizeof(Vec4f_t));
+		Job->RowProgress  = malloc(MaxRows * sizeof(atomic_uint));
+		if(!Job->DiffuseMem || !Job->RowProgress) {
+			DitherStream_Destroy(Stream);
+			return NULL;
 		}
+
+		//! Clear the diffusion rows that the first row reads from
+		//! (every row clears its lowest diffusion row itself)
+		size_t i;
+		for(i=0;i<(size_t)Job->nDiffuseRows*(Width+3);i++) Job->DiffuseMem[i] = VEC4F_EMPTY;
 	}
+	return Stream;
+}
 
-	//! Release memory
-	/*if(DitherBuffer)*/ free(DitherBuffer);
-	free(NewPal);
+/************************************************/
+
+//! Destroy streaming dither context
+void DitherStream_Destroy(struct DitherStream_t *Stream) {
+	uint32_t n;
+	struct DitherJob_t *Job = &Stream->Job;
+	if(Stream->UsePool) ThreadPool_Destroy(&Stream->Pool);
+	if(Job->Caches) {
+		for(n=0;n<Stream->nCaches;n++) ColourCache_Destroy(&Job->Caches[n]);
+		free(Job->Caches);
+	}
+	if(Stream->HasGrid) DitherGrid_Destroy(&Stream->Grid);
+	free(Job->RowProgress);
+	free(Job->DiffuseMem);
+	if(Stream->OwnedCtx) DitherContext_Destroy(Stream->OwnedCtx);
+	free(Stream);
+}
+
+/************************************************/
+
+//! Dither the next rows of the image
+uint8_t DitherStream_Rows(struct DitherStream_t *Stream, uint8_t *DstPx, const uint8_t *SrcPx, uint32_t nRows) {
+	return DitherStream_RowsEx(Stream, DstPx, SrcPx, 0, DITHER_FORMAT_RGBA, NULL, nRows);
+}
+
+//! Dither the next rows of the image, from any source format
+uint8_t DitherStream_RowsEx(
+	struct DitherStream_t *Stream,
+	      uint8_t *DstPx,
+	const uint8_t *SrcPx,
+	int32_t  SrcStride,
+	uint8_t  SrcFormat,
+	const uint8_t *SrcPalette, //! RGBA
+	uint32_t nRows
+) {
+	uint32_t y;
+	struct DitherJob_t *Job = &Stream->Job;
+	if(nRows > Stream->MaxRows) return DITHER_ERROR_ROWS;
+	if(!SourceFormatValid(SrcFormat, SrcPalette)) return DITHER_ERROR_FORMAT;
+	if(!SrcStride) SrcStride = (int32_t)(Job->Width * SourceBytesPerPixel[SrcFormat]);
+	SetSource(Job, Stream->Ctx, DstPx, SrcPx, SrcStride, SrcFormat, SrcPalette, nRows);
+
+	//! Select search for these rows
+	//! Diffusion carries the alpha error into later rows, so once any
+	//! diffused rows had alpha, the opaque search can't be used again.
+	//! The lookup grid is only valid for the opaque search.
+	uint8_t Diffuse = (Job->DitherType == DITHER_FLOYDSTEINBERG || Job->DitherType == DITHER_ATKINSON);
+	uint8_t Opaque  = 0;
+	if(Diffuse && Stream->HasAlpha) Job->Pal = &Stream->Ctx->PalSearch;
+	else if(!(Opaque = SelectSearch(Job, Stream->Ctx, Stream->Ctx->AssumeOpaque)) && Diffuse) Stream->HasAlpha = 1;
+	Job->Grid = (Opaque && Stream->HasGrid) ? &Stream->Grid : NULL;
+	PrepareSource(Job, &Stream->SrcPal);
+	if(Diffuse) {
+		for(y=0;y<nRows;y++) atomic_init(&Job->RowProgress[y], 0);
+		if(Stream->UsePool) ThreadPool_Run(&Stream->Pool, nRows, DiffuseRowJob, Job);
+		else for(y=0;y<nRows;y++) DiffuseRowJob(Job, y, 0);
+	} else {
+		uint32_t nBands = (nRows + DITHER_BAND_ROWS-1) / DITHER_BAND_ROWS;
+		if(Stream->UsePool) ThreadPool_Run(&Stream->Pool, nBands, DitherBandJob, Job);
+		else DitherRows(Job, 0, nRows, 0);
+	}
+	Job->RowOffs += nRows;
+	return DITHER_OK;
+}
+
+/************************************************/
+
+//! Get statistics for streaming dither context
+void DitherStream_GetStats(const struct DitherStream_t *Stream, struct DitherStats_t *Stats) {
+	uint32_t n;
+	Stats->nCacheLookups = 0;
+	Stats->nCacheHits    = 0;
+	if(Stream->Job.Caches) for(n=0;n<Stream->nCaches;n++) {
+		Stats->nCacheLookups += Stream->Job.Caches[n].nLookups;
+		Stats->nCacheHits    += Stream->Job.Caches[n].nHits;
+	}
+	Stats->nGridLookups = Stream->HasGrid ? atomic_load(&Stream->Grid.nLookups) : 0;
+	Stats->nGridMisses  = Stream->HasGrid ? atomic_load(&Stream->Grid.nMisses)  : 0;
+	Stats->nGridCells   = Stream->HasGrid ? Stream->Grid.nCells  : 0;
+	Stats->nGridLevels  = Stream->HasGrid ? Stream->Grid.nLevels : 0;
+	Stats->nPaletteColours  = Stream->Ctx->PalSearch.nCols;
+	Stats->nDistinctColours = Stream->Ctx->PalSearch.nDistinct;
+}
+
+/************************************************/
+
+//! Get description of error code
+const char *DitherImage_ErrorString(uint8_t Error) {
+	switch(Error) {
+		case DITHER_OK:            return "Success";
+		case DITHER_ERROR_FORMAT:  return "Invalid source format";
+		case DITHER_ERROR_MEMORY:  return "Out of memory";
+		case DITHER_ERROR_CONTEXT: return "Scratch memory belongs to a different context";
+		case DITHER_ERROR_DITHER:  return "Invalid dither type or threshold matrix";
+		case DITHER_ERROR_ROWS:    return "Too many rows for the stream";
+	}
+	return "Unknown error";
+}
+
+/************************************************/
+
+//! Decode source pixels to RGBA
+void DitherImage_DecodeRow(
+	      uint8_t *Dst,
+	const uint8_t *Src,
+	uint32_t n,
+	uint8_t  SrcFormat,
+	const uint8_t *SrcPalette
+) {
+	DitherKernels->DecodeRow(Dst, Src, n, SrcFormat, SrcPalette);
 }
 
 /************************************************/
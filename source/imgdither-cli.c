@@ -1,12 +1,17 @@
 /************************************************/
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 /************************************************/
 #include "Bitmap.h"
 #include "DitherImage-Colourspace.h"
 #include "DitherImage.h"
+#include "DitherImage-Tables.h"
 /************************************************/
 
 //! strcmp() implementation that ACTUALLY returns the difference between
@@ -67,6 +72,7 @@ static int ParseDitherMode(const char *s, uint8_t *ModePtr, float *LevelPtr) {
 	else if(DITHERMODE_MATCH("ord16"))    Mode = DITHER_ORDERED(4),     Level = 1.0f;
 	else if(DITHERMODE_MATCH("ord32"))    Mode = DITHER_ORDERED(5),     Level = 1.0f;
 	else if(DITHERMODE_MATCH("ord64"))    Mode = DITHER_ORDERED(6),     Level = 1.0f;
+	else if(DITHERMODE_MATCH("matrix"))   Mode = DITHER_MATRIX,         Level = 1.0f;
 	else return -1;
 #undef DITHERMODE_MATCH
 	if(Mode != DITHER_NONE && r == ',') {
@@ -92,6 +98,346 @@ static int ParseClearColour(const char *s, BGRA8_t *Col) {
 	return 0;
 }
 
+//! Load threshold matrix from text file
+//! The file holds the width and height, followed by the rank of each
+//! entry, row by row. Ranks are scaled to thresholds the same way as
+//! for the built-in Bayer matrices (ie. rank/(MaxRank+1) - 0.5), so a
+//! file holding the 8x8 Bayer matrix gives the same output as ord8.
+//! Returns the memory holding the thresholds (to be freed by the
+//! caller), or NULL on failure.
+static float *LoadMatrix(const char *Filename, struct DitherMatrix_t *Matrix) {
+	uint32_t n, Width, Height, MaxRank = 0;
+	FILE *File = fopen(Filename, "r");
+	if(!File) return NULL;
+	if(fscanf(File, "%u %u", &Width, &Height) != 2 || !Width || !Height || Width > 4096 || Height > 4096) {
+		fclose(File);
+		return NULL;
+	}
+	uint32_t *Ranks      = malloc(Width * Height * sizeof(uint32_t));
+	float    *Thresholds = malloc(Width * Height * sizeof(float));
+	if(!Ranks || !Thresholds) goto Fail;
+	for(n=0;n<Width*Height;n++) {
+		if(fscanf(File, "%u", &Ranks[n]) != 1) goto Fail;
+		if(Ranks[n] > MaxRank) MaxRank = Ranks[n];
+	}
+	for(n=0;n<Width*Height;n++) Thresholds[n] = (float)Ranks[n] * (1.0f / ((float)MaxRank + 1.0f)) - 0.5f;
+	free(Ranks);
+	fclose(File);
+	*Matrix = (struct DitherMatrix_t){.Width = Width, .Height = Height, .Thresholds = Thresholds};
+	return Thresholds;
+Fail:
+	free(Thresholds);
+	free(Ranks);
+	fclose(File);
+	return NULL;
+}
+
+//! Print dithering statistics
+static void PrintStats(const struct DitherStats_t *Stats) {
+	if(Stats->nDistinctColours < Stats->nPaletteColours) {
+		printf(
+			"Palette: %u distinct colours (%u duplicates skipped)\n",
+			Stats->nDistinctColours,
+			Stats->nPaletteColours - Stats->nDistinctColours
+		);
+	}
+	if(Stats->nCacheLookups) {
+		printf(
+			"Colour cache: %llu/%llu hits (%.1f%%)\n",
+			(unsigned long long)Stats->nCacheHits,
+			(unsigned long long)Stats->nCacheLookups,
+			Stats->nCacheHits * 100.0 / Stats->nCacheLookups
+		);
+	}
+	if(Stats->nGridCells) {
+		printf(
+			"Lookup grid: %u^3 cells x %u levels, %llu/%llu misses (%.2f%%)\n",
+			Stats->nGridCells,
+			Stats->nGridLevels,
+			(unsigned long long)Stats->nGridMisses,
+			(unsigned long long)Stats->nGridLookups,
+			Stats->nGridLookups ? Stats->nGridMisses * 100.0 / Stats->nGridLookups : 0.0
+		);
+	}
+}
+
+/************************************************/
+
+//! Blocks of rows in flight when pipelining
+//! The reader can run this many blocks ahead of the writer.
+#define PIPELINE_BLOCKS 4
+
+//! Streaming pipeline
+//! Blocks of rows pass through three stages (read, dither, write), in
+//! order. Each stage publishes how many blocks it has completed, and
+//! block n lives in slot n % nSlots, so the slots form a bounded ring
+//! between the stages, without any locking: the reader may only fill
+//! a slot once the writer has finished with its previous block.
+struct Pipeline_t {
+	struct BmpReader_t    *Reader;
+	struct BmpWriter_t    *Writer;
+	struct DitherStream_t *Stream;
+	uint32_t    BandRows;
+	uint32_t    nBlocks;
+	uint32_t    nSlots;
+	BGRA8_t    *Src[PIPELINE_BLOCKS];    //! Source rows
+	uint8_t    *Dst[PIPELINE_BLOCKS];    //! Output rows
+	atomic_uint nRead, nDithered, nWritten;
+	atomic_uint Failed;
+	double      ReadTime, DitherTime, WriteTime; //! Time spent in each stage (seconds)
+};
+
+//! Get time in seconds
+static double GetTime(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1.0e-9;
+}
+
+//! Wait until Counter reaches n
+//! Returns 0 if another stage failed.
+static uint8_t PipelineWait(struct Pipeline_t *Pipe, atomic_uint *Counter, uint32_t n) {
+	while(atomic_load_explicit(Counter, memory_order_acquire) < n) {
+		if(atomic_load_explicit(&Pipe->Failed, memory_order_relaxed)) return 0;
+		sched_yield();
+	}
+	return 1;
+}
+
+//! Get rows of block n
+static uint32_t PipelineRows(const struct Pipeline_t *Pipe, uint32_t n, uint32_t *y) {
+	*y = n * Pipe->BandRows;
+	return (Pipe->Reader->Height - *y < Pipe->BandRows) ? (Pipe->Reader->Height - *y) : Pipe->BandRows;
+}
+
+//! Stage: Read block n
+static uint8_t PipelineRead(struct Pipeline_t *Pipe, uint32_t n) {
+	uint32_t y, nRows = PipelineRows(Pipe, n, &y);
+	BGRA8_t *Src = Pipe->Src[n % Pipe->nSlots];
+	double t = GetTime();
+	if(!BmpReader_ReadRows(Pipe->Reader, Src, y, nRows)) {
+		printf("ERROR: Unable to read input file.\n");
+		return 0;
+	}
+	Pipe->ReadTime += GetTime() - t;
+	return 1;
+}
+
+//! Stage: Dither block n
+static uint8_t PipelineDither(struct Pipeline_t *Pipe, uint32_t n) {
+	uint32_t y, nRows = PipelineRows(Pipe, n, &y);
+	double t = GetTime();
+	uint8_t Error = DitherStream_RowsEx(
+		Pipe->Stream,
+		Pipe->Dst[n % Pipe->nSlots],
+		(const uint8_t*)Pipe->Src[n % Pipe->nSlots],
+		0,
+		DITHER_FORMAT_BGRA,
+		NULL,
+		nRows
+	);
+	if(Error != DITHER_OK) {
+		printf("ERROR: Unable to dither image (%s).\n", DitherImage_ErrorString(Error));
+		return 0;
+	}
+	Pipe->DitherTime += GetTime() - t;
+	return 1;
+}
+
+//! Stage: Write block n
+static uint8_t PipelineWrite(struct Pipeline_t *Pipe, uint32_t n) {
+	uint32_t y, nRows = PipelineRows(Pipe, n, &y);
+	double t = GetTime();
+	if(!BmpWriter_WriteRows(Pipe->Writer, Pipe->Dst[n % Pipe->nSlots], y, nRows)) {
+		printf("ERROR: Unable to write output file.\n");
+		return 0;
+	}
+	Pipe->WriteTime += GetTime() - t;
+	return 1;
+}
+
+//! Reader thread
+static void *PipelineReaderThread(void *Arg) {
+	struct Pipeline_t *Pipe = (struct Pipeline_t*)Arg;
+	uint32_t n;
+	for(n=0;n<Pipe->nBlocks;n++) {
+		if(n >= Pipe->nSlots && !PipelineWait(Pipe, &Pipe->nWritten, n - Pipe->nSlots + 1)) break;
+		if(!PipelineRead(Pipe, n)) {
+			atomic_store_explicit(&Pipe->Failed, 1, memory_order_relaxed);
+			break;
+		}
+		atomic_store_explicit(&Pipe->nRead, n+1, memory_order_release);
+	}
+	return NULL;
+}
+
+//! Writer thread
+static void *PipelineWriterThread(void *Arg) {
+	struct Pipeline_t *Pipe = (struct Pipeline_t*)Arg;
+	uint32_t n;
+	for(n=0;n<Pipe->nBlocks;n++) {
+		if(!PipelineWait(Pipe, &Pipe->nDithered, n+1)) break;
+		if(!PipelineWrite(Pipe, n)) {
+			atomic_store_explicit(&Pipe->Failed, 1, memory_order_relaxed);
+			break;
+		}
+		atomic_store_explicit(&Pipe->nWritten, n+1, memory_order_release);
+	}
+	return NULL;
+}
+
+//! Dither image in bands of BandRows rows, streaming from and to file
+//! Only a few bands of the input and output are held in memory. When
+//! UseThreads is set, reading and writing run on their own threads,
+//! overlapping with dithering on the calling thread (and the pool).
+static int StreamImage(
+	const char    *InputFilename,
+	const char    *OutputFilename,
+	const BGRA8_t *OutputPalette,
+	const uint8_t *Palette, //! RGBA
+	uint32_t nPaletteColours,
+	uint32_t BandRows,
+	uint8_t  UseThreads,
+	uint8_t  DitherType,
+	float    DitherLevel,
+	const struct DitherMatrix_t *Matrix,
+	uint8_t  Colourspace,
+	uint8_t  PremultipliedAlpha,
+	uint32_t nThreads,
+	size_t   GridMemory,
+	uint32_t Flags,
+	const uint8_t *ClearColour //! RGB
+) {
+	int ExitCode = -1;
+	uint32_t n;
+
+	//! Open input and output files
+	struct BmpReader_t Reader;
+	if(!BmpReader_Open(&Reader, InputFilename)) {
+		printf("ERROR: Unable to read input file.\n");
+		return -1;
+	}
+	//! Reject empty images (which have no bands), and sizes that can't
+	//! be stored in the (signed) fields of the output file
+	if(!Reader.Width || !Reader.Height || Reader.Width > INT32_MAX || Reader.Height > INT32_MAX) {
+		printf("ERROR: Invalid input image size (%ux%u).\n", Reader.Width, Reader.Height);
+		BmpReader_Close(&Reader);
+		return -1;
+	}
+
+	//! Colour 0 of palettized input is clear, but rows are expanded
+	//! through the palette when read, so mark it by its alpha instead
+	if(Reader.PaletteCount && (Flags & DITHER_FLAG_CLEAR0)) Reader.Palette[0].a = 0;
+	struct BmpWriter_t Writer;
+	if(!BmpWriter_Open(&Writer, OutputFilename, Reader.Width, Reader.Height, OutputPalette)) {
+		printf("ERROR: Unable to write output file.\n");
+		BmpReader_Close(&Reader);
+		return -1;
+	}
+
+	//! Allocate blocks and dither context
+	if(BandRows > Reader.Height) BandRows = Reader.Height;
+	struct Pipeline_t Pipe = {
+		.Reader     = &Reader,
+		.Writer     = &Writer,
+		.BandRows   = BandRows,
+		.nBlocks    = BandRows ? (uint32_t)(((uint64_t)Reader.Height + BandRows-1) / BandRows) : 0,
+		.nSlots     = UseThreads ? PIPELINE_BLOCKS : 1,
+		.ReadTime   = 0.0,
+		.DitherTime = 0.0,
+		.WriteTime  = 0.0,
+	};
+	atomic_init(&Pipe.nRead,     0);
+	atomic_init(&Pipe.nDithered, 0);
+	atomic_init(&Pipe.nWritten,  0);
+	atomic_init(&Pipe.Failed,    0);
+	uint8_t Ok = 1;
+	for(n=0;n<Pipe.nSlots;n++) {
+		Pipe.Src[n] = malloc((size_t)Reader.Width * BandRows * sizeof(BGRA8_t));
+		Pipe.Dst[n] = malloc((size_t)Reader.Width * BandRows);
+		if(!Pipe.Src[n] || !Pipe.Dst[n]) Ok = 0;
+	}
+	Pipe.Stream = DitherStream_Create(
+		Palette,
+		Reader.Width,
+		BandRows,
+		DitherType,
+		DitherLevel,
+		Matrix,
+		Colourspace,
+		PremultipliedAlpha,
+		nPaletteColours,
+		nThreads,
+		GridMemory,
+		Flags,
+		ClearColour
+	);
+	if(!Ok || !Pipe.Stream) {
+		printf("ERROR: Out of memory for streaming.\n");
+		goto Exit;
+	}
+
+	//! Process blocks
+	double t = GetTime();
+	if(UseThreads) {
+		pthread_t ReaderThread, WriterThread;
+		if(pthread_create(&ReaderThread, NULL, PipelineReaderThread, &Pipe) != 0) {
+			printf("ERROR: Unable to create reader thread.\n");
+			goto Exit;
+		}
+		if(pthread_create(&WriterThread, NULL, PipelineWriterThread, &Pipe) != 0) {
+			printf("ERROR: Unable to create writer thread.\n");
+			atomic_store(&Pipe.Failed, 1);
+			pthread_join(ReaderThread, NULL);
+			goto Exit;
+		}
+		for(n=0;n<Pipe.nBlocks;n++) {
+			if(!PipelineWait(&Pipe, &Pipe.nRead, n+1)) break;
+			if(!PipelineDither(&Pipe, n)) {
+				atomic_store_explicit(&Pipe.Failed, 1, memory_order_relaxed);
+				break;
+			}
+			atomic_store_explicit(&Pipe.nDithered, n+1, memory_order_release);
+		}
+		pthread_join(ReaderThread, NULL);
+		pthread_join(WriterThread, NULL);
+		if(atomic_load(&Pipe.Failed)) goto Exit;
+	} else {
+		for(n=0;n<Pipe.nBlocks;n++) {
+			if(!PipelineRead  (&Pipe, n)) goto Exit;
+			if(!PipelineDither(&Pipe, n)) goto Exit;
+			if(!PipelineWrite (&Pipe, n)) goto Exit;
+		}
+	}
+	t = GetTime() - t;
+	printf(
+		"Streaming: read %.0fms, dither %.0fms, write %.0fms, total %.0fms\n",
+		Pipe.ReadTime*1000.0, Pipe.DitherTime*1000.0, Pipe.WriteTime*1000.0, t*1000.0
+	);
+	struct DitherStats_t Stats;
+	DitherStream_GetStats(Pipe.Stream, &Stats);
+	PrintStats(&Stats);
+	ExitCode = 0;
+
+Exit:
+	if(Pipe.Stream) DitherStream_Destroy(Pipe.Stream);
+	for(n=0;n<Pipe.nSlots;n++) {
+		free(Pipe.Dst[n]);
+		free(Pipe.Src[n]);
+	}
+	BmpReader_Close(&Reader);
+	if(!BmpWriter_Close(&Writer) && ExitCode == 0) {
+		printf("ERROR: Unable to write output file.\n");
+		ExitCode = -1;
+	}
+
+	//! Don't leave a partly written output file behind
+	if(ExitCode != 0) remove(OutputFilename);
+	return ExitCode;
+}
+
+/************************************************/
+
 int main(int argc, const char *argv[]) {
 	//! Check arguments
 	if(argc < 4) {
@@ -118,11 +464,42 @@ int main(int argc, const char *argv[]) {
 			"                         To set transparency in a direct-colour input bitmap,\n"
 			"                         an alpha channel must be used (ie. 32-bit input);\n"
 			"                         translucent alpha values are supported by this tool.\n"
+			"                         Only transparent pixels are given the first colour.\n"
 			"  -clearcol:none       - Set colour of transparent pixels. Note that as long\n"
 			"                         as the RGB values match the clear colour, then the\n"
 			"                         pixel will be made fully transparent, regardless of\n"
 			"                         any alpha information.\n"
 			"                         Can be `none`, or a `#RRGGBB` hex triad.\n"
+			"  -matrix:file.txt     - Load threshold matrix for `-dither:matrix`\n"
+			"                         The file holds the width and height, and then the\n"
+			"                         rank of each entry (eg. 0..63 for an 8x8 matrix).\n"
+			"                         Any size works, so blue-noise masks can be used.\n"
+			"  -threads:0           - Number of threads to use (0 = one per CPU core)\n"
+			"                         The output does not depend on the thread count.\n"
+			"  -tiles:0             - Tile size for approximate diffusion (0 = exact)\n"
+			"                         Diffusing tiles independently scales better over\n"
+			"                         many threads, but gives slightly different output.\n"
+			"  -grid:0[,check]      - Lookup grid memory for ordered dithers, in MiB\n"
+			"                         (0 = exact). Results are computed once per colour\n"
+			"                         cell and threshold, which is much faster but only\n"
+			"                         approximates exact dithering. `check` reports the\n"
+			"                         number of output pixels that differ from exact.\n"
+			"  -rgbtable:n          - Build a full 24-bit colour conversion table (y/n)\n"
+			"                         This uses 192MiB of memory, and only pays off for\n"
+			"                         large images in the slower colourspaces.\n"
+			"  -stream:0            - Rows per band for streaming (0 = whole image)\n"
+			"                         When set, the image is read, dithered and written a\n"
+			"                         band at a time, so that memory use does not depend\n"
+			"                         on the image height. The output is unaffected.\n"
+			"  -pipeline:n          - Overlap reading, dithering and writing (y/n)\n"
+			"                         Reading and writing run on their own threads, so\n"
+			"                         that I/O is hidden behind dithering. This implies\n"
+			"                         -stream (with 256 rows per band, unless given).\n"
+			"  -fastmath:n          - Use approximate colour conversion (y/n/check)\n"
+			"                         This speeds up CIELAB, OkLab and the Psyopt modes,\n"
+			"                         at the cost of tiny colour errors. `check` enables\n"
+			"                         it and reports the number of output pixels that\n"
+			"                         differ from exact conversion.\n"
 			"Colourspaces available:\n"
 			"  srgb\n"
 			"  rgb-psy      (Psy = Non-linear light, weighted components)\n"
@@ -143,14 +520,25 @@ int main(int argc, const char *argv[]) {
 			"  ord16,1.0    - 16x16 ordered dithering\n"
 			"  ord32,1.0    - 32x32 ordered dithering\n"
 			"  ord64,1.0    - 64x64 ordered dithering\n"
+			"  matrix,1.0   - Ordered dithering with a custom matrix (see -matrix)\n"
 		);
 		return 1;
 	}
 	uint8_t FirstColourIsTransparent = 1;
+	BGRA8_t ClearColour          = {.b = 0, .g = 0, .r = 0, .a = 0};
 	uint8_t PremultipliedAlpha   = 0;
 	uint8_t DitherType           = DITHER_FLOYDSTEINBERG;
 	float DitherLevel          = 0.5f;
 	uint8_t Colourspace          = COLOURSPACE_YCBCR_PSY;
+	uint32_t nThreads            = 0;
+	uint32_t DiffuseTileSize     = 0;
+	uint32_t GridMiB             = 0;
+	uint8_t  GridCheck           = 0;
+	uint8_t  UseRGBTable         = 0;
+	uint8_t  FastMath            = 0; //! 0 = Off, 1 = On, 2 = On + check
+	uint32_t StreamRows          = 0;
+	uint8_t  Pipelined           = 0;
+	const char *MatrixFilename   = NULL;
 
 	{
 		int argi;
@@ -175,19 +563,52 @@ int main(int argc, const char *argv[]) {
 				ArgOk = 1;
 			}
 			ARGMATCH(argv[argi], "-col0isclear:")  ArgOk = 1, FirstColourIsTransparent = (ArgStr[0] == 'y') ? 1 : 0;
+			ARGMATCH(argv[argi], "-clearcol:") {
+				if(ParseClearColour(ArgStr, &ClearColour) == -1) {
+					printf("WARNING: Unrecognized clear colour: %s\n", ArgStr);
+				}
+				ArgOk = 1;
+			}
+			ARGMATCH(argv[argi], "-matrix:")     ArgOk = 1, MatrixFilename = ArgStr;
+			ARGMATCH(argv[argi], "-threads:") {
+				int n = atoi(ArgStr);
+				if(n >= 0) nThreads = (uint32_t)n;
+				else printf("WARNING: Invalid thread count: %s\n", ArgStr);
+				ArgOk = 1;
+			}
+			ARGMATCH(argv[argi], "-rgbtable:")    ArgOk = 1, UseRGBTable = (ArgStr[0] == 'y') ? 1 : 0;
+			ARGMATCH(argv[argi], "-fastmath:") {
+				     if(!strcmp(ArgStr, "check")) FastMath = 2;
+				else if(ArgStr[0] == 'y')         FastMath = 1;
+				else                              FastMath = 0;
+				ArgOk = 1;
+			}
+			ARGMATCH(argv[argi], "-stream:") {
+				int n = atoi(ArgStr);
+				if(n >= 0) StreamRows = (uint32_t)n;
+				else printf("WARNING: Invalid band size: %s\n", ArgStr);
+				ArgOk = 1;
+			}
+			ARGMATCH(argv[argi], "-pipeline:")   ArgOk = 1, Pipelined = (ArgStr[0] == 'y') ? 1 : 0;
+			ARGMATCH(argv[argi], "-tiles:") {
+				int n = atoi(ArgStr);
+				if(n >= 0) DiffuseTileSize = (uint32_t)n;
+				else printf("WARNING: Invalid tile size: %s\n", ArgStr);
+				ArgOk = 1;
+			}
+			ARGMATCH(argv[argi], "-grid:") {
+				int n = atoi(ArgStr);
+				if(n >= 0) GridMiB = (uint32_t)n;
+				else printf("WARNING: Invalid grid size: %s\n", ArgStr);
+				GridCheck = (strstr(ArgStr, ",check") != NULL);
+				ArgOk = 1;
+			}
 #undef ARGMATCH
 			//! Unrecognized?
 			if(!ArgOk) printf("WARNING: Unrecognized argument: %s\n", argv[argi]);
 		}
 	}
 
-	//! Open input image
-	struct BmpCtx_t Image;
-	if(!BmpCtx_FromFile(&Image, argv[1])) {
-		printf("ERROR: Unable to read input file.\n");
-		return -1;
-	}
-
 	//! Open palette image
 	struct BmpCtx_t PaletteImage;
 	if(!BmpCtx_FromFile(&PaletteImage, argv[2])) {
@@ -195,21 +616,11 @@ int main(int argc, const char *argv[]) {
 		return -1;
 	}
 
-	//! Create output image
-	struct BmpCtx_t Output;
-	if(!BmpCtx_Create(&Output, Image.Width, Image.Height, 1)) {
-		printf("ERROR: Couldn't create output image.\n");
-		BmpCtx_Destroy(&Image);
-		return -1;
-	}
-
 	//! Get palette colour count from loaded BMP
 	uint32_t nPaletteColours = PaletteImage.PaletteCount;
 	if(nPaletteColours == 0) {
 		fprintf(stderr, "ERROR: Palette image must be 8-bit palettized BMP.\n");
-		BmpCtx_Destroy(&Image);
 		BmpCtx_Destroy(&PaletteImage);
-		BmpCtx_Destroy(&Output);
 		return -1;
 	}
 	printf("Using palette with %u colours\n", nPaletteColours);
@@ -219,9 +630,7 @@ int main(int argc, const char *argv[]) {
 	uint8_t *palBytes = malloc(nPaletteBytes);
 	if(!palBytes) {
 		fprintf(stderr, "ERROR: out of memory (palBytes)\n");
-		BmpCtx_Destroy(&Image);
 		BmpCtx_Destroy(&PaletteImage);
-		BmpCtx_Destroy(&Output);
 		return -1;
 	}
 
@@ -234,43 +643,116 @@ int main(int argc, const char *argv[]) {
 		palBytes[i*4 + 3] = c.a; /* A */
 	}
 
-	/* Convert input image to RGBA format for DitherPaletteImage */
-	uint32_t nPixels = Image.Width * Image.Height;
-	uint8_t *srcRGBA = malloc(nPixels * 4);
-	if(!srcRGBA) {
-		fprintf(stderr, "ERROR: out of memory (srcRGBA)\n");
+	//! Load threshold matrix
+	struct DitherMatrix_t Matrix = {.Width = 0, .Height = 0, .Thresholds = NULL};
+	float *MatrixMem = NULL;
+	if(DitherType == DITHER_MATRIX && (!MatrixFilename || !(MatrixMem = LoadMatrix(MatrixFilename, &Matrix)))) {
+		printf("ERROR: Unable to load threshold matrix (see -matrix).\n");
 		free(palBytes);
-		BmpCtx_Destroy(&Image);
 		BmpCtx_Destroy(&PaletteImage);
-		BmpCtx_Destroy(&Output);
 		return -1;
 	}
 
-	/* Check if input is palettized or direct color */
-	if(Image.Palette) {
-		/* Palettized input - convert indices to RGBA */
-		uint8_t *indices = Image.PxIdx;
-		for(uint32_t i = 0; i < nPixels; ++i) {
-			BGRA8_t c = Image.Palette[indices[i]];
-			srcRGBA[i*4 + 0] = c.r; /* R */
-			srcRGBA[i*4 + 1] = c.g; /* G */
-			srcRGBA[i*4 + 2] = c.b; /* B */
-			srcRGBA[i*4 + 3] = c.a; /* A */
-		}
-	} else {
-		/* Direct color input - convert from BGRA to RGBA */
-		BGRA8_t *bgra = Image.PxBGR;
-		for(uint32_t i = 0; i < nPixels; ++i) {
-			srcRGBA[i*4 + 0] = bgra[i].r; /* R */
-			srcRGBA[i*4 + 1] = bgra[i].g; /* G */
-			srcRGBA[i*4 + 2] = bgra[i].b; /* B */
-			srcRGBA[i*4 + 3] = bgra[i].a; /* A */
-		}
+	//! Get dithering flags and clear colour
+	uint32_t Flags = 0;
+	if(FastMath)                 Flags |= DITHER_FLAG_FASTMATH;
+	if(FirstColourIsTransparent) Flags |= DITHER_FLAG_CLEAR0;
+	uint8_t ClearRGB[3] = {ClearColour.r, ClearColour.g, ClearColour.b};
+	const uint8_t *ClearRGBPtr = ClearColour.a ? ClearRGB : NULL;
+	size_t GridMemory = (size_t)GridMiB << 20;
+
+	if(UseRGBTable && !ColourTables_CreateRGB(Colourspace, nThreads)) {
+		printf("WARNING: Unable to create colour conversion table.\n");
+	}
+
+	//! Stream the image in bands?
+	if(Pipelined && !StreamRows) StreamRows = 256;
+	if(StreamRows) {
+		if(DiffuseTileSize) printf("WARNING: Tiled diffusion is not available when streaming.\n");
+		if(FastMath == 2)   printf("WARNING: Fast-math check is not available when streaming.\n");
+		if(GridCheck)       printf("WARNING: Grid check is not available when streaming.\n");
+		int ExitCode = StreamImage(
+			argv[1],
+			argv[3],
+			PaletteImage.Palette,
+			palBytes,
+			nPaletteColours,
+			StreamRows,
+			Pipelined,
+			DitherType,
+			DitherLevel,
+			&Matrix,
+			Colourspace,
+			PremultipliedAlpha,
+			nThreads,
+			GridMemory,
+			Flags,
+			ClearRGBPtr
+		);
+		free(palBytes);
+		free(MatrixMem);
+		BmpCtx_Destroy(&PaletteImage);
+		return ExitCode;
+	}
+
+	//! Map input image
+	//! The pixels are dithered straight from the mapped file.
+	struct BmpView_t Image;
+	if(!BmpView_Open(&Image, argv[1])) {
+		printf("ERROR: Unable to read input file.\n");
+		free(palBytes);
+		free(MatrixMem);
+		BmpCtx_Destroy(&PaletteImage);
+		return -1;
+	}
+
+	//! Create output image
+	struct BmpCtx_t Output;
+	if(!BmpCtx_Create(&Output, Image.Width, Image.Height, 1)) {
+		printf("ERROR: Couldn't create output image.\n");
+		free(palBytes);
+		free(MatrixMem);
+		BmpView_Close(&Image);
+		BmpCtx_Destroy(&PaletteImage);
+		return -1;
+	}
+
+	//! Get source format
+	//! Palettized images index into an RGBA copy of their palette.
+	uint8_t SrcFormat;
+	uint8_t SrcPalette[BMP_PALETTE_COLOURS*4];
+	size_t nPixels = (size_t)Image.Width * Image.Height;
+	switch(Image.BitCnt) {
+		case 8: {
+			SrcFormat = DITHER_FORMAT_INDEXED;
+			for(uint32_t i = 0; i < BMP_PALETTE_COLOURS; ++i) {
+				BGRA8_t c = Image.Palette[i];
+				SrcPalette[i*4 + 0] = c.r; /* R */
+				SrcPalette[i*4 + 1] = c.g; /* G */
+				SrcPalette[i*4 + 2] = c.b; /* B */
+				SrcPalette[i*4 + 3] = c.a; /* A */
+			}
+		} break;
+		case 24: SrcFormat = DITHER_FORMAT_BGR; break;
+		default: SrcFormat = Image.AlphaUnused ? DITHER_FORMAT_BGRX : DITHER_FORMAT_BGRA; break;
 	}
 
-	DitherPaletteImage(
+	struct DitherStats_t Stats;
+	struct DitherOptions_t Options = {
+		.SrcStride       = Image.Stride,
+		.SrcFormat       = SrcFormat,
+		.SrcPalette      = SrcPalette,
+		.Matrix          = &Matrix,
+		.Flags           = Flags,
+		.nThreads        = nThreads,
+		.DiffuseTileSize = DiffuseTileSize,
+		.GridMemory      = GridMemory,
+		.ClearColour     = ClearRGBPtr,
+		.Stats           = &Stats,
+	};
+	uint8_t Error = DitherPaletteImageEx(
 		Output.PxIdx,
-		srcRGBA,
+		Image.Px,
 		palBytes,
 		Image.Width,
 		Image.Height,
@@ -278,12 +760,83 @@ int main(int argc, const char *argv[]) {
 		DitherLevel,
 		Colourspace,
 		PremultipliedAlpha,
-		nPaletteColours
+		nPaletteColours,
+		&Options
 	);
+	if(Error != DITHER_OK) {
+		printf("ERROR: Unable to dither image (%s).\n", DitherImage_ErrorString(Error));
+		free(palBytes);
+		free(MatrixMem);
+		BmpView_Close(&Image);
+		BmpCtx_Destroy(&PaletteImage);
+		BmpCtx_Destroy(&Output);
+		return -1;
+	}
+	PrintStats(&Stats);
+
+	//! Compare fast-math against exact conversion
+	if(FastMath == 2) {
+		uint8_t *ExactPxIdx = malloc(nPixels);
+		if(ExactPxIdx) {
+			struct DitherOptions_t ExactOptions = Options;
+			ExactOptions.Flags &= ~DITHER_FLAG_FASTMATH;
+			ExactOptions.Stats  = NULL;
+			DitherPaletteImageEx(
+				ExactPxIdx,
+				Image.Px,
+				palBytes,
+				Image.Width,
+				Image.Height,
+				DitherType,
+				DitherLevel,
+				Colourspace,
+				PremultipliedAlpha,
+				nPaletteColours,
+				&ExactOptions
+			);
+			size_t i, nChanged = 0;
+			for(i=0;i<nPixels;i++) nChanged += (ExactPxIdx[i] != Output.PxIdx[i]);
+			printf(
+				"Fast-math: %llu/%llu output pixels differ from exact (%.3f%%)\n",
+				(unsigned long long)nChanged, (unsigned long long)nPixels, nChanged * 100.0 / nPixels
+			);
+			free(ExactPxIdx);
+		} else printf("WARNING: Out of memory for fast-math check.\n");
+	}
+
+	//! Compare lookup grid against exact dithering
+	if(GridCheck && Stats.nGridCells) {
+		uint8_t *ExactPxIdx = malloc(nPixels);
+		if(ExactPxIdx) {
+			struct DitherOptions_t ExactOptions = Options;
+			ExactOptions.GridMemory = 0;
+			ExactOptions.Stats      = NULL;
+			DitherPaletteImageEx(
+				ExactPxIdx,
+				Image.Px,
+				palBytes,
+				Image.Width,
+				Image.Height,
+				DitherType,
+				DitherLevel,
+				Colourspace,
+				PremultipliedAlpha,
+				nPaletteColours,
+				&ExactOptions
+			);
+			size_t i, nChanged = 0;
+			for(i=0;i<nPixels;i++) nChanged += (ExactPxIdx[i] != Output.PxIdx[i]);
+			printf(
+				"Lookup grid: %llu/%llu output pixels differ from exact (%.3f%%)\n",
+				(unsigned long long)nChanged, (unsigned long long)nPixels, nChanged * 100.0 / nPixels
+			);
+			free(ExactPxIdx);
+		} else printf("WARNING: Out of memory for grid check.\n");
+	} else if(GridCheck) printf("WARNING: Lookup grid was not used, so there is nothing to check.\n");
 
-	free(srcRGBA);
 	free(palBytes);
-	BmpCtx_Destroy(&Image);
+	free(MatrixMem);
+	BmpView_Close(&Image);
 
 	//! Copy palette to output image
 	memcpy(Output.Palette, PaletteImage.Palette, BMP_PALETTE_COLOURS * sizeof(BGRA8_t));
@@ -0,0 +1,483 @@
+/************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+/************************************************/
+#include "Bitmap.h"
+#include "DitherImage-Colourspace.h"
+#include "DitherImage-Kernels.h"
+#include "DitherImage-ThreadPool.h"
+#include "DitherImage.h"
+/************************************************/
+
+//! Regression checks for `make check`
+//! Usage: imgdither-check [CorpusDirectory]
+//! Returns 0 if every check passes, or 1 if any of them fails.
+
+/************************************************/
+
+//! Colourspaces to check, with their fast-math bounds
+//! MaxError[] bounds the conversion error over all 2^24 opaque RGB
+//! colours (see FastMathError()), and MaxChanged bounds the number of
+//! palette indices over the whole corpus that differ between fast-math
+//! and exact conversion.
+//! NOTE: These are the measured values with a little headroom, so
+//! that any loss of accuracy in the approximations is caught. If an
+//! approximation is made more accurate, tighten the bounds to match.
+//! NOTE: Colourspaces with zero bounds have nothing to approximate
+//! (sRGB linearisation is always tabulated, and the only other
+//! non-linearity of ICtCp is sqrtf()), so they must stay exact.
+static const struct {
+	const char *Name;
+	uint8_t  Colourspace;
+	float    MaxError[3];
+	uint32_t MaxChanged;
+} FastMathBounds[] = {
+	{"srgb",       COLOURSPACE_SRGB,       {0.0f,    0.0f,    0.0f   }, 0},
+	{"rgb-linear", COLOURSPACE_RGB_LINEAR, {0.0f,    0.0f,    0.0f   }, 0},
+	{"ycbcr",      COLOURSPACE_YCBCR,      {0.0f,    0.0f,    0.0f   }, 0},
+	{"ycocg",      COLOURSPACE_YCOCG,      {0.0f,    0.0f,    0.0f   }, 0},
+	{"cielab",     COLOURSPACE_CIELAB,     {2.0e-6f, 8.0e-6f, 4.0e-6f}, 4},
+	{"ictcp",      COLOURSPACE_ICTCP,      {0.0f,    0.0f,    0.0f   }, 0},
+	{"oklab",      COLOURSPACE_OKLAB,      {2.0e-6f, 4.0e-6f, 2.0e-6f}, 4},
+	{"rgb-psy",    COLOURSPACE_RGB_PSY,    {0.0f,    0.0f,    0.0f   }, 0},
+	{"ycbcr-psy",  COLOURSPACE_YCBCR_PSY,  {4.0e-7f, 0.0f,    0.0f   }, 2},
+	{"ycocg-psy",  COLOURSPACE_YCOCG_PSY,  {4.0e-7f, 0.0f,    0.0f   }, 2},
+};
+#define N_COLOURSPACES (sizeof(FastMathBounds) / sizeof(FastMathBounds[0]))
+
+//! Corpus images and palettes (in the corpus directory)
+static const char *const CorpusImages[] = {
+	"photo24.bmp",
+	"sprite32.bmp",
+};
+static const char *const CorpusPalettes[] = {
+	"pal16.bmp",
+	"pal256.bmp",
+};
+#define N_CORPUS_IMAGES   (sizeof(CorpusImages)   / sizeof(CorpusImages[0]))
+#define N_CORPUS_PALETTES (sizeof(CorpusPalettes) / sizeof(CorpusPalettes[0]))
+
+//! Dither modes that every corpus image is checked with
+static const struct {
+	uint8_t DitherType;
+	float   DitherLevel;
+} CorpusDithers[] = {
+	{DITHER_NONE,           0.0f},
+	{DITHER_FLOYDSTEINBERG, 0.5f},
+	{DITHER_ORDERED(3),     1.0f},
+};
+#define N_CORPUS_DITHERS (sizeof(CorpusDithers) / sizeof(CorpusDithers[0]))
+
+/************************************************/
+
+//! Corpus image or palette, loaded to RGBA
+struct CorpusFile_t {
+	uint32_t Width, Height;
+	uint32_t nColours; //! Palettes only
+	uint8_t *Data;     //! RGBA pixels (images) or colours (palettes)
+};
+
+//! Load a corpus file
+//! Returns 0 on failure, or 1 on success.
+static uint8_t CorpusFile_Load(struct CorpusFile_t *File, const char *Dir, const char *Name, uint8_t IsPalette) {
+	uint32_t i, n;
+	char Filename[1024];
+	struct BmpCtx_t Bmp;
+	snprintf(Filename, sizeof(Filename), "%s/%s", Dir, Name);
+	if(!BmpCtx_FromFile(&Bmp, Filename)) {
+		printf("ERROR: Unable to load %s.\n", Filename);
+		return 0;
+	}
+	if(IsPalette != (Bmp.PaletteCount != 0)) {
+		printf("ERROR: %s is not %s.\n", Filename, IsPalette ? "a palette" : "a direct-colour image");
+		BmpCtx_Destroy(&Bmp);
+		return 0;
+	}
+
+	//! Convert to RGBA
+	const BGRA8_t *Src = IsPalette ? Bmp.Palette : Bmp.PxBGR;
+	n = IsPalette ? Bmp.PaletteCount : Bmp.Width*Bmp.Height;
+	File->Width    = Bmp.Width;
+	File->Height   = Bmp.Height;
+	File->nColours = Bmp.PaletteCount;
+	File->Data     = malloc(n * 4);
+	if(!File->Data) {
+		printf("ERROR: Out of memory.\n");
+		BmpCtx_Destroy(&Bmp);
+		return 0;
+	}
+	for(i=0;i<n;i++) {
+		File->Data[i*4+0] = Src[i].r;
+		File->Data[i*4+1] = Src[i].g;
+		File->Data[i*4+2] = Src[i].b;
+		File->Data[i*4+3] = Src[i].a;
+	}
+	BmpCtx_Destroy(&Bmp);
+	return 1;
+}
+
+//! Corpus images and palettes, loaded to RGBA
+struct Corpus_t {
+	struct CorpusFile_t Images  [N_CORPUS_IMAGES];
+	struct CorpusFile_t Palettes[N_CORPUS_PALETTES];
+	uint32_t MaxPixels; //! Largest image
+};
+
+//! Load all corpus files
+//! Returns 0 on failure, or 1 on success.
+//! NOTE: The corpus must be destroyed even on failure.
+static uint8_t Corpus_Load(struct Corpus_t *Corpus, const char *Dir) {
+	uint32_t i;
+	uint8_t Loaded = 1;
+	Corpus->MaxPixels = 0;
+	for(i=0;i<N_CORPUS_IMAGES;i++) {
+		struct CorpusFile_t *Image = &Corpus->Images[i];
+		Image->Data = NULL;
+		if(!CorpusFile_Load(Image, Dir, CorpusImages[i], 0)) Loaded = 0;
+		else if(Image->Width*Image->Height > Corpus->MaxPixels) Corpus->MaxPixels = Image->Width*Image->Height;
+	}
+	for(i=0;i<N_CORPUS_PALETTES;i++) {
+		Corpus->Palettes[i].Data = NULL;
+		if(!CorpusFile_Load(&Corpus->Palettes[i], Dir, CorpusPalettes[i], 1)) Loaded = 0;
+	}
+	return Loaded;
+}
+
+//! Destroy corpus
+static void Corpus_Destroy(struct Corpus_t *Corpus) {
+	uint32_t i;
+	for(i=0;i<N_CORPUS_IMAGES;  i++) free(Corpus->Images[i].Data);
+	for(i=0;i<N_CORPUS_PALETTES;i++) free(Corpus->Palettes[i].Data);
+}
+
+/************************************************/
+
+//! Fast-math error measurement job
+struct FastMathErrorJob_t {
+	const struct DitherKernels_t *Kernels;
+	uint8_t Colourspace;
+	float (*MaxError)[3]; //! Per thread
+};
+
+//! Thread pool job: Measure error for all colours with a given value of B
+static void FastMathErrorJob(void *Arg, uint32_t b, uint32_t Thread) {
+	const struct FastMathErrorJob_t *Job = (const struct FastMathErrorJob_t*)Arg;
+	uint32_t c, r, g;
+	uint8_t Src[256*4];
+	float   Exact [4][256], *const pExact [4] = {Exact [0], Exact [1], Exact [2], Exact [3]};
+	float   Approx[4][256], *const pApprox[4] = {Approx[0], Approx[1], Approx[2], Approx[3]};
+	float  *MaxError = Job->MaxError[Thread];
+	for(g=0;g<256;g++) {
+		for(r=0;r<256;r++) {
+			Src[r*4+0] = (uint8_t)r;
+			Src[r*4+1] = (uint8_t)g;
+			Src[r*4+2] = (uint8_t)b;
+			Src[r*4+3] = 0xFF;
+		}
+		Job->Kernels->ConvertRowPlanar(pExact,  Src, 256, Job->Colourspace, 1, 0);
+		Job->Kernels->ConvertRowPlanar(pApprox, Src, 256, Job->Colourspace, 1, 1);
+		for(c=0;c<3;c++) for(r=0;r<256;r++) {
+			float d = fabsf(Approx[c][r] - Exact[c][r]);
+			if(d > MaxError[c]) MaxError[c] = d;
+		}
+	}
+}
+
+//! Measure the error of fast-math colour conversion
+//! Every opaque 24-bit RGB colour is converted both exactly and with
+//! fast-math, and the largest absolute difference in each channel of
+//! the target colourspace is stored to MaxError[].
+static void FastMathError(uint8_t Colourspace, float MaxError[3], uint32_t nThreads) {
+	uint32_t c, n;
+	struct ThreadPool_t Pool;
+	uint8_t UsePool = ThreadPool_Create(&Pool, nThreads);
+	nThreads = UsePool ? Pool.nThreads : 1;
+
+	//! Run jobs, keeping a separate maximum for each thread
+	float ThreadMaxError[nThreads][3];
+	for(n=0;n<nThreads;n++) for(c=0;c<3;c++) ThreadMaxError[n][c] = 0.0f;
+	struct FastMathErrorJob_t Job = {
+		.Kernels     = DitherKernels,
+		.Colourspace = Colourspace,
+		.MaxError    = ThreadMaxError,
+	};
+	if(UsePool) {
+		ThreadPool_Run(&Pool, 256, FastMathErrorJob, &Job);
+		ThreadPool_Destroy(&Pool);
+	} else {
+		for(n=0;n<256;n++) FastMathErrorJob(&Job, n, 0);
+	}
+
+	//! Combine results
+	for(c=0;c<3;c++) {
+		MaxError[c] = 0.0f;
+		for(n=0;n<nThreads;n++) if(ThreadMaxError[n][c] > MaxError[c]) MaxError[c] = ThreadMaxError[n][c];
+	}
+}
+
+//! Check the fast-math conversion error of every colourspace
+//! Returns the number of failed checks.
+static uint32_t CheckFastMathError(void) {
+	uint32_t i, c, nFailed = 0;
+	printf("Fast-math conversion error (over all 2^24 colours):\n");
+	for(i=0;i<N_COLOURSPACES;i++) {
+		float MaxError[3];
+		uint8_t Failed = 0;
+		FastMathError(FastMathBounds[i].Colourspace, MaxError, 0);
+		for(c=0;c<3;c++) if(MaxError[c] > FastMathBounds[i].MaxError[c]) Failed = 1;
+		printf(
+			"  %-10s %.3g, %.3g, %.3g (bound %.3g, %.3g, %.3g)%s\n",
+			FastMathBounds[i].Name,
+			MaxError[0], MaxError[1], MaxError[2],
+			FastMathBounds[i].MaxError[0], FastMathBounds[i].MaxError[1], FastMathBounds[i].MaxError[2],
+			Failed ? " FAILED" : ""
+		);
+		nFailed += Failed;
+	}
+	return nFailed;
+}
+
+//! Check the number of palette indices that fast-math changes on the corpus
+//! Returns the number of failed checks.
+static uint32_t CheckFastMathIndices(const char *CorpusDir) {
+	uint32_t i, j, k, m, nFailed = 0;
+	struct Corpus_t Corpus;
+	const struct CorpusFile_t *Images = Corpus.Images, *Palettes = Corpus.Palettes;
+	uint8_t  Loaded  = Corpus_Load(&Corpus, CorpusDir);
+	uint8_t *ExactPx = malloc(Corpus.MaxPixels);
+	uint8_t *FastPx  = malloc(Corpus.MaxPixels);
+	if(!Loaded || !ExactPx || !FastPx) {
+		if(Loaded) printf("ERROR: Out of memory.\n");
+		nFailed = 1;
+		goto Exit;
+	}
+
+	//! Dither every image to every palette with every dither, and count changes
+	printf("Fast-math palette index changes (over %u corpus dithers):\n", (uint32_t)(N_CORPUS_IMAGES*N_CORPUS_PALETTES*N_CORPUS_DITHERS));
+	for(i=0;i<N_COLOURSPACES;i++) {
+		uint32_t nChanged = 0, nPixels = 0;
+		uint8_t  Failed = 0;
+		for(j=0;j<N_CORPUS_IMAGES;j++) for(k=0;k<N_CORPUS_PALETTES;k++) for(m=0;m<N_CORPUS_DITHERS;m++) {
+			uint32_t n, nPx = Images[j].Width*Images[j].Height;
+			uint8_t Error = DITHER_OK;
+			for(n=0;n<2 && Error == DITHER_OK;n++) {
+				const struct DitherOptions_t Options = {.nThreads = 1, .Flags = n ? DITHER_FLAG_FASTMATH : 0};
+				Error = DitherPaletteImageEx(
+					n ? FastPx : ExactPx,
+					Images[j].Data,
+					Palettes[k].Data,
+					Images[j].Width,
+					Images[j].Height,
+					CorpusDithers[m].DitherType,
+					CorpusDithers[m].DitherLevel,
+					FastMathBounds[i].Colourspace,
+					0,
+					Palettes[k].nColours,
+					&Options
+				);
+			}
+			if(Error != DITHER_OK) {
+				printf("ERROR: Unable to dither %s (%s).\n", CorpusImages[j], DitherImage_ErrorString(Error));
+				Failed = 1;
+				continue;
+			}
+			for(n=0;n<nPx;n++) nChanged += (ExactPx[n] != FastPx[n]);
+			nPixels += nPx;
+		}
+		if(nChanged > FastMathBounds[i].MaxChanged) Failed = 1;
+		printf(
+			"  %-10s %u/%u (bound %u)%s\n",
+			FastMathBounds[i].Name,
+			nChanged, nPixels, FastMathBounds[i].MaxChanged,
+			Failed ? " FAILED" : ""
+		);
+		nFailed += Failed;
+	}
+
+Exit:
+	Corpus_Destroy(&Corpus);
+	free(ExactPx);
+	free(FastPx);
+	return nFailed;
+}
+
+/************************************************/
+
+//! Check that, with DITHER_FLAG_CLEAR0, only clear pixels get index 0
+//! Colour 0 of each palette is made transparent (as the CLI does).
+//! Returns the number of failed checks.
+static uint32_t CheckClear0(const char *CorpusDir) {
+	uint32_t i, j, k, m, nFailed = 0;
+	static const uint8_t DitherTypes[] = {DITHER_NONE, DITHER_FLOYDSTEINBERG, DITHER_ATKINSON, DITHER_CHECKER, DITHER_ORDERED(3)};
+	struct Corpus_t Corpus;
+	const struct CorpusFile_t *Images = Corpus.Images, *Palettes = Corpus.Palettes;
+	uint8_t  Loaded = Corpus_Load(&Corpus, CorpusDir);
+	uint8_t *DstPx  = malloc(Corpus.MaxPixels);
+	if(!Loaded || !DstPx) {
+		if(Loaded) printf("ERROR: Out of memory.\n");
+		nFailed = 1;
+		goto Exit;
+	}
+	for(k=0;k<N_CORPUS_PALETTES;k++) Corpus.Palettes[k].Data[3] = 0x00;
+
+	const struct DitherOptions_t Options = {.nThreads = 1, .Flags = DITHER_FLAG_CLEAR0};
+	printf("Non-clear pixels given index 0 with colour 0 clear:\n");
+	for(i=0;i<N_COLOURSPACES;i++) {
+		uint32_t nWrong = 0, nPixels = 0;
+		uint8_t  Failed = 0;
+		for(j=0;j<N_CORPUS_IMAGES;j++) for(k=0;k<N_CORPUS_PALETTES;k++) for(m=0;m<sizeof(DitherTypes);m++) {
+			uint32_t n, nPx = Images[j].Width*Images[j].Height;
+			uint8_t Error = DitherPaletteImageEx(
+				DstPx, Images[j].Data, Palettes[k].Data, Images[j].Width, Images[j].Height,
+				DitherTypes[m], 1.0f, FastMathBounds[i].Colourspace, 0, Palettes[k].nColours,
+				&Options
+			);
+			if(Error != DITHER_OK) {
+				printf("ERROR: Unable to dither %s (%s).\n", CorpusImages[j], DitherImage_ErrorString(Error));
+				Failed = 1;
+				continue;
+			}
+			for(n=0;n<nPx;n++) nWrong += (DstPx[n] == 0) != (Images[j].Data[n*4+3] == 0);
+			nPixels += nPx;
+		}
+		if(nWrong) Failed = 1;
+		printf("  %-10s %u/%u%s\n", FastMathBounds[i].Name, nWrong, nPixels, Failed ? " FAILED" : "");
+		nFailed += Failed;
+	}
+
+Exit:
+	Corpus_Destroy(&Corpus);
+	free(DstPx);
+	return nFailed;
+}
+
+/************************************************/
+
+//! Images for the thread-count invariance check
+//! These are wide, so that rows outside of the content (which need no
+//! diffusion) could easily finish long before the rows above them.
+#define THREADCHECK_WIDTH   20000
+#define THREADCHECK_HEIGHT  64
+#define THREADCHECK_REPEATS 4
+static const struct {
+	const char *Name;
+	uint32_t ContentY0, ContentY1; //! Opaque rows; all others are clear
+} ThreadCheckImages[] = {
+	{"clear below", 0,  22},
+	{"clear around", 22, 44},
+};
+#define N_THREADCHECK_IMAGES (sizeof(ThreadCheckImages) / sizeof(ThreadCheckImages[0]))
+
+//! Check that diffusion dithers give the same output regardless of the
+//! number of threads and the band size for streaming
+//! Returns the number of failed checks.
+static uint32_t CheckThreadInvariance(const char *CorpusDir) {
+	uint32_t i, m, n, y, nFailed = 0;
+	const uint32_t Width = THREADCHECK_WIDTH, Height = THREADCHECK_HEIGHT;
+	static const uint8_t DitherTypes[] = {DITHER_FLOYDSTEINBERG, DITHER_ATKINSON};
+	static const uint32_t BandRows[] = {64, 5};
+	struct CorpusFile_t Palette = {.Data = NULL};
+	uint8_t *SrcPx = malloc((size_t)Width*Height*4);
+	uint8_t *RefPx = malloc((size_t)Width*Height);
+	uint8_t *DstPx = malloc((size_t)Width*Height);
+	if(!CorpusFile_Load(&Palette, CorpusDir, "pal256.bmp", 1) || !SrcPx || !RefPx || !DstPx) {
+		if(Palette.Data) printf("ERROR: Out of memory.\n");
+		nFailed = 1;
+		goto Exit;
+	}
+
+	printf("Thread-count invariance (%ux%u, 1 thread vs. 4 threads and streaming):\n", Width, Height);
+	for(i=0;i<N_THREADCHECK_IMAGES;i++) {
+		//! Random opaque content, with clear rows outside of it
+		uint32_t Seed = 12345;
+		for(y=0;y<Height;y++) {
+			uint8_t *Row = SrcPx + (size_t)y*Width*4;
+			if(y < ThreadCheckImages[i].ContentY0 || y >= ThreadCheckImages[i].ContentY1) {
+				memset(Row, 0, Width*4);
+			} else for(n=0;n<Width;n++) {
+				Seed = Seed*1664525u + 1013904223u;
+				Row[n*4+0] = (uint8_t)(Seed >> 24);
+				Row[n*4+1] = (uint8_t)(Seed >> 16);
+				Row[n*4+2] = (uint8_t)(Seed >>  8);
+				Row[n*4+3] = 0xFF;
+			}
+		}
+
+		for(m=0;m<sizeof(DitherTypes)/sizeof(DitherTypes[0]);m++) {
+			uint32_t nMismatches = 0;
+			const struct DitherOptions_t Serial   = {.nThreads = 1, .Flags = DITHER_FLAG_CLEAR0};
+			const struct DitherOptions_t Threaded = {.nThreads = 4, .Flags = DITHER_FLAG_CLEAR0};
+			uint8_t Error = DitherPaletteImageEx(
+				RefPx, SrcPx, Palette.Data, Width, Height, DitherTypes[m], 1.0f,
+				COLOURSPACE_YCBCR_PSY, 0, Palette.nColours, &Serial
+			);
+			for(n=0;n<THREADCHECK_REPEATS && Error == DITHER_OK;n++) {
+				//! Whole image on 4 threads
+				Error = DitherPaletteImageEx(
+					DstPx, SrcPx, Palette.Data, Width, Height, DitherTypes[m], 1.0f,
+					COLOURSPACE_YCBCR_PSY, 0, Palette.nColours, &Threaded
+				);
+				if(Error == DITHER_OK) nMismatches += !!memcmp(RefPx, DstPx, (size_t)Width*Height);
+
+				//! Streamed in bands, on 4 threads
+				uint32_t b;
+				for(b=0;b<sizeof(BandRows)/sizeof(BandRows[0]) && Error == DITHER_OK;b++) {
+					struct DitherStream_t *Stream = DitherStream_Create(
+						Palette.Data, Width, BandRows[b], DitherTypes[m], 1.0f, NULL,
+						COLOURSPACE_YCBCR_PSY, 0, Palette.nColours,
+						4, 0, DITHER_FLAG_CLEAR0, NULL
+					);
+					if(!Stream) {
+						Error = DITHER_ERROR_MEMORY;
+						break;
+					}
+					for(y=0;y<Height && Error == DITHER_OK;y+=BandRows[b]) {
+						uint32_t nRows = (Height-y < BandRows[b]) ? (Height-y) : BandRows[b];
+						Error = DitherStream_Rows(Stream, DstPx + (size_t)y*Width, SrcPx + (size_t)y*Width*4, nRows);
+					}
+					DitherStream_Destroy(Stream);
+					nMismatches += !!memcmp(RefPx, DstPx, (size_t)Width*Height);
+				}
+			}
+			if(Error != DITHER_OK) printf("ERROR: Unable to dither (%s).\n", DitherImage_ErrorString(Error));
+			printf(
+				"  %-12s %-9s %u/%u runs differ%s\n",
+				ThreadCheckImages[i].Name,
+				(DitherTypes[m] == DITHER_FLOYDSTEINBERG) ? "floyd" : "atkinson",
+				nMismatches, THREADCHECK_REPEATS * (uint32_t)(1 + sizeof(BandRows)/sizeof(BandRows[0])),
+				(nMismatches || Error != DITHER_OK) ? " FAILED" : ""
+			);
+			nFailed += (nMismatches || Error != DITHER_OK);
+		}
+	}
+
+Exit:
+	free(Palette.Data);
+	free(SrcPx);
+	free(RefPx);
+	free(DstPx);
+	return nFailed;
+}
+
+/************************************************/
+
+int main(int argc, const char *argv[]) {
+	const char *CorpusDir = (argc > 1) ? argv[1] : "tests/corpus";
+	uint32_t nFailed = 0;
+	nFailed += CheckFastMathError();
+	nFailed += CheckFastMathIndices(CorpusDir);
+	nFailed += CheckClear0(CorpusDir);
+	nFailed += CheckThreadInvariance(CorpusDir);
+	if(nFailed) {
+		printf("%u check(s) FAILED.\n", nFailed);
+		return 1;
+	}
+	printf("All checks passed.\n");
+	return 0;
+}
+
+/************************************************/
+//! EOF
+/************************************************/